@@ -0,0 +1,324 @@
+
+/*
+ * Microbenchmark for the session scanners: ngx_strncasestrn() looking for
+ * the session name, ngx_strntok() looking for the end of its value, and
+ * ngx_strncmp_r() matching a srun_id against the tail of a route.
+ *
+ * Build it twice (see Makefile) to compare the SSE2 kernels with the
+ * scalar loops on the same corpora.
+ */
+
+
+#include "../ngx_http_upstream_jvm_route_module.c"
+
+
+#define BENCH_BYTES  (256 * 1024 * 1024)
+
+
+static const char *bench_cookie_parts[] = {
+    "_ga=GA1.2.1187654321.1601234567; ",
+    "_gid=GA1.2.998877665.1602345678; ",
+    "cart=%7B%22items%22%3A%5B%7B%22sku%22%3A%22A-1001%22%7D%5D%7D; ",
+    "locale=en_US; ",
+    "ab_test=variant-b; ",
+    "remember_me=ZXlKaGJHY2lPaUpJVXpJMU5pSjkuZXlKemRXSWlPaUl4TWpNMEluMA; ",
+    "recently_viewed=sku-1001,sku-2048,sku-4096,sku-8192; ",
+};
+
+static const char *bench_uri_parts[] = {
+    "/catalog/electronics/computers/laptops",
+    "?category=notebooks&sort=price_asc&page=3",
+    "&utm_source=newsletter&utm_medium=email&utm_campaign=autumn-sale",
+    "&filter%5Bbrand%5D=acme&filter%5Bram%5D=16gb&q=thin+and+light",
+};
+
+static const char *bench_value_parts[] = {
+    "4F2C0A9E1B7D35C86E0F5A3B2D1C9E8F",
+    "ZXlKaGJHY2lPaUpJVXpJMU5pSjkuZXlKemRXSWlPaUl4TWpNMEluMA",
+    ".node7",
+};
+
+#define BENCH_SESSION  "jsessionid"
+#define BENCH_VALUE    "=4F2C0A9E1B7D35C86E0F5A3B2D1C9E8F.a"
+
+
+static u_char *
+bench_corpus(const char **parts, size_t nparts, size_t len, ngx_uint_t hit,
+    const char *tail)
+{
+    u_char      *buf, *p;
+    size_t       n, tlen;
+    ngx_uint_t   i;
+
+    buf = malloc(len + 1);
+    if (buf == NULL) {
+        exit(1);
+    }
+
+    tlen = hit ? strlen(tail) : 0;
+    p = buf;
+
+    for (i = 0; (size_t) (p - buf) < len - tlen; i++) {
+        n = strlen(parts[i % nparts]);
+        n = ngx_min(n, len - tlen - (size_t) (p - buf));
+        p = ngx_cpymem(p, parts[i % nparts], n);
+    }
+
+    if (hit) {
+        p = ngx_cpymem(p, tail, tlen);
+    }
+
+    *p = '\0';
+
+    return buf;
+}
+
+
+static u_char *
+bench_naive_strncasestrn(u_char *s1, u_char *s2, size_t len1, size_t len2)
+{
+    size_t  i;
+
+    for (i = 0; i + len2 <= len1; i++) {
+        if (s1[i] == '\0') {
+            return NULL;
+        }
+
+        if (ngx_strncasecmp(s1 + i, s2, len2) == 0) {
+            return s1 + i;
+        }
+    }
+
+    return NULL;
+}
+
+
+static ngx_int_t
+bench_naive_strntok(u_char *s, const char *delim, size_t len)
+{
+    size_t  i;
+
+    for (i = 0; i < len; i++) {
+        if (memchr(delim, s[i], strlen(delim)) != NULL) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+
+static ngx_int_t
+bench_naive_strncmp_r(u_char *s1, u_char *s2, size_t len1, size_t len2)
+{
+    size_t  n;
+
+    if (len1 == 0 || len2 == 0) {
+        return -1;
+    }
+
+    for (n = 1; n <= ngx_min(len1, len2); n++) {
+        if (s1[len1 - n] != s2[len2 - n]) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+static void
+bench_check(void)
+{
+    u_char      buf[512];
+    size_t      len, nlen;
+    ngx_uint_t  i, j, n;
+
+    srandom(1);
+
+    for (n = 0; n < 200000; n++) {
+        len = random() % sizeof(buf);
+
+        for (i = 0; i < len; i++) {
+            j = random() % 16;
+            buf[i] = (u_char) (j < 14 ? "aAbB=;&?xXyYzZ"[j] : random() % 256);
+        }
+
+        nlen = 1 + random() % 4;
+
+        if (bench_naive_strncasestrn(buf, (u_char *) "aBxY" + (n % 3),
+                                     len, ngx_min(nlen, 4 - n % 3))
+            != ngx_strncasestrn(buf, (u_char *) "aBxY" + (n % 3),
+                                len, ngx_min(nlen, 4 - n % 3)))
+        {
+            fprintf(stderr, "ngx_strncasestrn() mismatch, case %lu\n",
+                    (unsigned long) n);
+            exit(1);
+        }
+
+        if ((bench_naive_strncmp_r(buf, buf + len / 2, len, len - len / 2) == 0)
+            != (ngx_strncmp_r(buf, buf + len / 2, len, len - len / 2) == 0)
+            || (bench_naive_strncmp_r(buf, (u_char *) "xA=", len, nlen % 4)
+                == 0)
+               != (ngx_strncmp_r(buf, (u_char *) "xA=", len, nlen % 4) == 0))
+        {
+            fprintf(stderr, "ngx_strncmp_r() mismatch, case %lu\n",
+                    (unsigned long) n);
+            exit(1);
+        }
+
+        if (bench_naive_strntok(buf, "?&;", len)
+            != ngx_strntok(buf, "?&;", len, sizeof("?&;") - 1))
+        {
+            fprintf(stderr, "ngx_strntok() mismatch, case %lu\n",
+                    (unsigned long) n);
+            exit(1);
+        }
+    }
+}
+
+
+static double
+bench_now(void)
+{
+    struct timespec  ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+static void
+bench_find(const char *what, u_char *s, size_t len)
+{
+    double            start, ns;
+    ngx_uint_t        i, loops;
+    volatile size_t   sink;
+
+    loops = BENCH_BYTES / len;
+    sink = 0;
+
+    start = bench_now();
+
+    for (i = 0; i < loops; i++) {
+        sink += (size_t) ngx_strncasestrn(s, (u_char *) BENCH_SESSION, len,
+                                          sizeof(BENCH_SESSION) - 1);
+    }
+
+    ns = (bench_now() - start) / loops;
+
+    printf("  %-5s %6lu bytes  %9.1f ns/op  %6.2f GB/s\n",
+           what, (unsigned long) len, ns, len / ns);
+
+    (void) sink;
+}
+
+
+static void
+bench_tok(u_char *s, size_t len)
+{
+    double            start, ns;
+    ngx_uint_t        i, loops;
+    volatile size_t   sink;
+
+    loops = BENCH_BYTES / len;
+    sink = 0;
+
+    start = bench_now();
+
+    for (i = 0; i < loops; i++) {
+        sink += ngx_strntok(s, "?&;", len, sizeof("?&;") - 1);
+    }
+
+    ns = (bench_now() - start) / loops;
+
+    printf("  value %6lu bytes  %9.1f ns/op  %6.2f GB/s\n",
+           (unsigned long) len, ns, len / ns);
+
+    (void) sink;
+}
+
+
+static void
+bench_rev(size_t len)
+{
+    u_char            route[64], srun_id[64];
+    double            start, ns;
+    ngx_uint_t        i, loops;
+    volatile size_t   sink;
+
+    ngx_memset(route, 'a', sizeof(route));
+    ngx_memset(srun_id, 'a', len);
+
+    loops = BENCH_BYTES / 64;
+    sink = 0;
+
+    start = bench_now();
+
+    for (i = 0; i < loops; i++) {
+        route[i % 8] = (u_char) i;
+        sink += ngx_strncmp_r(route, srun_id, sizeof(route), len);
+    }
+
+    ns = (bench_now() - start) / loops;
+
+    printf("  srun_id %4lu bytes  %9.1f ns/op\n", (unsigned long) len, ns);
+
+    (void) sink;
+}
+
+
+int
+main(int argc, char **argv)
+{
+    u_char      *s;
+    size_t       lens[] = { 64, 256, 1024, 4096, 8192 };
+    ngx_uint_t   i, hit;
+
+    bench_check();
+
+    printf("kernels: %s\n", NGX_HAVE_SSE2 ? "sse2" : "scalar");
+
+    printf("\nngx_strncasestrn(), Cookie header (session cookie last on hits)\n");
+
+    for (hit = 0; hit < 2; hit++) {
+        for (i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+            s = bench_corpus(bench_cookie_parts,
+                             sizeof(bench_cookie_parts) / sizeof(char *),
+                             lens[i], hit, BENCH_SESSION BENCH_VALUE);
+            bench_find(hit ? "hit" : "miss", s, lens[i]);
+            free(s);
+        }
+    }
+
+    printf("\nngx_strncasestrn(), URI (;jsessionid= path parameter on hits)\n");
+
+    for (hit = 0; hit < 2; hit++) {
+        for (i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+            s = bench_corpus(bench_uri_parts,
+                             sizeof(bench_uri_parts) / sizeof(char *),
+                             lens[i], hit, ";" BENCH_SESSION BENCH_VALUE);
+            bench_find(hit ? "hit" : "miss", s, lens[i]);
+            free(s);
+        }
+    }
+
+    printf("\nngx_strntok(), session value running to the end of the URI\n");
+
+    for (i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+        s = bench_corpus(bench_value_parts,
+                         sizeof(bench_value_parts) / sizeof(char *),
+                         lens[i], 0, NULL);
+        bench_tok(s, lens[i]);
+        free(s);
+    }
+
+    printf("\nngx_strncmp_r(), srun_id matching the tail of a 64 byte route\n");
+
+    for (i = 1; i <= 32; i *= 2) {
+        bench_rev(i);
+    }
+
+    return 0;
+}
@@ -0,0 +1,478 @@
+
+/*
+ * Microbenchmark for the peer selection: ngx_http_upstream_choose_by_jvm_route()
+ * with sticky hits and misses, the weighted round-robin of choose_peer(),
+ * and ngx_http_upstream_jvm_route_try_peer() alone, from 4 to 1024 peers.
+ *
+ * Besides ns/op it reports how the picks spread: for round-robin the worst
+ * deviation of a peer from its share of the weights, for jvm_route the part
+ * of the hits that reached the peer named by the route.
+ *
+ * The jvm_route_hash ring is checked for remapping: a fixed set of keys is
+ * hashed against N-1, N and N+1 peers, and the part of the keys that move
+ * is compared with the weight of the peer removed or added; a key that
+ * moves between two peers that stayed is an error.
+ */
+
+
+#include "../ngx_http_upstream_jvm_route_module.c"
+
+
+#define BENCH_OPS     2000000
+#define BENCH_ROUTES  4096
+#define BENCH_KEYS    100000
+
+
+typedef struct {
+    ngx_http_upstream_jvm_route_peers_t      *peers;
+    ngx_http_upstream_jvm_route_srv_conf_t    conf;
+    ngx_http_upstream_jvm_route_peer_data_t  *jrp;
+    ngx_uint_t                                nelts;
+} bench_upstream_t;
+
+
+static ngx_str_t  bench_name = ngx_string("backend");
+
+
+static void
+bench_init(bench_upstream_t *bu, ngx_uint_t npeers, ngx_uint_t format)
+{
+    u_char                                   *p;
+    ngx_uint_t                                i;
+    ngx_conf_t                                cf;
+    ngx_http_upstream_jvm_route_peer_t       *peer;
+    ngx_http_upstream_jvm_route_shm_block_t  *shm_block;
+
+    ngx_memzero(bu, sizeof(bench_upstream_t));
+    ngx_memzero(&cf, sizeof(ngx_conf_t));
+
+    bu->peers = ngx_calloc(sizeof(ngx_http_upstream_jvm_route_peers_t)
+                       + (npeers - 1) * sizeof(ngx_http_upstream_jvm_route_peer_t),
+                           NULL);
+    shm_block = ngx_calloc(sizeof(ngx_http_upstream_jvm_route_shm_block_t)
+                     + (npeers - 1) * sizeof(ngx_http_upstream_jvm_route_shared_t),
+                           NULL);
+    if (bu->peers == NULL || shm_block == NULL) {
+        exit(1);
+    }
+
+    bu->peers->number = npeers;
+    bu->peers->name = &bench_name;
+
+    for (i = 0; i < npeers; i++) {
+        peer = &bu->peers->peer[i];
+
+        p = malloc(NGX_INT_T_LEN + sizeof("node"));
+        if (p == NULL) {
+            exit(1);
+        }
+
+        peer->srun_id.data = p;
+        peer->srun_id.len = ngx_sprintf(p, "node%04ui", i) - p;
+
+        peer->name = peer->srun_id;
+        peer->weight = 1 + i % 3;
+        peer->max_fails = 1;
+        peer->fail_timeout = 10;
+    }
+
+    bu->conf.route_format = format;
+
+    if (ngx_http_upstream_jvm_route_init_hot(&cf, bu->peers, format) != NGX_OK) {
+        exit(1);
+    }
+
+    ngx_http_upstream_jvm_route_init_block(shm_block, bu->peers, NULL, 0);
+
+    bu->peers->current = npeers - 1;
+
+    bu->nelts = ngx_bitvector_nelts(npeers);
+
+    bu->jrp = ngx_calloc(sizeof(ngx_http_upstream_jvm_route_peer_data_t)
+                         + (bu->nelts - 1) * sizeof(uintptr_t), NULL);
+    if (bu->jrp == NULL) {
+        exit(1);
+    }
+
+    bu->jrp->tried = bu->jrp->data;
+    bu->jrp->peers = bu->peers;
+    bu->jrp->conf = &bu->conf;
+}
+
+
+static void
+bench_free(bench_upstream_t *bu)
+{
+    ngx_uint_t  i;
+
+    for (i = 0; i < bu->peers->number; i++) {
+        free(bu->peers->peer[i].srun_id.data);
+    }
+
+    free(bu->peers->shared);
+    free(bu->peers->points);
+    free(bu->peers);
+    free(bu->jrp);
+}
+
+
+/* what get_peer() does to a request before choose_peer() */
+
+static ngx_inline void
+bench_request(bench_upstream_t *bu)
+{
+    ngx_memzero(bu->jrp->tried, bu->nelts * sizeof(uintptr_t));
+
+    bu->jrp->current = (bu->peers->current + 1) % bu->peers->number;
+}
+
+
+static double
+bench_now(void)
+{
+    struct timespec  ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+static void
+bench_rr(ngx_uint_t npeers)
+{
+    double                  start, ns, share, dev, worst;
+    ngx_uint_t              i, total;
+    ngx_uint_t             *picks;
+    bench_upstream_t        bu;
+    ngx_peer_connection_t   pc;
+
+    bench_init(&bu, npeers, NGX_JVM_ROUTE_PREFIX);
+    ngx_memzero(&pc, sizeof(ngx_peer_connection_t));
+
+    picks = ngx_calloc(npeers * sizeof(ngx_uint_t), NULL);
+    if (picks == NULL) {
+        exit(1);
+    }
+
+    start = bench_now();
+
+    for (i = 0; i < BENCH_OPS; i++) {
+        bench_request(&bu);
+
+        if (ngx_http_upstream_jvm_route_choose_peer(&pc, bu.jrp) != NGX_OK) {
+            fprintf(stderr, "round-robin found no peer\n");
+            exit(1);
+        }
+
+        bu.peers->current = bu.jrp->index;
+        picks[bu.jrp->index]++;
+    }
+
+    ns = (bench_now() - start) / BENCH_OPS;
+
+    total = 0;
+
+    for (i = 0; i < npeers; i++) {
+        total += bu.peers->peer[i].weight;
+    }
+
+    worst = 0;
+
+    for (i = 0; i < npeers; i++) {
+        share = (double) BENCH_OPS * bu.peers->peer[i].weight / total;
+        dev = (picks[i] > share ? picks[i] - share : share - picks[i]) / share;
+
+        if (dev > worst) {
+            worst = dev;
+        }
+    }
+
+    printf("  rr     %5lu peers  %9.1f ns/op  worst share deviation %6.2f%%\n",
+           (unsigned long) npeers, ns, worst * 100);
+
+    free(picks);
+    bench_free(&bu);
+}
+
+
+static void
+bench_sticky(ngx_uint_t npeers, ngx_uint_t format, ngx_uint_t hits)
+{
+    u_char                 *p;
+    double                  start, ns;
+    ngx_str_t              *routes;
+    ngx_uint_t              i, n, loops, target, sticky, hit;
+    ngx_uint_t             *targets;
+    bench_upstream_t        bu;
+    ngx_peer_connection_t   pc;
+
+    bench_init(&bu, npeers, format);
+    ngx_memzero(&pc, sizeof(ngx_peer_connection_t));
+
+    routes = ngx_calloc(BENCH_ROUTES * sizeof(ngx_str_t), NULL);
+    targets = ngx_calloc(BENCH_ROUTES * sizeof(ngx_uint_t), NULL);
+    if (routes == NULL || targets == NULL) {
+        exit(1);
+    }
+
+    /* the routes as the session values carry them, hits naming a peer */
+
+    for (i = 0; i < BENCH_ROUTES; i++) {
+        p = malloc(64);
+        if (p == NULL) {
+            exit(1);
+        }
+
+        routes[i].data = p;
+        target = random() % npeers;
+
+        hit = (ngx_uint_t) (random() % 100) < hits;
+        targets[i] = hit ? target : NGX_PEER_INVALID;
+
+        if (format == NGX_JVM_ROUTE_REVERSE) {
+            p = ngx_sprintf(p, "4F2C0A9E1B7D35C86E0F5A3B.%s%04ui",
+                            hit ? "node" : "gone", target);
+
+        } else {
+            p = ngx_sprintf(p, "%s%04ui4F2C0A9E1B7D35C86E0F5A3B",
+                            hit ? "node" : "gone", target);
+        }
+
+        routes[i].len = p - routes[i].data;
+    }
+
+    sticky = 0;
+    hit = 0;
+
+    /* a miss scans every peer, keep the big upstreams short */
+
+    loops = BENCH_OPS / (1 + npeers / 16);
+
+    start = bench_now();
+
+    for (i = 0; i < loops; i++) {
+        bench_request(&bu);
+
+        bu.jrp->route = routes[i % BENCH_ROUTES];
+
+        n = ngx_http_upstream_choose_by_jvm_route(bu.jrp);
+
+        if (targets[i % BENCH_ROUTES] != NGX_PEER_INVALID) {
+            hit++;
+            sticky += (n == targets[i % BENCH_ROUTES]);
+        }
+    }
+
+    ns = (bench_now() - start) / loops;
+
+    printf("  %-7s %4lu peers %3lu%% hits  %9.1f ns/op  sticky %6.2f%%\n",
+           format == NGX_JVM_ROUTE_REVERSE ? "reverse" : "prefix",
+           (unsigned long) npeers, (unsigned long) hits, ns,
+           hit ? 100.0 * sticky / hit : 100.0);
+
+    if (sticky != hit) {
+        fprintf(stderr, "a route missed its peer\n");
+        exit(1);
+    }
+
+    for (i = 0; i < BENCH_ROUTES; i++) {
+        free(routes[i].data);
+    }
+
+    free(routes);
+    free(targets);
+    bench_free(&bu);
+}
+
+
+static void
+bench_try(ngx_uint_t npeers)
+{
+    double             start, ns;
+    ngx_uint_t         i, ok;
+    bench_upstream_t   bu;
+
+    bench_init(&bu, npeers, NGX_JVM_ROUTE_PREFIX);
+
+    /* a third of the peers busy, failed or limited */
+
+    for (i = 0; i < npeers; i += 3) {
+        bu.peers->hot[i].max_busy = 1;
+        bu.peers->shared->stats[i].nreq = 1;
+    }
+
+    for (i = 1; i < npeers; i += 6) {
+        bu.peers->shared->stats[i].fails = 1;
+        bu.peers->shared->stats[i].accessed = ngx_time();
+    }
+
+    ok = 0;
+
+    start = bench_now();
+
+    for (i = 0; i < BENCH_OPS; i++) {
+        ok += (ngx_http_upstream_jvm_route_try_peer(bu.jrp, i % npeers, 0)
+               == NGX_OK);
+    }
+
+    ns = (bench_now() - start) / BENCH_OPS;
+
+    printf("  try    %5lu peers  %9.1f ns/op  available %6.2f%%\n",
+           (unsigned long) npeers, ns, 100.0 * ok / BENCH_OPS);
+
+    bench_free(&bu);
+}
+
+
+/* the peer of every key on the ring of an upstream of npeers */
+
+static void
+bench_ring(ngx_uint_t npeers, uint32_t *hashes, ngx_uint_t *picks)
+{
+    ngx_uint_t         i;
+    ngx_conf_t         cf;
+    bench_upstream_t   bu;
+
+    bench_init(&bu, npeers, NGX_JVM_ROUTE_PREFIX);
+    ngx_memzero(&cf, sizeof(ngx_conf_t));
+
+    if (ngx_http_upstream_jvm_route_init_points(&cf, bu.peers) != NGX_OK) {
+        exit(1);
+    }
+
+    for (i = 0; i < BENCH_KEYS; i++) {
+        bench_request(&bu);
+
+        bu.jrp->hash = hashes[i];
+
+        picks[i] = ngx_http_upstream_choose_by_hash(bu.jrp, 0);
+
+        if (picks[i] == NGX_PEER_INVALID) {
+            fprintf(stderr, "the ring found no peer\n");
+            exit(1);
+        }
+    }
+
+    bench_free(&bu);
+}
+
+
+static void
+bench_remap(ngx_uint_t npeers)
+{
+    u_char       buf[32];
+    uint32_t    *hashes;
+    ngx_uint_t   i, total, less, more;
+    ngx_uint_t  *fewer, *same, *added;
+
+    hashes = ngx_calloc(BENCH_KEYS * sizeof(uint32_t), NULL);
+    fewer = ngx_calloc(BENCH_KEYS * sizeof(ngx_uint_t), NULL);
+    same = ngx_calloc(BENCH_KEYS * sizeof(ngx_uint_t), NULL);
+    added = ngx_calloc(BENCH_KEYS * sizeof(ngx_uint_t), NULL);
+    if (hashes == NULL || fewer == NULL || same == NULL || added == NULL) {
+        exit(1);
+    }
+
+    /* client addresses, the default key of jvm_route_hash */
+
+    for (i = 0; i < BENCH_KEYS; i++) {
+        hashes[i] = ngx_murmur_hash2(buf, ngx_sprintf(buf, "10.%ui.%ui.%ui",
+                                                      i >> 16, (i >> 8) & 0xff,
+                                                      i & 0xff) - buf);
+    }
+
+    bench_ring(npeers - 1, hashes, fewer);
+    bench_ring(npeers, hashes, same);
+    bench_ring(npeers + 1, hashes, added);
+
+    less = 0;
+    more = 0;
+
+    /* only the keys of the peer removed, or to the peer added, may move */
+
+    for (i = 0; i < BENCH_KEYS; i++) {
+        if (fewer[i] != same[i]) {
+            less++;
+
+            if (same[i] != npeers - 1) {
+                fprintf(stderr, "a key moved between two peers that stayed\n");
+                exit(1);
+            }
+        }
+
+        if (added[i] != same[i]) {
+            more++;
+
+            if (added[i] != npeers) {
+                fprintf(stderr, "a key moved between two peers that stayed\n");
+                exit(1);
+            }
+        }
+    }
+
+    /* the peers are the same up to the last one, of weight 1 + i % 3 */
+
+    total = 0;
+
+    for (i = 0; i < npeers; i++) {
+        total += 1 + i % 3;
+    }
+
+    printf("  ring   %5lu peers  -1 peer moved %6.2f%% (ideal %6.2f%%)"
+           "  +1 peer moved %6.2f%% (ideal %6.2f%%)\n",
+           (unsigned long) npeers,
+           100.0 * less / BENCH_KEYS,
+           100.0 * (1 + (npeers - 1) % 3) / total,
+           100.0 * more / BENCH_KEYS,
+           100.0 * (1 + npeers % 3) / (total + 1 + npeers % 3));
+
+    free(hashes);
+    free(fewer);
+    free(same);
+    free(added);
+}
+
+
+int
+main(int argc, char **argv)
+{
+    ngx_uint_t   i, j, hits[] = { 100, 50, 0 };
+    ngx_uint_t   peers[] = { 4, 16, 64, 256, 1024 };
+
+    srandom(1);
+    ngx_pid = getpid();
+    ngx_time_update();
+
+    printf("ngx_http_upstream_jvm_route_try_peer()\n");
+
+    for (i = 0; i < sizeof(peers) / sizeof(peers[0]); i++) {
+        bench_try(peers[i]);
+    }
+
+    printf("\nngx_http_upstream_choose_by_jvm_route(), "
+           "sticky hits and unknown routes\n");
+
+    for (i = 0; i < sizeof(peers) / sizeof(peers[0]); i++) {
+        for (j = 0; j < sizeof(hits) / sizeof(hits[0]); j++) {
+            bench_sticky(peers[i], NGX_JVM_ROUTE_PREFIX, hits[j]);
+            bench_sticky(peers[i], NGX_JVM_ROUTE_REVERSE, hits[j]);
+        }
+    }
+
+    printf("\nngx_http_upstream_choose_by_rr() through choose_peer(), "
+           "weights 1, 2, 3\n");
+
+    for (i = 0; i < sizeof(peers) / sizeof(peers[0]); i++) {
+        bench_rr(peers[i]);
+    }
+
+    printf("\nngx_http_upstream_choose_by_hash(), %d keys moved by a peer "
+           "removed or added\n", BENCH_KEYS);
+
+    for (i = 0; i < sizeof(peers) / sizeof(peers[0]); i++) {
+        bench_remap(peers[i]);
+    }
+
+    return 0;
+}
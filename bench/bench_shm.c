@@ -0,0 +1,391 @@
+
+/*
+ * Contention harness for the shared state.  Forked workers share one
+ * mmap'd block laid out like ngx_http_upstream_jvm_route_shm_block_t and
+ * run the module's get/free peer sequence at full speed, each keeping a
+ * few requests in flight, as nginx workers do with ngx_spinlock() on
+ * shared->lock.
+ *
+ * With -g, the block is initialized again while the workers of the
+ * previous generation are still running, as a reload does, and a new set
+ * of workers starts on it.
+ *
+ * When every worker is done it reports the throughput, the lock waits and
+ * the invariants: nreq and total_nreq back at zero, no negative
+ * current_weight, and the total_requests updates lost by the unlocked
+ * increment of init_jvm_route_peer().
+ */
+
+
+#include "../ngx_http_upstream_jvm_route_module.c"
+
+
+typedef struct {
+    ngx_uint_t      ops;
+    ngx_uint_t      busy;
+    ngx_uint_t      negative;
+    ngx_uint_t      waits;
+    uint64_t        wait_ns;
+    ngx_uint_t      done;
+
+    /* one result per cache line */
+    u_char          pad[16];
+} bench_result_t;
+
+
+static ngx_uint_t  bench_workers = 4;
+static ngx_uint_t  bench_requests = 1000000;
+static ngx_uint_t  bench_peers = 16;
+static ngx_uint_t  bench_inflight = 8;
+static ngx_uint_t  bench_fails = 1;
+static ngx_uint_t  bench_sticky = 50;
+static ngx_uint_t  bench_max_busy = 0;
+static ngx_uint_t  bench_generations = 1;
+
+static ngx_str_t   bench_name = ngx_string("backend");
+static ngx_log_t   bench_log = { NGX_LOG_EMERG, NULL, NULL };
+
+static ngx_http_upstream_jvm_route_srv_conf_t   bench_conf;
+
+
+static ngx_http_upstream_jvm_route_peers_t *
+bench_peers_init(ngx_uint_t npeers)
+{
+    u_char                                *p;
+    ngx_uint_t                             i;
+    ngx_conf_t                             cf;
+    ngx_http_upstream_jvm_route_peer_t    *peer;
+    ngx_http_upstream_jvm_route_peers_t   *peers;
+
+    ngx_memzero(&cf, sizeof(ngx_conf_t));
+
+    peers = ngx_calloc(sizeof(ngx_http_upstream_jvm_route_peers_t)
+                       + (npeers - 1) * sizeof(ngx_http_upstream_jvm_route_peer_t),
+                       NULL);
+    if (peers == NULL) {
+        exit(1);
+    }
+
+    peers->number = npeers;
+    peers->name = &bench_name;
+
+    for (i = 0; i < npeers; i++) {
+        peer = &peers->peer[i];
+
+        p = malloc(NGX_INT_T_LEN + sizeof("node"));
+        if (p == NULL) {
+            exit(1);
+        }
+
+        peer->srun_id.data = p;
+        peer->srun_id.len = ngx_sprintf(p, "node%04ui", i) - p;
+
+        peer->name = peer->srun_id;
+        peer->weight = 1 + i % 3;
+        peer->max_fails = 2;
+        peer->max_busy = bench_max_busy;
+        peer->fail_timeout = 1;
+    }
+
+    if (ngx_http_upstream_jvm_route_init_hot(&cf, peers, NGX_JVM_ROUTE_PREFIX)
+        != NGX_OK)
+    {
+        exit(1);
+    }
+
+    return peers;
+}
+
+
+static void
+bench_worker(ngx_http_upstream_jvm_route_peers_t *peers, bench_result_t *res)
+{
+    ngx_uint_t                                 i, n, slot, nelts;
+    ngx_peer_connection_t                     *pc;
+    ngx_http_upstream_jvm_route_peer_data_t  **jrp;
+
+    ngx_pid = getpid();
+    srandom(ngx_pid);
+
+    nelts = ngx_bitvector_nelts(peers->number);
+
+    pc = ngx_calloc(bench_inflight * sizeof(ngx_peer_connection_t), NULL);
+    jrp = ngx_calloc(bench_inflight * sizeof(void *), NULL);
+    if (pc == NULL || jrp == NULL) {
+        exit(1);
+    }
+
+    for (i = 0; i < bench_inflight; i++) {
+        jrp[i] = ngx_calloc(sizeof(ngx_http_upstream_jvm_route_peer_data_t)
+                            + (nelts - 1) * sizeof(uintptr_t), NULL);
+        if (jrp[i] == NULL) {
+            exit(1);
+        }
+
+        jrp[i]->tried = jrp[i]->data;
+        jrp[i]->peers = peers;
+        jrp[i]->conf = &bench_conf;
+        jrp[i]->current = NGX_PEER_INVALID;
+        pc[i].log = &bench_log;
+    }
+
+    for (i = 0; i < bench_requests + bench_inflight; i++) {
+        slot = i % bench_inflight;
+
+        /* the oldest request in flight is done */
+
+        if (jrp[slot]->current != NGX_PEER_INVALID) {
+            ngx_http_upstream_free_jvm_route_peer(&pc[slot], jrp[slot],
+                 (ngx_uint_t) (random() % 100) < bench_fails ? NGX_PEER_FAILED
+                                                             : 0);
+            jrp[slot]->current = NGX_PEER_INVALID;
+        }
+
+        if (i >= bench_requests) {
+            continue;
+        }
+
+        if ((i & 4095) == 0) {
+            ngx_time_update();
+        }
+
+        /* what init_jvm_route_peer() does, unlocked increment included */
+
+        ngx_memzero(jrp[slot]->tried, nelts * sizeof(uintptr_t));
+
+        jrp[slot]->current = peers->current;
+        jrp[slot]->route.len = 0;
+
+        if ((ngx_uint_t) (random() % 100) < bench_sticky) {
+            jrp[slot]->route = peers->peer[random() % peers->number].srun_id;
+        }
+
+        peers->shared->total_requests++;
+
+        pc[slot].tries = 1;
+
+        if (ngx_http_upstream_get_jvm_route_peer(&pc[slot], jrp[slot])
+            == NGX_BUSY)
+        {
+            res->busy++;
+
+        } else if (peers->shared->stats[jrp[slot]->index].current_weight < 0) {
+            res->negative++;
+        }
+
+        res->ops++;
+    }
+
+    for (n = 0; n < peers->number; n++) {
+        if (peers->shared->stats[n].current_weight < 0) {
+            res->negative++;
+        }
+    }
+
+    res->waits = ngx_stub_lock_waits;
+    res->wait_ns = ngx_stub_lock_wait_ns;
+
+    ngx_memory_barrier();
+    res->done = 1;
+
+    _exit(0);
+}
+
+
+static double
+bench_now(void)
+{
+    struct timespec  ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+static ngx_uint_t
+bench_arg(char *arg)
+{
+    ngx_int_t  n;
+
+    n = ngx_atoi((u_char *) arg, ngx_strlen(arg));
+
+    if (n == NGX_ERROR) {
+        fprintf(stderr, "invalid number \"%s\"\n", arg);
+        exit(1);
+    }
+
+    return n;
+}
+
+
+int
+main(int argc, char **argv)
+{
+    int                                       c, failed;
+    size_t                                    size;
+    double                                    start, ns;
+    ngx_uint_t                                g, i, n, half, ops, busy, negative,
+                                              waits, nreq, expected;
+    uint64_t                                  wait_ns;
+    bench_result_t                           *res;
+    ngx_http_upstream_jvm_route_peers_t      *peers;
+    ngx_http_upstream_jvm_route_shm_block_t  *shm_block;
+
+    bench_workers = sysconf(_SC_NPROCESSORS_ONLN);
+
+    while ((c = getopt(argc, argv, "w:n:p:i:f:s:b:g:")) != -1) {
+        switch (c) {
+        case 'w': bench_workers = bench_arg(optarg); break;
+        case 'n': bench_requests = bench_arg(optarg); break;
+        case 'p': bench_peers = bench_arg(optarg); break;
+        case 'i': bench_inflight = bench_arg(optarg); break;
+        case 'f': bench_fails = bench_arg(optarg); break;
+        case 's': bench_sticky = bench_arg(optarg); break;
+        case 'b': bench_max_busy = bench_arg(optarg); break;
+        case 'g': bench_generations = bench_arg(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-w workers] [-n requests per worker] "
+                    "[-p peers] [-i requests in flight per worker] "
+                    "[-f failed %%] [-s sticky %%] [-b max_busy] "
+                    "[-g generations]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (bench_workers == 0 || bench_peers == 0 || bench_inflight == 0
+        || bench_generations == 0)
+    {
+        fprintf(stderr, "workers, peers, in flight and generations "
+                "must not be zero\n");
+        return 1;
+    }
+
+    ngx_ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    ngx_pid = getpid();
+    ngx_time_update();
+
+    /* the zone, and the results of every worker of every generation */
+
+    size = sizeof(ngx_http_upstream_jvm_route_shm_block_t)
+           + (bench_peers - 1) * sizeof(ngx_http_upstream_jvm_route_shared_t);
+
+    shm_block = mmap(NULL, size, PROT_READ|PROT_WRITE,
+                     MAP_ANON|MAP_SHARED, -1, 0);
+
+    res = mmap(NULL, bench_generations * bench_workers * sizeof(bench_result_t),
+               PROT_READ|PROT_WRITE, MAP_ANON|MAP_SHARED, -1, 0);
+
+    if (shm_block == MAP_FAILED || res == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+
+    peers = bench_peers_init(bench_peers);
+
+    printf("%lu workers x %lu requests, %lu peers, %lu in flight, "
+           "%lu%% failed, %lu%% sticky, max_busy %lu, %lu generations\n",
+           (unsigned long) bench_workers, (unsigned long) bench_requests,
+           (unsigned long) bench_peers, (unsigned long) bench_inflight,
+           (unsigned long) bench_fails, (unsigned long) bench_sticky,
+           (unsigned long) bench_max_busy, (unsigned long) bench_generations);
+
+    start = bench_now();
+
+    for (g = 0; g < bench_generations; g++) {
+
+        /* a reload: the block is reset under the lock, the new workers
+         * see the next generation, the old ones keep running */
+
+        ngx_http_upstream_jvm_route_init_block(shm_block, peers, NULL, 0);
+        ngx_http_upstream_jvm_route_generation++;
+
+        for (i = 0; i < bench_workers; i++) {
+            switch (fork()) {
+            case -1:
+                perror("fork");
+                return 1;
+
+            case 0:
+                bench_worker(peers, &res[g * bench_workers + i]);
+            }
+        }
+
+        if (g + 1 == bench_generations) {
+            break;
+        }
+
+        /* the next reload comes when this generation is half way */
+
+        half = bench_workers * bench_requests / 2;
+
+        do {
+            sched_yield();
+
+            for (ops = 0, i = 0; i < bench_workers; i++) {
+                ops += res[g * bench_workers + i].ops;
+            }
+
+        } while (ops < half);
+    }
+
+    failed = 0;
+
+    while (wait(&c) > 0) {
+        if (!WIFEXITED(c) || WEXITSTATUS(c) != 0) {
+            failed = 1;
+        }
+    }
+
+    ns = bench_now() - start;
+
+    if (failed) {
+        fprintf(stderr, "a worker failed\n");
+        return 1;
+    }
+
+    ops = busy = negative = waits = 0;
+    wait_ns = 0;
+
+    for (i = 0; i < bench_generations * bench_workers; i++) {
+        ops += res[i].ops;
+        busy += res[i].busy;
+        negative += res[i].negative;
+        waits += res[i].waits;
+        wait_ns += res[i].wait_ns;
+    }
+
+    nreq = 0;
+
+    for (n = 0; n < bench_peers; n++) {
+        nreq += shm_block->stats[n].nreq;
+
+        if (shm_block->stats[n].current_weight < 0) {
+            negative++;
+        }
+    }
+
+    printf("  %10.0f requests/s, %lu busy\n", ops * 1e9 / ns,
+           (unsigned long) busy);
+
+    printf("  %10lu lock waits (%.2f%% of 2 locks per request), "
+           "%.1f ns per wait, %.1f ns per request\n",
+           (unsigned long) waits, 100.0 * waits / (2 * ops),
+           waits ? (double) wait_ns / waits : 0.0, (double) wait_ns / ops);
+
+    printf("  nreq drift %ld, total_nreq drift %ld, negative weights %lu\n",
+           (long) nreq, (long) shm_block->total_nreq, (unsigned long) negative);
+
+    /* the increments before the last reset are gone with it */
+
+    if (bench_generations == 1) {
+        expected = bench_workers * bench_requests;
+
+        printf("  total_requests %lu of %lu, %lu lost updates\n",
+               (unsigned long) shm_block->total_requests,
+               (unsigned long) expected,
+               (unsigned long) (expected - shm_block->total_requests));
+    }
+
+    return (nreq || shm_block->total_nreq || negative) ? 2 : 0;
+}
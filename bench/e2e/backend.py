@@ -0,0 +1,240 @@
+#!/usr/bin/env python3
+
+"""
+Mock JVM backends for the jvm_route load tests.
+
+One process serves --peers backends on consecutive ports of --host from
+--port.  Backend i has the route "node<i>", i in two digits, and issues
+session cookies the way its container would:
+
+    tomcat:  JSESSIONID=<id>.node07       (jvm_route ... reverse)
+    resin:   JSESSIONID=node07<id>        (jvm_route ..., the default)
+
+A request whose session names another route is a failover: the backend
+issues a new session of its own, as a container that does not know the
+session does.  Every response carries X-Route so the load generator can
+tell where a request went.
+
+Latency, errors and GC-like pauses are set per backend on the command
+line, and changed at run time through the control port:
+
+    GET /down?peer=2          close connections to backend 2
+    GET /up?peer=2            serve them again
+    GET /pause?peer=2&ms=3000 stop backend 2 for 3 seconds, like a full GC
+    GET /latency?peer=2&ms=50 add 50ms to every response of backend 2
+"""
+
+import argparse
+import asyncio
+import os
+import random
+import sys
+import urllib.parse
+
+
+class Backend:
+
+    def __init__(self, index, args):
+        self.index = index
+        self.route = "node%02d" % index
+        self.style = args.style
+        self.latency = args.latency / 1000.0
+        self.errors = args.errors / 100.0
+        self.gc_every = args.gc_every
+        self.gc_pause = args.gc_ms / 1000.0
+        self.down = False
+        self.paused_until = 0.0
+        self.requests = 0
+        self.active = 0
+        self.max_active = 0
+
+    def session(self, cookie):
+        """The session id of the cookie if it belongs to this backend."""
+
+        if cookie is None:
+            return None
+
+        if self.style == "tomcat":
+            sid, _, route = cookie.rpartition(".")
+            return sid if route == self.route else None
+
+        return cookie[len(self.route):] if cookie.startswith(self.route) else None
+
+    def new_cookie(self):
+        sid = os.urandom(16).hex().upper()
+
+        if self.style == "tomcat":
+            return "%s.%s" % (sid, self.route)
+
+        return self.route + sid
+
+    async def pause(self):
+        loop = asyncio.get_running_loop()
+
+        if self.gc_every and self.requests % self.gc_every == 0:
+            self.paused_until = loop.time() + self.gc_pause
+
+        wait = self.paused_until - loop.time()
+        if wait > 0:
+            await asyncio.sleep(wait)
+
+    async def handle(self, reader, writer):
+        try:
+            while True:
+                head = await reader.readuntil(b"\r\n\r\n")
+
+                if self.down:
+                    break
+
+                lines = head.decode("latin-1").split("\r\n")
+                cookie = None
+                length = 0
+
+                for line in lines[1:]:
+                    name, _, value = line.partition(":")
+                    name = name.strip().lower()
+
+                    if name == "cookie":
+                        for c in value.split(";"):
+                            k, _, v = c.strip().partition("=")
+                            if k == "JSESSIONID":
+                                cookie = v
+
+                    elif name == "content-length":
+                        length = int(value)
+
+                if length:
+                    await reader.readexactly(length)
+
+                self.requests += 1
+                self.active += 1
+                self.max_active = max(self.max_active, self.active)
+
+                try:
+                    await self.pause()
+
+                    if self.latency:
+                        await asyncio.sleep(self.latency)
+
+                finally:
+                    self.active -= 1
+
+                if random.random() < self.errors:
+                    writer.write(b"HTTP/1.1 500 Internal Server Error\r\n"
+                                 b"Content-Length: 0\r\n"
+                                 b"X-Route: " + self.route.encode() + b"\r\n"
+                                 b"\r\n")
+                    await writer.drain()
+                    continue
+
+                extra = b""
+
+                if self.session(cookie) is None:
+                    extra = ("Set-Cookie: JSESSIONID=%s; Path=/\r\n"
+                             % self.new_cookie()).encode()
+
+                body = b"ok\n"
+
+                writer.write(b"HTTP/1.1 200 OK\r\n"
+                             b"Content-Type: text/plain\r\n"
+                             b"Content-Length: " + str(len(body)).encode()
+                             + b"\r\n"
+                             b"X-Route: " + self.route.encode() + b"\r\n"
+                             + extra + b"\r\n" + body)
+
+                await writer.drain()
+
+        except (asyncio.IncompleteReadError, ConnectionError):
+            pass
+
+        finally:
+            writer.close()
+
+
+async def control(backends, reader, writer):
+    try:
+        line = (await reader.readuntil(b"\r\n\r\n")).decode("latin-1")
+        target = line.split(" ")[1]
+        url = urllib.parse.urlsplit(target)
+        query = dict(urllib.parse.parse_qsl(url.query))
+        body = ""
+
+        if url.path == "/stats":
+            for b in backends:
+                body += "%s requests %d max_active %d%s\n" % (
+                    b.route, b.requests, b.max_active,
+                    " down" if b.down else "")
+
+        else:
+            b = backends[int(query.get("peer", 0))]
+            ms = int(query.get("ms", 0)) / 1000.0
+            loop = asyncio.get_running_loop()
+
+            if url.path == "/down":
+                b.down = True
+            elif url.path == "/up":
+                b.down = False
+            elif url.path == "/pause":
+                b.paused_until = loop.time() + ms
+            elif url.path == "/latency":
+                b.latency = ms
+            else:
+                raise ValueError(url.path)
+
+            body = "%s %s\n" % (b.route, url.path[1:])
+
+        writer.write(("HTTP/1.1 200 OK\r\nContent-Length: %d\r\n"
+                      "Connection: close\r\n\r\n%s" % (len(body), body))
+                     .encode())
+
+    except (ValueError, IndexError, KeyError):
+        writer.write(b"HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\n"
+                     b"Connection: close\r\n\r\n")
+
+    await writer.drain()
+    writer.close()
+
+
+async def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                    formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--peers", type=int, default=4)
+    parser.add_argument("--host", default="127.0.0.1",
+                        help="the loopback address of the backends")
+    parser.add_argument("--port", type=int, default=18080,
+                        help="the port of the first backend")
+    parser.add_argument("--control", type=int, default=18079)
+    parser.add_argument("--style", choices=("tomcat", "resin"),
+                        default="tomcat")
+    parser.add_argument("--latency", type=float, default=0,
+                        help="milliseconds added to every response")
+    parser.add_argument("--errors", type=float, default=0,
+                        help="percent of responses that are 500")
+    parser.add_argument("--gc-every", type=int, default=0,
+                        help="pause a backend every N of its requests")
+    parser.add_argument("--gc-ms", type=float, default=500)
+    args = parser.parse_args()
+
+    backends = [Backend(i, args) for i in range(args.peers)]
+    servers = []
+
+    for b in backends:
+        servers.append(await asyncio.start_server(b.handle, args.host,
+                                                  args.port + b.index,
+                                                  backlog=1024))
+
+    servers.append(await asyncio.start_server(
+        lambda r, w: control(backends, r, w), "127.0.0.1", args.control))
+
+    print("%d %s backends on %s:%d-%d, control on %d"
+          % (args.peers, args.style, args.host, args.port,
+             args.port + args.peers - 1, args.control), file=sys.stderr)
+
+    await asyncio.gather(*(s.serve_forever() for s in servers))
+
+
+if __name__ == "__main__":
+    try:
+        asyncio.run(main())
+    except KeyboardInterrupt:
+        pass
@@ -0,0 +1,129 @@
+#!/usr/bin/env python3
+
+"""
+Stub DNS server for the jvm_route load tests.
+
+It answers the A queries of the names in --zone, a file of lines
+
+    name address [address ...]
+
+read again on every query, so a test changes the records by writing the
+file.  A name that is not in the file is NXDOMAIN; other query types of a
+known name get an empty answer.  Point nginx at it with
+
+    resolver 127.0.0.1:18053 valid=1s ipv6=off;
+"""
+
+import argparse
+import asyncio
+import socket
+import struct
+import sys
+
+
+def zone(path):
+    records = {}
+
+    try:
+        with open(path) as f:
+            for line in f:
+                fields = line.split()
+                if len(fields) >= 2 and not fields[0].startswith("#"):
+                    records[fields[0].lower().rstrip(".")] = fields[1:]
+
+    except OSError:
+        pass
+
+    return records
+
+
+def answer(query, path):
+    """The response to one query, or None if it is not a query."""
+
+    if len(query) < 12:
+        return None
+
+    qid, flags, qdcount = struct.unpack("!HHH", query[:6])
+
+    if flags & 0x8000 or qdcount != 1:
+        return None
+
+    labels = []
+    pos = 12
+
+    while pos < len(query) and query[pos] != 0:
+        n = query[pos]
+        labels.append(query[pos + 1:pos + 1 + n].decode("ascii", "replace"))
+        pos += 1 + n
+
+    pos += 1
+
+    if pos + 4 > len(query):
+        return None
+
+    qtype, qclass = struct.unpack("!HH", query[pos:pos + 4])
+    question = query[12:pos + 4]
+    name = ".".join(labels).lower()
+
+    addresses = zone(path).get(name)
+    answers = b""
+    count = 0
+
+    if addresses is None:
+        rcode = 3
+
+    else:
+        rcode = 0
+
+        if qtype == 1 and qclass == 1:
+            for a in addresses:
+                answers += struct.pack("!HHHIH", 0xc00c, 1, 1, 1, 4)
+                answers += socket.inet_aton(a)
+                count += 1
+
+    header = struct.pack("!HHHHHH", qid, 0x8180 | (flags & 0x0100) | rcode,
+                         1, count, 0, 0)
+
+    return header + question + answers
+
+
+class Server(asyncio.DatagramProtocol):
+
+    def __init__(self, path):
+        self.path = path
+        self.transport = None
+
+    def connection_made(self, transport):
+        self.transport = transport
+
+    def datagram_received(self, data, addr):
+        response = answer(data, self.path)
+
+        if response is not None:
+            self.transport.sendto(response, addr)
+
+
+async def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                    formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--port", type=int, default=18053)
+    parser.add_argument("--zone", required=True,
+                        help="the file of the records")
+    args = parser.parse_args()
+
+    loop = asyncio.get_running_loop()
+
+    await loop.create_datagram_endpoint(lambda: Server(args.zone),
+                                        local_addr=("127.0.0.1", args.port))
+
+    print("dns on 127.0.0.1:%d, records in %s" % (args.port, args.zone),
+          file=sys.stderr)
+
+    await asyncio.Event().wait()
+
+
+if __name__ == "__main__":
+    try:
+        asyncio.run(main())
+    except KeyboardInterrupt:
+        pass
@@ -0,0 +1,187 @@
+#!/usr/bin/env python3
+
+"""
+Session-heavy load generator for the jvm_route load tests.
+
+--sessions clients each keep a JSESSIONID cookie across their requests,
+the way browsers do; --new percent of the requests come from a new client
+without a cookie.  --concurrency connections are kept alive to nginx.
+
+It prints the throughput, the latency percentiles, the sticky-hit ratio
+(the requests with a cookie answered by the backend the cookie names) and
+the requests per backend, from the X-Route header of the mock backends.
+"""
+
+import argparse
+import asyncio
+import collections
+import random
+import time
+import urllib.parse
+
+
+class Stats:
+
+    def __init__(self):
+        self.latencies = []
+        self.status = collections.Counter()
+        self.routes = collections.Counter()
+        self.sticky = 0
+        self.moved = 0
+        self.errors = 0
+
+
+def route_of(cookie, style):
+    if cookie is None:
+        return None
+
+    if style == "tomcat":
+        return cookie.rpartition(".")[2]
+
+    # resin: node<N><hex id>, the id is 32 upper case hex digits
+    return cookie[:-32]
+
+
+async def client(args, url, sessions, stats, deadline):
+    reader = writer = None
+
+    while time.monotonic() < deadline:
+
+        if writer is None:
+            try:
+                reader, writer = await asyncio.open_connection(url.hostname,
+                                                               url.port or 80)
+            except OSError:
+                stats.errors += 1
+                await asyncio.sleep(0.01)
+                continue
+
+        if random.random() * 100 < args.new:
+            slot = None
+            cookie = None
+        else:
+            slot = random.randrange(len(sessions))
+            cookie = sessions[slot]
+
+        request = ("GET %s HTTP/1.1\r\nHost: %s\r\n"
+                   % (url.path or "/", url.netloc))
+
+        if cookie:
+            request += "Cookie: JSESSIONID=%s\r\n" % cookie
+
+        start = time.monotonic()
+
+        try:
+            writer.write((request + "\r\n").encode())
+            head = await reader.readuntil(b"\r\n\r\n")
+
+        except (asyncio.IncompleteReadError, ConnectionError):
+            stats.errors += 1
+            writer.close()
+            writer = None
+            continue
+
+        lines = head.decode("latin-1").split("\r\n")
+        status = int(lines[0].split(" ")[1])
+        length = 0
+        route = None
+        set_cookie = None
+        close = False
+
+        for line in lines[1:]:
+            name, _, value = line.partition(":")
+            name = name.strip().lower()
+            value = value.strip()
+
+            if name == "content-length":
+                length = int(value)
+            elif name == "x-route":
+                route = value
+            elif name == "set-cookie" and value.startswith("JSESSIONID="):
+                set_cookie = value[11:].split(";")[0]
+            elif name == "connection" and value.lower() == "close":
+                close = True
+
+        if length:
+            await reader.readexactly(length)
+
+        stats.latencies.append(time.monotonic() - start)
+        stats.status[status] += 1
+
+        if route:
+            stats.routes[route] += 1
+
+        if cookie and route:
+            if route_of(cookie, args.style) == route:
+                stats.sticky += 1
+            else:
+                stats.moved += 1
+
+        if set_cookie and slot is not None:
+            sessions[slot] = set_cookie
+
+        elif set_cookie:
+            sessions[random.randrange(len(sessions))] = set_cookie
+
+        if close:
+            writer.close()
+            writer = None
+
+
+def percentile(values, p):
+    if not values:
+        return 0.0
+
+    return values[min(len(values) - 1, int(len(values) * p / 100))]
+
+
+async def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("url", nargs="?", default="http://127.0.0.1:18000/")
+    parser.add_argument("--sessions", type=int, default=1000)
+    parser.add_argument("--concurrency", type=int, default=64)
+    parser.add_argument("--duration", type=float, default=20)
+    parser.add_argument("--new", type=float, default=5,
+                        help="percent of requests from new clients")
+    parser.add_argument("--style", choices=("tomcat", "resin"),
+                        default="tomcat")
+    args = parser.parse_args()
+
+    url = urllib.parse.urlsplit(args.url)
+    sessions = [None] * args.sessions
+    stats = Stats()
+
+    start = time.monotonic()
+    deadline = start + args.duration
+
+    await asyncio.gather(*(client(args, url, sessions, stats, deadline)
+                           for _ in range(args.concurrency)))
+
+    elapsed = time.monotonic() - start
+    lat = sorted(stats.latencies)
+    total = len(lat)
+    with_cookie = stats.sticky + stats.moved
+
+    print("requests      %d in %.1fs, %.0f/s, %d connection errors"
+          % (total, elapsed, total / elapsed, stats.errors))
+    print("latency       p50 %.1fms  p99 %.1fms  p999 %.1fms  max %.1fms"
+          % (percentile(lat, 50) * 1000, percentile(lat, 99) * 1000,
+             percentile(lat, 99.9) * 1000, (lat[-1] if lat else 0) * 1000))
+    print("status        " + "  ".join("%d: %d" % s
+                                       for s in sorted(stats.status.items())))
+    print("sticky hits   %.2f%% of %d requests with a session"
+          % (100.0 * stats.sticky / with_cookie if with_cookie else 100.0,
+             with_cookie))
+
+    if stats.routes:
+        mean = sum(stats.routes.values()) / len(stats.routes)
+        print("balance       max/mean %.2f over %d backends"
+              % (max(stats.routes.values()) / mean, len(stats.routes)))
+
+        for route, n in sorted(stats.routes.items(),
+                               key=lambda r: int(r[0][4:])):
+            print("  %-10s %8d  %5.1f%%" % (route, n, 100.0 * n / total))
+
+
+if __name__ == "__main__":
+    asyncio.run(main())
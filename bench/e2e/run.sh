@@ -0,0 +1,379 @@
+#!/bin/sh
+
+# End-to-end load tests of the jvm_route module on one Linux box: nginx
+# built with the module, mock JVM backends on loopback and a session-heavy
+# load generator.
+#
+#   NGINX_SRC=/path/to/nginx-1.24.0 ./run.sh [scenario ...]
+#
+# The scenarios are baseline, failure, busy, gc, reload, resin, resolve and
+# sync; all of them run by default.  nginx is built once into $WORK (./work by
+# default); PEERS, DURATION, CONCURRENCY and SESSIONS tune every scenario.
+# A scenario that checks the module prints FAILED and makes run.sh exit 1.
+
+set -e
+
+E2E=$(cd "$(dirname "$0")" && pwd)
+MODULE=$(cd "$E2E/../.." && pwd)
+
+WORK=${WORK:-$E2E/work}
+PEERS=${PEERS:-4}
+DURATION=${DURATION:-20}
+CONCURRENCY=${CONCURRENCY:-64}
+SESSIONS=${SESSIONS:-1000}
+
+NGINX=$WORK/nginx/sbin/nginx
+CONF=$WORK/nginx/conf/nginx.conf
+CONF_B=$WORK/nginx/conf/nginx-b.conf
+LISTEN=18000
+BACKEND_PORT=18080
+CONTROL_PORT=18079
+MOVED_CONTROL_PORT=18078
+DNS_PORT=18053
+SYNC_PORT=17946
+
+PYTHON=${PYTHON:-python3}
+
+
+build() {
+    [ -x "$NGINX" ] && return
+
+    if [ -z "$NGINX_SRC" ]; then
+        echo "set NGINX_SRC to an nginx source tree" >&2
+        exit 1
+    fi
+
+    if ! grep -q '"1\.24\.' "$NGINX_SRC/src/core/nginx.h" 2>/dev/null; then
+        echo "jvm_route.patch is made for nginx 1.24.0, $NGINX_SRC is not" >&2
+        exit 1
+    fi
+
+    rm -rf "$WORK/src"
+    mkdir -p "$WORK"
+    cp -r "$NGINX_SRC" "$WORK/src"
+
+    (cd "$WORK/src" \
+     && patch -p0 < "$MODULE/jvm_route.patch" \
+     && ./configure --prefix="$WORK/nginx" --add-module="$MODULE" \
+                    --with-stream \
+                    --without-http_rewrite_module --without-http_gzip_module \
+     && make -j"$(nproc)" && make install) > "$WORK/build.log" 2>&1 \
+    || { echo "the build failed, see $WORK/build.log" >&2; exit 1; }
+}
+
+
+# conf style max_busy: the upstream of the scenario, with the host,
+# server_opts, upstream_opts and http_opts that run() sets
+
+conf() {
+    servers=""
+    i=0
+
+    while [ $i -lt "$PEERS" ]; do
+        servers="$servers
+        server $host:$((BACKEND_PORT + i)) srun_id=node$(printf %02d $i) max_fails=2 fail_timeout=5s${2:+ max_busy=$2}$server_opts;"
+        i=$((i + 1))
+    done
+
+    if [ "$1" = tomcat ]; then
+        jvm_route='jvm_route $cookie_JSESSIONID reverse;'
+    else
+        jvm_route='jvm_route $cookie_JSESSIONID;'
+    fi
+
+    cat > "$CONF" <<EOF
+worker_processes  $(nproc);
+error_log  logs/error.log  error;
+pid        logs/nginx.pid;
+
+events {
+    worker_connections  4096;
+}
+
+http {
+    access_log  off;
+$http_opts
+    upstream backend {$servers
+        $jvm_route
+$upstream_opts
+    }
+
+    server {
+        listen  127.0.0.1:$LISTEN;
+
+        location / {
+            proxy_pass  http://backend;
+            proxy_next_upstream  error timeout http_500;
+        }
+
+        location /status {
+            jvm_route_status backend;
+        }
+    }
+}
+EOF
+}
+
+
+fetch() {
+    $PYTHON -c "import sys, urllib.request; \
+        sys.stdout.write(urllib.request.urlopen('$1').read().decode())"
+}
+
+
+ctl() {
+    fetch "http://127.0.0.1:$CONTROL_PORT/$1"
+}
+
+
+fail() {
+    echo "FAILED: $*"
+    touch "$WORK/failed"
+}
+
+
+# the slot, srun_id, total_req and address of every peer in the status
+
+peers() {
+    sed -n 's/^ peer \([0-9]*\): \([^(]*\)(\([^)]*\)).*total_req: \([0-9]*\),.*/\1 \3 \4 \2/p'
+}
+
+
+# status-a status-b srun_id seconds: the milliseconds from the first fails
+# of srun_id in the status at a to the first in the status at b, polled
+# every 20ms; exits 1 if b shows none within the seconds
+
+synced() {
+    $PYTHON - "$@" <<'PY'
+import re, sys, time, urllib.request
+
+a, b, srun_id, limit = sys.argv[1], sys.argv[2], sys.argv[3], float(sys.argv[4])
+
+def fails(url):
+    status = urllib.request.urlopen(url).read().decode()
+    m = re.search(r"\(%s\) down: \d+, fails: (\d+)" % re.escape(srun_id), status)
+    return int(m.group(1)) if m else 0
+
+start = time.time()
+seen = None
+
+while time.time() - start < limit:
+    if seen is None and fails(a):
+        seen = time.time()
+
+    if seen is not None and fails(b):
+        print("%d" % ((time.time() - seen) * 1000))
+        sys.exit(0)
+
+    time.sleep(0.02)
+
+sys.exit(1)
+PY
+}
+
+
+# scenario style max_busy backend-options: run the load against a fresh
+# nginx and fresh backends; the caller's "during" hook acts on them
+
+scenario() {
+    name=$1
+    style=$2
+    max_busy=$3
+    shift 3
+
+    echo
+    echo "== $name"
+
+    conf "$style" "$max_busy"
+
+    $PYTHON "$E2E/backend.py" --peers "$PEERS" --port $BACKEND_PORT \
+        --control $CONTROL_PORT --style "$style" "$@" &
+    backends=$!
+
+    "$NGINX" -c "$CONF"
+    sleep 1
+
+    during &
+    hook=$!
+
+    $PYTHON "$E2E/load.py" "http://127.0.0.1:$LISTEN/" --style "$style" \
+        --duration "$DURATION" --concurrency "$CONCURRENCY" \
+        --sessions "$SESSIONS" || true
+
+    wait $hook || true
+
+    echo "backends:"
+    ctl stats | sed 's/^/  /'
+    echo "jvm_route_status:"
+    fetch "http://127.0.0.1:$LISTEN/status" | sed 's/^/  /'
+
+    "$NGINX" -c "$CONF" -s quit
+    kill $backends
+    wait $backends 2>/dev/null || true
+    sleep 1
+}
+
+
+run() {
+    host=127.0.0.1
+    server_opts=""
+    upstream_opts=""
+    http_opts=""
+
+    case $1 in
+
+    baseline)
+        during() { :; }
+        scenario baseline tomcat "" --latency 2
+        ;;
+
+    failure)
+        # backend 1 dies a third of the way in and comes back at two thirds
+        during() {
+            sleep $((DURATION / 3)); ctl "down?peer=1"
+            sleep $((DURATION / 3)); ctl "up?peer=1"
+        }
+        scenario failure tomcat "" --latency 2
+        ;;
+
+    busy)
+        # slow backends with max_busy=4: the overflow of a sticky peer
+        # spills to the others, and 502 when every peer is full
+        during() { :; }
+        scenario busy tomcat 4 --latency 50
+        ;;
+
+    gc)
+        # a 500ms pause every 2000 requests of each backend
+        during() { :; }
+        scenario gc tomcat "" --latency 2 --gc-every 2000 --gc-ms 500
+        ;;
+
+    reload)
+        # three reloads under load: sessions stay sticky, the counters of
+        # the old workers are left out of the new generation
+        during() {
+            for n in 1 2 3; do
+                sleep $((DURATION / 4)); "$NGINX" -c "$CONF" -s reload
+            done
+        }
+        scenario reload tomcat "" --latency 2
+        ;;
+
+    resin)
+        during() { :; }
+        scenario resin resin "" --latency 2
+        ;;
+
+    resolve)
+        # the servers are "localhost", resolved again every second by the
+        # stub DNS server; a third of the way in it moves them to the same
+        # routes on 127.0.0.2, and each peer must keep its slot, srun_id
+        # and counters in the shared memory
+        host=localhost
+        server_opts=" resolve"
+        upstream_opts="        jvm_route_resolve_interval 1s;"
+        http_opts="    resolver 127.0.0.1:$DNS_PORT valid=1s ipv6=off;"
+
+        echo "localhost 127.0.0.1" > "$WORK/dns.zone"
+        $PYTHON "$E2E/dns.py" --port $DNS_PORT --zone "$WORK/dns.zone" &
+        dns=$!
+
+        $PYTHON "$E2E/backend.py" --peers "$PEERS" --host 127.0.0.2 \
+            --port $BACKEND_PORT --control $MOVED_CONTROL_PORT \
+            --style tomcat --latency 2 &
+        moved=$!
+
+        during() {
+            sleep $((DURATION / 3))
+            fetch "http://127.0.0.1:$LISTEN/status" | peers > "$WORK/before"
+            echo "localhost 127.0.0.2" > "$WORK/dns.zone"
+
+            sleep $((DURATION / 3))
+            fetch "http://127.0.0.1:$LISTEN/status" | peers > "$WORK/after"
+
+            if [ "$(wc -l < "$WORK/before")" -ne "$PEERS" ] \
+               || ! grep -q " 127\.0\.0\.1:" "$WORK/before"
+            then
+                fail "resolve: the peers did not start on 127.0.0.1"
+            fi
+
+            paste -d ' ' "$WORK/before" "$WORK/after" | awk '
+                $1 != $5 || $2 != $6 || $7 < $3 { bad = 1 }
+                $8 !~ /^127\.0\.0\.2:/ { bad = 1 }
+                END { exit bad }' \
+            || fail "resolve: a peer lost its slot, srun_id or total_req," \
+                    "or did not move to 127.0.0.2"
+
+            echo "resolve: slot srun_id total_req address, before and after"
+            paste -d ' ' "$WORK/before" "$WORK/after" | sed 's/^/  /'
+        }
+
+        scenario resolve tomcat "" --latency 2
+
+        echo "backends on 127.0.0.2:"
+        fetch "http://127.0.0.1:$MOVED_CONTROL_PORT/stats" | sed 's/^/  /'
+
+        if ! fetch "http://127.0.0.1:$MOVED_CONTROL_PORT/stats" \
+             | awk '$3 == 0 { bad = 1 } END { exit bad }'
+        then
+            fail "resolve: a backend on 127.0.0.2 got no requests"
+        fi
+
+        kill $dns $moved
+        wait $dns $moved 2>/dev/null || true
+        ;;
+
+    sync)
+        # a second nginx on the next port shares the failures over
+        # jvm_route_sync and gets no load: when backend 1 dies behind the
+        # first one, the second must see its fails within two intervals
+        http_opts="    jvm_route_sync 127.0.0.1:$SYNC_PORT 127.0.0.1:$((SYNC_PORT + 1)) interval=200ms;"
+
+        during() {
+            sed -e "s/127.0.0.1:$SYNC_PORT 127.0.0.1:$((SYNC_PORT + 1))/127.0.0.1:$((SYNC_PORT + 1)) 127.0.0.1:$SYNC_PORT/" \
+                -e "s/listen  127.0.0.1:$LISTEN;/listen  127.0.0.1:$((LISTEN + 1));/" \
+                -e "s,logs/nginx\.pid,logs/nginx-b.pid," \
+                -e "s,logs/error\.log,logs/error-b.log," \
+                "$CONF" > "$CONF_B"
+            "$NGINX" -c "$CONF_B"
+
+            sleep $((DURATION / 3)); ctl "down?peer=1"
+
+            if ms=$(synced "http://127.0.0.1:$LISTEN/status" \
+                           "http://127.0.0.1:$((LISTEN + 1))/status" node01 5)
+            then
+                echo "sync: node01 failed on the second nginx ${ms}ms after the first"
+                [ "$ms" -le 400 ] \
+                || fail "sync: node01 took ${ms}ms to fail on the second nginx"
+            else
+                fail "sync: node01 never failed on the second nginx"
+            fi
+
+            sleep $((DURATION / 3)); ctl "up?peer=1"
+
+            "$NGINX" -c "$CONF_B" -s quit
+        }
+
+        scenario sync tomcat "" --latency 2
+        ;;
+
+    *)
+        echo "unknown scenario \"$1\"" >&2
+        exit 1
+        ;;
+    esac
+}
+
+
+build
+
+[ $# -eq 0 ] && set -- baseline failure busy gc reload resin resolve sync
+
+rm -f "$WORK/failed"
+
+for s in "$@"; do
+    run "$s"
+done
+
+[ ! -e "$WORK/failed" ]
@@ -0,0 +1,687 @@
+
+/*
+ * Replays an access log into the module's peer selection, with simulated
+ * peers, to compare weight, max_busy, max_fails/fail_timeout and the route
+ * format on real traffic before a rollout.
+ *
+ * The log has one request per line:
+ *
+ *     timestamp session_cookie uri upstream_time
+ *
+ * as written by
+ *
+ *     log_format  replay  '$msec $cookie_JSESSIONID $request_uri '
+ *                         '$upstream_response_time';
+ *
+ * A request holds its peer for upstream_time times the latency factor of
+ * the peer, and fails with the failure rate of the peer; a failed request
+ * is tried on the next peer as proxy_next_upstream does.  The sessions of
+ * the log get their routes from the simulated peers: the first request of
+ * a session, or one whose peer does not take it, gets a new session on the
+ * peer chosen, as a JVM that does not know the session does.
+ *
+ * It prints the requests and failures per peer against its share of the
+ * weights, how often sticky requests were sent to another peer, and how
+ * many peers the sessions were spread over.  With -c it writes the load
+ * curve of every peer, the requests and the most in flight per interval.
+ */
+
+
+#include "../ngx_http_upstream_jvm_route_module.c"
+
+
+typedef struct {
+    double                                    done;
+    ngx_uint_t                                session;
+    double                                    time;
+    ngx_peer_connection_t                     pc;
+    ngx_http_upstream_jvm_route_peer_data_t  *jrp;
+
+    /* the session value, the route of retries points into it */
+    u_char                                    cookie[256];
+} replay_request_t;
+
+
+typedef struct {
+    u_char                                   *cookie;
+    size_t                                    len;
+    ngx_uint_t                                peer;
+    ngx_uint_t                                requests;
+    ngx_uint_t                                moved;
+} replay_session_t;
+
+
+typedef struct {
+    double                                    latency;
+    double                                    fail;
+
+    ngx_uint_t                                requests;
+    ngx_uint_t                                fails;
+    ngx_uint_t                                inflight;
+    ngx_uint_t                                max_inflight;
+
+    ngx_uint_t                                curve_requests;
+    ngx_uint_t                                curve_inflight;
+} replay_peer_t;
+
+
+static ngx_http_upstream_jvm_route_srv_conf_t   replay_conf;
+static ngx_http_upstream_jvm_route_peers_t     *replay_peers;
+static replay_peer_t                           *replay_sim;
+static ngx_uint_t                               replay_nelts;
+
+static ngx_str_t   replay_name = ngx_string("backend");
+static ngx_log_t   replay_log = { NGX_LOG_EMERG, NULL, NULL };
+static ngx_time_t  replay_time;
+
+/* the requests in flight, a heap on their end */
+static replay_request_t  **replay_heap;
+static ngx_uint_t          replay_nheap, replay_heap_size;
+
+/* the sessions, open addressing on the hash of the cookie */
+static replay_session_t   *replay_sessions;
+static ngx_uint_t          replay_nsessions, replay_sessions_size;
+
+static ngx_uint_t  replay_total, replay_cookieless, replay_sticky,
+                   replay_moved, replay_busy, replay_retries, replay_failed;
+
+
+static void
+replay_clock(double t)
+{
+    replay_time.sec = (time_t) t;
+    replay_time.msec = (ngx_uint_t) ((t - replay_time.sec) * 1000);
+
+    ngx_current_msec = (ngx_msec_t) (t * 1000);
+}
+
+
+static void
+replay_heap_push(replay_request_t *rr)
+{
+    ngx_uint_t         i, parent;
+    replay_request_t  *tmp;
+
+    if (replay_nheap == replay_heap_size) {
+        replay_heap_size = replay_heap_size ? replay_heap_size * 2 : 1024;
+        replay_heap = realloc(replay_heap,
+                              replay_heap_size * sizeof(replay_request_t *));
+        if (replay_heap == NULL) {
+            exit(1);
+        }
+    }
+
+    i = replay_nheap++;
+    replay_heap[i] = rr;
+
+    while (i > 0) {
+        parent = (i - 1) / 2;
+
+        if (replay_heap[parent]->done <= replay_heap[i]->done) {
+            break;
+        }
+
+        tmp = replay_heap[parent];
+        replay_heap[parent] = replay_heap[i];
+        replay_heap[i] = tmp;
+        i = parent;
+    }
+}
+
+
+static replay_request_t *
+replay_heap_pop(void)
+{
+    ngx_uint_t         i, child;
+    replay_request_t  *rr, *tmp;
+
+    rr = replay_heap[0];
+    replay_heap[0] = replay_heap[--replay_nheap];
+
+    i = 0;
+
+    for ( ;; ) {
+        child = 2 * i + 1;
+
+        if (child >= replay_nheap) {
+            break;
+        }
+
+        if (child + 1 < replay_nheap
+            && replay_heap[child + 1]->done < replay_heap[child]->done)
+        {
+            child++;
+        }
+
+        if (replay_heap[i]->done <= replay_heap[child]->done) {
+            break;
+        }
+
+        tmp = replay_heap[child];
+        replay_heap[child] = replay_heap[i];
+        replay_heap[i] = tmp;
+        i = child;
+    }
+
+    return rr;
+}
+
+
+static replay_session_t *
+replay_session(u_char *cookie, size_t len)
+{
+    ngx_uint_t         i, n, size;
+    replay_session_t  *s, *old;
+
+    if (2 * (replay_nsessions + 1) > replay_sessions_size) {
+        old = replay_sessions;
+        size = replay_sessions_size;
+
+        replay_sessions_size = size ? size * 2 : 65536;
+        replay_sessions = calloc(replay_sessions_size, sizeof(replay_session_t));
+        if (replay_sessions == NULL) {
+            exit(1);
+        }
+
+        for (i = 0; i < size; i++) {
+            if (old[i].cookie == NULL) {
+                continue;
+            }
+
+            n = ngx_murmur_hash2(old[i].cookie, old[i].len)
+                & (replay_sessions_size - 1);
+
+            while (replay_sessions[n].cookie) {
+                n = (n + 1) & (replay_sessions_size - 1);
+            }
+
+            replay_sessions[n] = old[i];
+        }
+
+        free(old);
+    }
+
+    n = ngx_murmur_hash2(cookie, len) & (replay_sessions_size - 1);
+
+    for ( ;; ) {
+        s = &replay_sessions[n];
+
+        if (s->cookie == NULL) {
+            break;
+        }
+
+        if (s->len == len && ngx_memcmp(s->cookie, cookie, len) == 0) {
+            return s;
+        }
+
+        n = (n + 1) & (replay_sessions_size - 1);
+    }
+
+    s->cookie = malloc(len);
+    if (s->cookie == NULL) {
+        exit(1);
+    }
+
+    ngx_memcpy(s->cookie, cookie, len);
+    s->len = len;
+    s->peer = NGX_PEER_INVALID;
+
+    replay_nsessions++;
+
+    return s;
+}
+
+
+/* choose a peer for the request, as get_peer() does for nginx */
+
+static ngx_int_t
+replay_get(replay_request_t *rr, double now, double upstream_time)
+{
+    replay_peer_t  *sim;
+
+    if (ngx_http_upstream_get_jvm_route_peer(&rr->pc, rr->jrp) == NGX_BUSY) {
+        return NGX_BUSY;
+    }
+
+    sim = &replay_sim[rr->jrp->index];
+
+    sim->requests++;
+    sim->curve_requests++;
+    sim->inflight++;
+
+    if (sim->inflight > sim->max_inflight) {
+        sim->max_inflight = sim->inflight;
+    }
+
+    if (sim->inflight > sim->curve_inflight) {
+        sim->curve_inflight = sim->inflight;
+    }
+
+    rr->time = upstream_time;
+    rr->done = now + upstream_time * sim->latency;
+
+    replay_heap_push(rr);
+
+    return NGX_OK;
+}
+
+
+static void
+replay_free(replay_request_t *rr)
+{
+    free(rr->jrp);
+    free(rr);
+}
+
+
+/* the requests done by now: free their peers, retry the failed ones */
+
+static void
+replay_complete(double now)
+{
+    ngx_uint_t         failed;
+    replay_peer_t     *sim;
+    replay_request_t  *rr;
+
+    while (replay_nheap && replay_heap[0]->done <= now) {
+        rr = replay_heap_pop();
+
+        replay_clock(rr->done);
+
+        sim = &replay_sim[rr->jrp->index];
+        sim->inflight--;
+
+        failed = (random() % 10000) < sim->fail * 100;
+
+        if (failed) {
+            sim->fails++;
+        }
+
+        ngx_http_upstream_free_jvm_route_peer(&rr->pc, rr->jrp,
+                                              failed ? NGX_PEER_FAILED : 0);
+
+        if (failed && rr->pc.tries > 0) {
+            replay_retries++;
+
+            if (replay_get(rr, rr->done, rr->time) == NGX_OK) {
+                continue;
+            }
+        }
+
+        if (failed) {
+            replay_failed++;
+        }
+
+        replay_free(rr);
+    }
+}
+
+
+static void
+replay_request(double now, u_char *cookie, size_t len, u_char *uri,
+    size_t uri_len, double upstream_time)
+{
+    u_char                                  *buf;
+    ngx_str_t                                val;
+    replay_session_t                        *s;
+    replay_request_t                         *rr;
+    ngx_http_upstream_jvm_route_peer_t       *peer;
+    ngx_http_upstream_jvm_route_peer_data_t  *jrp;
+
+    rr = calloc(1, sizeof(replay_request_t));
+    jrp = calloc(1, sizeof(ngx_http_upstream_jvm_route_peer_data_t)
+                    + (replay_nelts - 1) * sizeof(uintptr_t));
+    if (rr == NULL || jrp == NULL) {
+        exit(1);
+    }
+
+    rr->jrp = jrp;
+    buf = rr->cookie;
+    rr->pc.log = &replay_log;
+    rr->pc.tries = replay_peers->number;
+
+    if (replay_conf.tries && replay_conf.tries < replay_peers->number) {
+        rr->pc.tries = replay_conf.tries;
+    }
+
+    jrp->tried = jrp->data;
+    jrp->peers = replay_peers;
+    jrp->conf = &replay_conf;
+    jrp->current = replay_peers->current;
+
+    s = NULL;
+
+    if (len) {
+        s = replay_session(cookie, len);
+        s->requests++;
+
+        /* the session value as the JVM of the session wrote it */
+
+        if (s->peer != NGX_PEER_INVALID) {
+            peer = &replay_peers->peer[s->peer];
+            len = ngx_min(len, sizeof(rr->cookie) - peer->srun_id.len - 1);
+
+            if (replay_conf.route_format == NGX_JVM_ROUTE_REVERSE) {
+                val.data = buf;
+                val.len = ngx_sprintf(buf, "%*s.%V", len, cookie,
+                                      &peer->srun_id) - buf;
+
+            } else {
+                val.data = buf;
+                val.len = ngx_sprintf(buf, "%V%*s", &peer->srun_id,
+                                      len, cookie) - buf;
+            }
+
+            ngx_http_upstream_jvm_route_get_route(&replay_conf, &val,
+                                                  &jrp->route);
+            replay_sticky++;
+        }
+
+    } else {
+        replay_cookieless++;
+    }
+
+    if (jrp->route.len == 0 && replay_peers->points) {
+        jrp->hash = len ? ngx_murmur_hash2(cookie, len)
+                        : ngx_murmur_hash2(uri, uri_len);
+        jrp->hashed = 1;
+    }
+
+    replay_peers->shared->total_requests++;
+    replay_total++;
+
+    if (replay_get(rr, now, upstream_time) != NGX_OK) {
+        replay_busy++;
+        replay_free(rr);
+        return;
+    }
+
+    if (s == NULL) {
+        return;
+    }
+
+    if (s->peer != NGX_PEER_INVALID && s->peer != jrp->index) {
+        s->moved++;
+        replay_moved++;
+    }
+
+    s->peer = jrp->index;
+}
+
+
+static void
+replay_add_peer(char *spec, ngx_array_t *peers, ngx_array_t *sims)
+{
+    char                                *p, *field[7];
+    ngx_uint_t                           n;
+    replay_peer_t                       *sim;
+    ngx_http_upstream_jvm_route_peer_t  *peer;
+
+    ngx_memzero(field, sizeof(field));
+
+    for (n = 0, p = strtok(spec, ":"); p && n < 7; p = strtok(NULL, ":")) {
+        field[n++] = p;
+    }
+
+    peer = ngx_array_push(peers);
+    sim = ngx_array_push(sims);
+    if (peer == NULL || sim == NULL) {
+        exit(1);
+    }
+
+    ngx_memzero(peer, sizeof(ngx_http_upstream_jvm_route_peer_t));
+    ngx_memzero(sim, sizeof(replay_peer_t));
+
+    peer->srun_id.data = (u_char *) field[0];
+    peer->srun_id.len = ngx_strlen(field[0]);
+    peer->name = peer->srun_id;
+
+    peer->weight = field[1] ? atoi(field[1]) : 1;
+    peer->max_busy = field[2] ? atoi(field[2]) : 0;
+    peer->max_fails = field[3] ? atoi(field[3]) : 1;
+    peer->fail_timeout = field[4] ? atoi(field[4]) : 10;
+
+    sim->latency = field[5] ? atof(field[5]) : 1.0;
+    sim->fail = field[6] ? atof(field[6]) : 0;
+}
+
+
+static void
+replay_usage(char *name)
+{
+    fprintf(stderr,
+        "usage: %s [-r] [-H] [-t tries] [-c curve.csv] [-i interval]\n"
+        "       -p srun_id[:weight[:max_busy[:max_fails[:fail_timeout"
+        "[:latency[:fail%%]]]]]] ... [access.log]\n"
+        "  -r  srun_id is the suffix of the session (tomcat, \"reverse\")\n"
+        "  -H  jvm_route_hash for requests without a session route\n"
+        "  latency multiplies the upstream time of the log, fail%% is the\n"
+        "  part of the requests to the peer that fail\n", name);
+
+    exit(1);
+}
+
+
+int
+main(int argc, char **argv)
+{
+    int                                   c;
+    char                                 *p, *curve_file;
+    FILE                                 *log, *curve;
+    u_char                               *cookie, *uri, line[8192];
+    double                                t, upstream_time, interval, next, w;
+    ngx_uint_t                            i, n, moved[3], total_weight;
+    ngx_conf_t                            cf;
+    ngx_array_t                           peers, sims;
+    replay_peer_t                        *sim;
+    ngx_http_upstream_jvm_route_peer_t   *peer;
+    ngx_http_upstream_jvm_route_shm_block_t  *shm_block;
+
+    curve_file = NULL;
+    interval = 60;
+
+    ngx_memzero(&cf, sizeof(ngx_conf_t));
+
+    if (ngx_array_init(&peers, NULL, 8,
+                       sizeof(ngx_http_upstream_jvm_route_peer_t)) != NGX_OK
+        || ngx_array_init(&sims, NULL, 8, sizeof(replay_peer_t)) != NGX_OK)
+    {
+        return 1;
+    }
+
+    while ((c = getopt(argc, argv, "rHt:c:i:p:")) != -1) {
+        switch (c) {
+        case 'r': replay_conf.route_format = NGX_JVM_ROUTE_REVERSE; break;
+        case 'H': replay_conf.hash = 1; break;
+        case 't': replay_conf.tries = atoi(optarg); break;
+        case 'c': curve_file = optarg; break;
+        case 'i': interval = atof(optarg); break;
+        case 'p': replay_add_peer(optarg, &peers, &sims); break;
+        default: replay_usage(argv[0]);
+        }
+    }
+
+    if (peers.nelts == 0 || interval <= 0) {
+        replay_usage(argv[0]);
+    }
+
+    log = stdin;
+
+    if (optind < argc && (log = fopen(argv[optind], "r")) == NULL) {
+        perror(argv[optind]);
+        return 1;
+    }
+
+    curve = NULL;
+
+    if (curve_file && (curve = fopen(curve_file, "w")) == NULL) {
+        perror(curve_file);
+        return 1;
+    }
+
+    /* the upstream as init_jvm_route() builds it */
+
+    n = peers.nelts;
+
+    replay_peers = calloc(1, sizeof(ngx_http_upstream_jvm_route_peers_t)
+                     + (n - 1) * sizeof(ngx_http_upstream_jvm_route_peer_t));
+    shm_block = calloc(1, sizeof(ngx_http_upstream_jvm_route_shm_block_t)
+                     + (n - 1) * sizeof(ngx_http_upstream_jvm_route_shared_t));
+    if (replay_peers == NULL || shm_block == NULL) {
+        return 1;
+    }
+
+    replay_peers->number = n;
+    replay_peers->name = &replay_name;
+    ngx_memcpy(replay_peers->peer, peers.elts,
+               n * sizeof(ngx_http_upstream_jvm_route_peer_t));
+
+    replay_sim = sims.elts;
+    replay_nelts = ngx_bitvector_nelts(n);
+
+    if (replay_conf.hash
+        && ngx_http_upstream_jvm_route_init_points(&cf, replay_peers) != NGX_OK)
+    {
+        return 1;
+    }
+
+    if (ngx_http_upstream_jvm_route_init_hot(&cf, replay_peers,
+                                             replay_conf.route_format)
+        != NGX_OK)
+    {
+        return 1;
+    }
+
+    ngx_cached_time = &replay_time;
+
+    ngx_http_upstream_jvm_route_init_block(shm_block, replay_peers, NULL, 0);
+    ngx_http_upstream_jvm_route_generation++;
+
+    replay_peers->current = n - 1;
+
+    if (curve) {
+        fprintf(curve, "time");
+
+        for (i = 0; i < n; i++) {
+            fprintf(curve, ",%.*s_requests,%.*s_inflight",
+                    (int) replay_peers->peer[i].srun_id.len,
+                    replay_peers->peer[i].srun_id.data,
+                    (int) replay_peers->peer[i].srun_id.len,
+                    replay_peers->peer[i].srun_id.data);
+        }
+
+        fprintf(curve, "\n");
+    }
+
+    next = 0;
+
+    while (fgets((char *) line, sizeof(line), log)) {
+
+        t = strtod((char *) line, NULL);
+
+        (void) strtok((char *) line, " \t\n");
+        cookie = (u_char *) strtok(NULL, " \t\n");
+        uri = (u_char *) strtok(NULL, " \t\n");
+        p = strtok(NULL, " \t\n");
+
+        if (t <= 0 || cookie == NULL || uri == NULL) {
+            continue;
+        }
+
+        /* "-" when nginx answered itself, a short request then */
+
+        upstream_time = (p && p[0] != '-') ? strtod(p, NULL) : 0.05;
+
+        if (next == 0) {
+            next = t + interval;
+        }
+
+        /* the load curve of the intervals that ended before this request */
+
+        while (t >= next) {
+            replay_complete(next);
+
+            if (curve) {
+                fprintf(curve, "%.0f", next - interval);
+
+                for (i = 0; i < n; i++) {
+                    fprintf(curve, ",%lu,%lu",
+                            (unsigned long) replay_sim[i].curve_requests,
+                            (unsigned long) replay_sim[i].curve_inflight);
+
+                    replay_sim[i].curve_requests = 0;
+                    replay_sim[i].curve_inflight = replay_sim[i].inflight;
+                }
+
+                fprintf(curve, "\n");
+            }
+
+            next += interval;
+        }
+
+        replay_complete(t);
+        replay_clock(t);
+
+        if (cookie[0] == '-' && cookie[1] == '\0') {
+            cookie[0] = '\0';
+        }
+
+        replay_request(t, cookie, ngx_strlen(cookie), uri, ngx_strlen(uri),
+                       upstream_time);
+    }
+
+    replay_complete(1e18);
+
+    if (curve) {
+        fclose(curve);
+    }
+
+    /* the report */
+
+    printf("requests %lu, without a session %lu, sessions %lu\n",
+           (unsigned long) replay_total, (unsigned long) replay_cookieless,
+           (unsigned long) replay_nsessions);
+
+    printf("sticky requests %lu, sent to another peer %lu (%.3f%%)\n",
+           (unsigned long) replay_sticky, (unsigned long) replay_moved,
+           replay_sticky ? 100.0 * replay_moved / replay_sticky : 0.0);
+
+    printf("no peer (502) %lu, retries %lu, failed %lu\n",
+           (unsigned long) replay_busy, (unsigned long) replay_retries,
+           (unsigned long) replay_failed);
+
+    moved[0] = moved[1] = moved[2] = 0;
+
+    for (i = 0; i < replay_sessions_size; i++) {
+        if (replay_sessions[i].cookie) {
+            moved[ngx_min(replay_sessions[i].moved, 2)]++;
+        }
+    }
+
+    printf("sessions on 1 peer %lu, on 2 peers %lu, on 3 or more %lu\n",
+           (unsigned long) moved[0], (unsigned long) moved[1],
+           (unsigned long) moved[2]);
+
+    total_weight = 0;
+
+    for (i = 0; i < n; i++) {
+        total_weight += replay_peers->peer[i].weight;
+    }
+
+    printf("\n  %-16s %6s %10s %7s %7s %8s %8s\n", "peer", "weight",
+           "requests", "share", "weight", "fails", "inflight");
+
+    for (i = 0; i < n; i++) {
+        peer = &replay_peers->peer[i];
+        sim = &replay_sim[i];
+        w = total_weight ? 100.0 * peer->weight / total_weight : 0;
+
+        printf("  %-16.*s %6ld %10lu %6.2f%% %6.2f%% %8lu %8lu\n",
+               (int) peer->srun_id.len, peer->srun_id.data,
+               (long) peer->weight, (unsigned long) sim->requests,
+               replay_total ? 100.0 * sim->requests / replay_total : 0.0, w,
+               (unsigned long) sim->fails, (unsigned long) sim->max_inflight);
+    }
+
+    return 0;
+}
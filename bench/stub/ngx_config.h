@@ -0,0 +1,79 @@
+
+/*
+ * Minimal stand-in for nginx's ngx_config.h, just enough to compile the
+ * jvm_route module's logic outside of an nginx source tree.
+ */
+
+
+#ifndef _NGX_CONFIG_H_INCLUDED_
+#define _NGX_CONFIG_H_INCLUDED_
+
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sched.h>
+
+
+typedef intptr_t        ngx_int_t;
+typedef uintptr_t       ngx_uint_t;
+typedef intptr_t        ngx_flag_t;
+typedef int             ngx_err_t;
+typedef int             ngx_fd_t;
+typedef int             ngx_socket_t;
+typedef pid_t           ngx_pid_t;
+typedef ngx_uint_t      ngx_msec_t;
+typedef ngx_int_t       ngx_msec_int_t;
+
+
+#define NGX_INT_T_LEN   (sizeof("-9223372036854775808") - 1)
+#define NGX_MAX_INT_T_VALUE  9223372036854775807
+#define NGX_MAX_UINT32_VALUE  (uint32_t) 0xffffffff
+
+#define NGX_ALIGNMENT   sizeof(unsigned long)
+
+#define ngx_align(d, a)     (((d) + (a - 1)) & ~(a - 1))
+#define ngx_align_ptr(p, a)                                                   \
+    (u_char *) (((uintptr_t) (p) + ((uintptr_t) a - 1)) & ~((uintptr_t) a - 1))
+
+#define ngx_inline      inline
+#define ngx_cdecl
+
+#if (defined __SSE2__ && !defined NGX_HAVE_SSE2)
+#define NGX_HAVE_SSE2   1
+#endif
+
+#ifndef NGX_DEBUG
+#define NGX_DEBUG       0
+#endif
+
+#ifndef NGX_HTTP_SSL
+#define NGX_HTTP_SSL    0
+#endif
+
+#ifndef NGX_STREAM_SSL
+#define NGX_STREAM_SSL  0
+#endif
+
+#ifndef NGX_STREAM
+#define NGX_STREAM      0
+#endif
+
+#define NGX_LINUX       1
+
+
+#endif /* _NGX_CONFIG_H_INCLUDED_ */
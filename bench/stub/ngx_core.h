@@ -0,0 +1,815 @@
+
+/*
+ * Minimal stand-in for nginx's ngx_core.h.  Only the declarations the
+ * jvm_route module touches are provided; the behaviour lives in ngx_stub.c.
+ */
+
+
+#ifndef _NGX_CORE_H_INCLUDED_
+#define _NGX_CORE_H_INCLUDED_
+
+
+#include <ngx_config.h>
+
+
+typedef struct ngx_module_s      ngx_module_t;
+typedef struct ngx_conf_s        ngx_conf_t;
+typedef struct ngx_cycle_s       ngx_cycle_t;
+typedef struct ngx_pool_s        ngx_pool_t;
+typedef struct ngx_chain_s       ngx_chain_t;
+typedef struct ngx_log_s         ngx_log_t;
+typedef struct ngx_array_s       ngx_array_t;
+typedef struct ngx_event_s       ngx_event_t;
+typedef struct ngx_connection_s  ngx_connection_t;
+typedef struct ngx_peer_connection_s  ngx_peer_connection_t;
+
+typedef void (*ngx_event_handler_pt)(ngx_event_t *ev);
+
+
+#define  NGX_OK          0
+#define  NGX_ERROR      -1
+#define  NGX_AGAIN      -2
+#define  NGX_BUSY       -3
+#define  NGX_DONE       -4
+#define  NGX_DECLINED   -5
+#define  NGX_ABORT      -6
+
+
+#define LF     (u_char) '\n'
+#define CR     (u_char) '\r'
+#define CRLF   "\r\n"
+
+
+#define ngx_abs(value)       (((value) >= 0) ? (value) : - (value))
+#define ngx_max(val1, val2)  ((val1 < val2) ? (val2) : (val1))
+#define ngx_min(val1, val2)  ((val1 > val2) ? (val2) : (val1))
+
+
+/* strings */
+
+typedef struct {
+    size_t      len;
+    u_char     *data;
+} ngx_str_t;
+
+#define ngx_string(str)     { sizeof(str) - 1, (u_char *) str }
+#define ngx_null_string     { 0, NULL }
+#define ngx_str_set(str, text)                                               \
+    (str)->len = sizeof(text) - 1; (str)->data = (u_char *) text
+#define ngx_str_null(str)   (str)->len = 0; (str)->data = NULL
+
+#define ngx_tolower(c)      (u_char) ((c >= 'A' && c <= 'Z') ? (c | 0x20) : c)
+#define ngx_toupper(c)      (u_char) ((c >= 'a' && c <= 'z') ? (c & ~0x20) : c)
+
+#define ngx_strncmp(s1, s2, n)  strncmp((const char *) s1, (const char *) s2, n)
+#define ngx_strcmp(s1, s2)  strcmp((const char *) s1, (const char *) s2)
+#define ngx_strlen(s)       strlen((const char *) s)
+#define ngx_strchr(s1, c)   strchr((const char *) s1, (int) c)
+
+#define ngx_memzero(buf, n)       (void) memset(buf, 0, n)
+#define ngx_memset(buf, c, n)     (void) memset(buf, c, n)
+#define ngx_memcpy(dst, src, n)   (void) memcpy(dst, src, n)
+#define ngx_cpymem(dst, src, n)   (((u_char *) memcpy(dst, src, n)) + (n))
+#define ngx_memcmp(s1, s2, n)     memcmp((const char *) s1, (const char *) s2, n)
+#define ngx_memmove(dst, src, n)  (void) memmove(dst, src, n)
+
+static ngx_inline u_char *
+ngx_strlchr(u_char *p, u_char *last, u_char c)
+{
+    while (p < last) {
+
+        if (*p == c) {
+            return p;
+        }
+
+        p++;
+    }
+
+    return NULL;
+}
+
+ngx_int_t ngx_strncasecmp(u_char *s1, u_char *s2, size_t n);
+ngx_int_t ngx_strcasecmp(u_char *s1, u_char *s2);
+ngx_int_t ngx_atoi(u_char *line, size_t n);
+ssize_t ngx_atosz(u_char *line, size_t n);
+ngx_int_t ngx_hextoi(u_char *line, size_t n);
+u_char *ngx_cpystrn(u_char *dst, u_char *src, size_t n);
+u_char *ngx_pstrdup(ngx_pool_t *pool, ngx_str_t *src);
+u_char * ngx_cdecl ngx_sprintf(u_char *buf, const char *fmt, ...);
+u_char * ngx_cdecl ngx_snprintf(u_char *buf, size_t max, const char *fmt, ...);
+u_char * ngx_cdecl ngx_slprintf(u_char *buf, u_char *last, const char *fmt,
+    ...);
+u_char *ngx_vslprintf(u_char *buf, u_char *last, const char *fmt,
+    va_list args);
+void ngx_sort(void *base, size_t n, size_t size,
+    ngx_int_t (*cmp)(const void *, const void *));
+#define ngx_qsort             qsort
+
+#define NGX_ATOMIC_T_LEN      (sizeof("-9223372036854775808") - 1)
+#define NGX_TIME_T_LEN        (sizeof("-9223372036854775808") - 1)
+
+
+/* crc32 and hashes */
+
+uint32_t ngx_crc32_short(u_char *p, size_t len);
+uint32_t ngx_crc32_long(u_char *p, size_t len);
+#define ngx_crc32_init(crc)   crc = 0xffffffff
+void ngx_crc32_update(uint32_t *crc, u_char *p, size_t len);
+#define ngx_crc32_final(crc)  crc ^= 0xffffffff
+uint32_t ngx_murmur_hash2(u_char *data, size_t len);
+#define ngx_hash(key, c)      ((ngx_uint_t) key * 31 + c)
+ngx_uint_t ngx_hash_key(u_char *data, size_t len);
+
+
+/* log */
+
+#define NGX_LOG_STDERR            0
+#define NGX_LOG_EMERG             1
+#define NGX_LOG_ALERT             2
+#define NGX_LOG_CRIT              3
+#define NGX_LOG_ERR               4
+#define NGX_LOG_WARN              5
+#define NGX_LOG_NOTICE            6
+#define NGX_LOG_INFO              7
+#define NGX_LOG_DEBUG             8
+
+#define NGX_LOG_DEBUG_CORE        0x010
+#define NGX_LOG_DEBUG_ALLOC       0x020
+#define NGX_LOG_DEBUG_EVENT       0x080
+#define NGX_LOG_DEBUG_HTTP        0x100
+#define NGX_LOG_DEBUG_STREAM      0x800
+
+struct ngx_log_s {
+    ngx_uint_t           log_level;
+    void                *data;
+    const char          *action;
+};
+
+void ngx_log_error_core(ngx_uint_t level, ngx_log_t *log, ngx_err_t err,
+    const char *fmt, ...);
+
+#define ngx_log_error(level, log, ...)                                        \
+    if ((log)->log_level >= level) ngx_log_error_core(level, log, __VA_ARGS__)
+
+#if (NGX_DEBUG)
+#define ngx_log_debug0(level, log, err, fmt)                                  \
+    ngx_log_error_core(NGX_LOG_DEBUG, log, err, fmt)
+#define ngx_log_debug1(level, log, err, fmt, a1)                              \
+    ngx_log_error_core(NGX_LOG_DEBUG, log, err, fmt, a1)
+#define ngx_log_debug2(level, log, err, fmt, a1, a2)                          \
+    ngx_log_error_core(NGX_LOG_DEBUG, log, err, fmt, a1, a2)
+#define ngx_log_debug3(level, log, err, fmt, a1, a2, a3)                      \
+    ngx_log_error_core(NGX_LOG_DEBUG, log, err, fmt, a1, a2, a3)
+#define ngx_log_debug4(level, log, err, fmt, a1, a2, a3, a4)                  \
+    ngx_log_error_core(NGX_LOG_DEBUG, log, err, fmt, a1, a2, a3, a4)
+#define ngx_log_debug5(level, log, err, fmt, a1, a2, a3, a4, a5)              \
+    ngx_log_error_core(NGX_LOG_DEBUG, log, err, fmt, a1, a2, a3, a4, a5)
+#define ngx_log_debug6(level, log, err, fmt, a1, a2, a3, a4, a5, a6)          \
+    ngx_log_error_core(NGX_LOG_DEBUG, log, err, fmt, a1, a2, a3, a4, a5, a6)
+#define ngx_log_debug7(level, log, err, fmt, a1, a2, a3, a4, a5, a6, a7)      \
+    ngx_log_error_core(NGX_LOG_DEBUG, log, err, fmt,                          \
+                       a1, a2, a3, a4, a5, a6, a7)
+#define ngx_log_debug8(level, log, err, fmt, a1, a2, a3, a4, a5, a6, a7, a8)  \
+    ngx_log_error_core(NGX_LOG_DEBUG, log, err, fmt,                          \
+                       a1, a2, a3, a4, a5, a6, a7, a8)
+#else
+#define ngx_log_debug0(level, log, err, fmt)
+#define ngx_log_debug1(level, log, err, fmt, a1)
+#define ngx_log_debug2(level, log, err, fmt, a1, a2)
+#define ngx_log_debug3(level, log, err, fmt, a1, a2, a3)
+#define ngx_log_debug4(level, log, err, fmt, a1, a2, a3, a4)
+#define ngx_log_debug5(level, log, err, fmt, a1, a2, a3, a4, a5)
+#define ngx_log_debug6(level, log, err, fmt, a1, a2, a3, a4, a5, a6)
+#define ngx_log_debug7(level, log, err, fmt, a1, a2, a3, a4, a5, a6, a7)
+#define ngx_log_debug8(level, log, err, fmt, a1, a2, a3, a4, a5, a6, a7, a8)
+#endif
+
+#define ngx_errno                  errno
+#define ngx_socket_errno           errno
+
+#define NGX_EAGAIN                 EAGAIN
+#define NGX_EADDRINUSE             EADDRINUSE
+
+
+/* memory */
+
+#define NGX_MAX_ALLOC_FROM_POOL  (ngx_pagesize - 1)
+
+struct ngx_pool_s {
+    ngx_log_t           *log;
+};
+
+void *ngx_alloc(size_t size, ngx_log_t *log);
+void *ngx_calloc(size_t size, ngx_log_t *log);
+#define ngx_free          free
+void *ngx_palloc(ngx_pool_t *pool, size_t size);
+void *ngx_pnalloc(ngx_pool_t *pool, size_t size);
+void *ngx_pcalloc(ngx_pool_t *pool, size_t size);
+ngx_int_t ngx_pfree(ngx_pool_t *pool, void *p);
+void ngx_destroy_pool(ngx_pool_t *pool);
+
+typedef void (*ngx_pool_cleanup_pt)(void *data);
+
+typedef struct ngx_pool_cleanup_s  ngx_pool_cleanup_t;
+
+struct ngx_pool_cleanup_s {
+    ngx_pool_cleanup_pt   handler;
+    void                 *data;
+    ngx_pool_cleanup_t   *next;
+};
+
+ngx_pool_cleanup_t *ngx_pool_cleanup_add(ngx_pool_t *p, size_t size);
+
+extern ngx_uint_t  ngx_pagesize;
+extern ngx_uint_t  ngx_pagesize_shift;
+extern ngx_uint_t  ngx_cacheline_size;
+extern ngx_uint_t  ngx_ncpu;
+
+
+/* arrays, lists, queues */
+
+struct ngx_array_s {
+    void        *elts;
+    ngx_uint_t   nelts;
+    size_t       size;
+    ngx_uint_t   nalloc;
+    ngx_pool_t  *pool;
+};
+
+ngx_array_t *ngx_array_create(ngx_pool_t *p, ngx_uint_t n, size_t size);
+void *ngx_array_push(ngx_array_t *a);
+void *ngx_array_push_n(ngx_array_t *a, ngx_uint_t n);
+
+static ngx_inline ngx_int_t
+ngx_array_init(ngx_array_t *array, ngx_pool_t *pool, ngx_uint_t n, size_t size)
+{
+    array->nelts = 0;
+    array->size = size;
+    array->nalloc = n;
+    array->pool = pool;
+
+    array->elts = ngx_palloc(pool, n * size);
+    if (array->elts == NULL) {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+typedef struct ngx_list_part_s  ngx_list_part_t;
+
+struct ngx_list_part_s {
+    void             *elts;
+    ngx_uint_t        nelts;
+    ngx_list_part_t  *next;
+};
+
+typedef struct {
+    ngx_list_part_t  *last;
+    ngx_list_part_t   part;
+    size_t            size;
+    ngx_uint_t        nalloc;
+    ngx_pool_t       *pool;
+} ngx_list_t;
+
+typedef struct ngx_queue_s  ngx_queue_t;
+
+struct ngx_queue_s {
+    ngx_queue_t  *prev;
+    ngx_queue_t  *next;
+};
+
+#define ngx_queue_init(q)                                                     \
+    (q)->prev = q;                                                            \
+    (q)->next = q
+
+#define ngx_queue_empty(h)                                                    \
+    (h == (h)->prev)
+
+#define ngx_queue_insert_head(h, x)                                           \
+    (x)->next = (h)->next;                                                    \
+    (x)->next->prev = x;                                                      \
+    (x)->prev = h;                                                            \
+    (h)->next = x
+
+#define ngx_queue_insert_tail(h, x)                                           \
+    (x)->prev = (h)->prev;                                                    \
+    (x)->prev->next = x;                                                      \
+    (x)->next = h;                                                            \
+    (h)->prev = x
+
+#define ngx_queue_head(h)       (h)->next
+#define ngx_queue_last(h)       (h)->prev
+#define ngx_queue_sentinel(h)   (h)
+#define ngx_queue_next(q)       (q)->next
+#define ngx_queue_prev(q)       (q)->prev
+
+#define ngx_queue_remove(x)                                                   \
+    (x)->next->prev = (x)->prev;                                              \
+    (x)->prev->next = (x)->next
+
+#define ngx_queue_data(q, type, link)                                         \
+    (type *) ((u_char *) q - offsetof(type, link))
+
+
+/* buffers */
+
+typedef void *  ngx_buf_tag_t;
+
+typedef struct ngx_buf_s  ngx_buf_t;
+
+struct ngx_buf_s {
+    u_char          *pos;
+    u_char          *last;
+    u_char          *start;
+    u_char          *end;
+
+    unsigned         temporary:1;
+    unsigned         memory:1;
+    unsigned         last_buf:1;
+    unsigned         last_in_chain:1;
+};
+
+struct ngx_chain_s {
+    ngx_buf_t    *buf;
+    ngx_chain_t  *next;
+};
+
+ngx_buf_t *ngx_create_temp_buf(ngx_pool_t *pool, size_t size);
+#define ngx_calloc_buf(pool) ngx_pcalloc(pool, sizeof(ngx_buf_t))
+
+
+/* time */
+
+typedef struct {
+    time_t      sec;
+    ngx_uint_t  msec;
+    ngx_int_t   gmtoff;
+} ngx_time_t;
+
+extern volatile ngx_msec_t  ngx_current_msec;
+extern volatile ngx_time_t *ngx_cached_time;
+
+#define ngx_time()           ngx_cached_time->sec
+#define ngx_timeofday()      (ngx_time_t *) ngx_cached_time
+
+void ngx_time_update(void);
+
+ngx_int_t ngx_parse_time(ngx_str_t *line, ngx_uint_t is_sec);
+ssize_t ngx_parse_size(ngx_str_t *line);
+
+#define NGX_PARSE_LARGE_TIME  -2
+
+
+/* atomics and locks */
+
+typedef long                        ngx_atomic_int_t;
+typedef unsigned long               ngx_atomic_uint_t;
+typedef volatile ngx_atomic_uint_t  ngx_atomic_t;
+
+#define ngx_atomic_cmp_set(lock, old, set)                                    \
+    __sync_bool_compare_and_swap(lock, old, set)
+
+#define ngx_atomic_fetch_add(value, add)                                      \
+    __sync_fetch_and_add(value, add)
+
+#define ngx_memory_barrier()        __sync_synchronize()
+#define ngx_cpu_pause()             __asm__ ("pause")
+
+void ngx_spinlock(ngx_atomic_t *lock, ngx_atomic_int_t value, ngx_uint_t spin);
+
+/* counted by the stub ngx_spinlock(), per process */
+extern ngx_uint_t  ngx_stub_lock_waits;
+extern uint64_t    ngx_stub_lock_wait_ns;
+
+#define ngx_trylock(lock)  (*(lock) == 0 && ngx_atomic_cmp_set(lock, 0, 1))
+#define ngx_unlock(lock)    *(lock) = 0
+
+extern ngx_pid_t  ngx_pid;
+extern ngx_uint_t ngx_worker;
+
+
+/* shared memory */
+
+typedef struct {
+    u_char      *addr;
+    size_t       size;
+    ngx_str_t    name;
+    ngx_log_t   *log;
+    ngx_uint_t   exists;   /* unsigned  exists:1;  */
+} ngx_shm_t;
+
+typedef struct ngx_shm_zone_s  ngx_shm_zone_t;
+
+typedef ngx_int_t (*ngx_shm_zone_init_pt) (ngx_shm_zone_t *zone, void *data);
+
+struct ngx_shm_zone_s {
+    void                     *data;
+    ngx_shm_t                 shm;
+    ngx_shm_zone_init_pt      init;
+    void                     *tag;
+    ngx_uint_t                noreuse;  /* unsigned  noreuse:1; */
+};
+
+typedef struct {
+    ngx_atomic_t   lock;
+    size_t         min_size;
+    size_t         min_shift;
+    u_char        *start;
+    u_char        *end;
+    void          *data;
+    void          *addr;
+    u_char        *log_ctx;
+    u_char         zero;
+} ngx_slab_pool_t;
+
+void *ngx_slab_alloc(ngx_slab_pool_t *pool, size_t size);
+void *ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size);
+void *ngx_slab_calloc(ngx_slab_pool_t *pool, size_t size);
+void *ngx_slab_calloc_locked(ngx_slab_pool_t *pool, size_t size);
+void ngx_slab_free(ngx_slab_pool_t *pool, void *p);
+void ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p);
+
+#define ngx_shmtx_lock(mtx)       ngx_spinlock(&(mtx)->lock, ngx_pid, 1024)
+#define ngx_shmtx_unlock(mtx)     (void) ngx_atomic_cmp_set(&(mtx)->lock,    \
+                                                            ngx_pid, 0)
+
+ngx_shm_zone_t *ngx_shared_memory_add(ngx_conf_t *cf, ngx_str_t *name,
+    size_t size, void *tag);
+
+
+/* files */
+
+typedef struct {
+    ngx_fd_t     fd;
+    ngx_str_t    name;
+} ngx_file_t;
+
+typedef struct {
+    ngx_file_t   file;
+    ngx_uint_t   line;
+} ngx_conf_file_t;
+
+
+/* events and connections */
+
+struct ngx_event_s {
+    void            *data;
+
+    unsigned         write:1;
+    unsigned         active:1;
+    unsigned         ready:1;
+    unsigned         eof:1;
+    unsigned         error:1;
+    unsigned         timedout:1;
+    unsigned         timer_set:1;
+    unsigned         delayed:1;
+    unsigned         cancelable:1;
+
+    ngx_event_handler_pt  handler;
+
+    ngx_log_t       *log;
+    ngx_msec_t       timer;
+};
+
+typedef ssize_t (*ngx_recv_pt)(ngx_connection_t *c, u_char *buf, size_t size);
+typedef ssize_t (*ngx_send_pt)(ngx_connection_t *c, u_char *buf, size_t size);
+
+#if (NGX_HTTP_SSL || NGX_STREAM_SSL)
+#include <openssl/ssl.h>
+
+typedef SSL_SESSION  ngx_ssl_session_t;
+
+typedef struct {
+    SSL_CTX        *ctx;
+    ngx_log_t      *log;
+} ngx_ssl_t;
+
+typedef void (*ngx_connection_handler_pt)(ngx_connection_t *c);
+
+typedef struct {
+    SSL                        *connection;
+    SSL_CTX                    *session_ctx;
+
+    ngx_connection_handler_pt   handler;
+
+    unsigned                    no_wait_shutdown:1;
+    unsigned                    no_send_shutdown:1;
+} ngx_ssl_connection_t;
+
+ngx_int_t ngx_ssl_set_session(ngx_connection_t *c, ngx_ssl_session_t *session);
+ngx_int_t ngx_ssl_shutdown(ngx_connection_t *c);
+#define ngx_ssl_get_session(c)  SSL_get1_session(c->ssl->connection)
+#define ngx_ssl_free_session    SSL_SESSION_free
+#endif
+
+struct ngx_connection_s {
+    void               *data;
+    ngx_event_t        *read;
+    ngx_event_t        *write;
+
+    ngx_socket_t        fd;
+
+    ngx_recv_pt         recv;
+    ngx_send_pt         send;
+
+    ngx_log_t          *log;
+    ngx_pool_t         *pool;
+
+    struct sockaddr    *sockaddr;
+    socklen_t           socklen;
+    ngx_str_t           addr_text;
+
+#if (NGX_HTTP_SSL || NGX_STREAM_SSL)
+    ngx_ssl_connection_t  *ssl;
+#endif
+
+    unsigned            idle:1;
+    unsigned            close:1;
+};
+
+ngx_connection_t *ngx_get_connection(ngx_socket_t s, ngx_log_t *log);
+void ngx_close_connection(ngx_connection_t *c);
+
+#define ngx_socket           socket
+#define ngx_socket_n         "socket()"
+#define ngx_close_socket     close
+#define ngx_close_socket_n   "close() socket"
+#define ngx_nonblocking(s)   fcntl(s, F_SETFL, fcntl(s, F_GETFL) | O_NONBLOCK)
+#define ngx_nonblocking_n    "fcntl(O_NONBLOCK)"
+
+extern ngx_msec_t  ngx_event_timer_value;
+
+void ngx_event_add_timer(ngx_event_t *ev, ngx_msec_t timer);
+void ngx_event_del_timer(ngx_event_t *ev);
+#define ngx_add_timer        ngx_event_add_timer
+#define ngx_del_timer        ngx_event_del_timer
+
+ngx_int_t ngx_handle_read_event(ngx_event_t *rev, ngx_uint_t flags);
+
+#define ngx_recv             recv
+#define ngx_send             send
+
+extern ngx_uint_t  ngx_exiting;
+extern ngx_uint_t  ngx_quit;
+extern ngx_uint_t  ngx_terminate;
+
+#define NGX_EVENT_MODULE      0x544E5645  /* "EVNT" */
+
+
+/* inet */
+
+#define NGX_SOCKADDR_STRLEN   (sizeof("[ffff:ffff:ffff:ffff:ffff:ffff:255.255.255.255]:65535") - 1)
+#define NGX_SOCKADDRLEN       sizeof(struct sockaddr_storage)
+
+typedef struct {
+    struct sockaddr          *sockaddr;
+    socklen_t                 socklen;
+    ngx_str_t                 name;
+} ngx_addr_t;
+
+typedef ngx_addr_t  ngx_peer_addr_t;
+
+typedef struct {
+    ngx_str_t                 url;
+    ngx_str_t                 host;
+    ngx_str_t                 port_text;
+    ngx_str_t                 uri;
+
+    in_port_t                 port;
+    in_port_t                 default_port;
+    int                       family;
+
+    unsigned                  listen:1;
+    unsigned                  uri_part:1;
+    unsigned                  no_resolve:1;
+
+    unsigned                  no_port:1;
+    unsigned                  wildcard:1;
+
+    socklen_t                 socklen;
+    u_char                    sockaddr[NGX_SOCKADDRLEN];
+
+    ngx_addr_t               *addrs;
+    ngx_uint_t                naddrs;
+
+    char                     *err;
+} ngx_url_t;
+
+ngx_int_t ngx_parse_url(ngx_pool_t *pool, ngx_url_t *u);
+ngx_int_t ngx_inet_resolve_host(ngx_pool_t *pool, ngx_url_t *u);
+size_t ngx_sock_ntop(struct sockaddr *sa, socklen_t socklen, u_char *text,
+    size_t len, ngx_uint_t port);
+ngx_int_t ngx_cmp_sockaddr(struct sockaddr *sa1, socklen_t slen1,
+    struct sockaddr *sa2, socklen_t slen2, ngx_uint_t cmp_port);
+in_port_t ngx_inet_get_port(struct sockaddr *sa);
+void ngx_inet_set_port(struct sockaddr *sa, in_port_t port);
+
+
+/* resolver */
+
+#define NGX_RESOLVE_FORMERR   1
+#define NGX_RESOLVE_SERVFAIL  2
+#define NGX_RESOLVE_NXDOMAIN  3
+#define NGX_RESOLVE_TIMEDOUT  110
+
+#define NGX_NO_RESOLVER       (void *) -1
+
+typedef struct ngx_resolver_s      ngx_resolver_t;
+typedef struct ngx_resolver_ctx_s  ngx_resolver_ctx_t;
+
+typedef void (*ngx_resolver_handler_pt)(ngx_resolver_ctx_t *ctx);
+
+typedef struct {
+    struct sockaddr          *sockaddr;
+    socklen_t                 socklen;
+    ngx_str_t                 name;
+    u_short                   priority;
+    u_short                   weight;
+} ngx_resolver_addr_t;
+
+struct ngx_resolver_s {
+    ngx_event_t              *event;
+    ngx_log_t                 log;
+};
+
+struct ngx_resolver_ctx_s {
+    ngx_resolver_t           *resolver;
+
+    ngx_int_t                 state;
+    ngx_str_t                 name;
+
+    ngx_uint_t                naddrs;
+    ngx_resolver_addr_t      *addrs;
+
+    ngx_resolver_handler_pt   handler;
+    void                     *data;
+    ngx_msec_t                timeout;
+};
+
+ngx_resolver_ctx_t *ngx_resolve_start(ngx_resolver_t *r,
+    ngx_resolver_ctx_t *temp);
+ngx_int_t ngx_resolve_name(ngx_resolver_ctx_t *ctx);
+void ngx_resolve_name_done(ngx_resolver_ctx_t *ctx);
+char *ngx_resolver_strerror(ngx_int_t err);
+
+
+/* configuration */
+
+#define NGX_CONF_NOARGS      0x00000001
+#define NGX_CONF_TAKE1       0x00000002
+#define NGX_CONF_TAKE2       0x00000004
+#define NGX_CONF_TAKE3       0x00000008
+#define NGX_CONF_TAKE4       0x00000010
+#define NGX_CONF_TAKE5       0x00000020
+#define NGX_CONF_TAKE6       0x00000040
+#define NGX_CONF_TAKE7       0x00000080
+
+#define NGX_CONF_TAKE12      (NGX_CONF_TAKE1|NGX_CONF_TAKE2)
+#define NGX_CONF_TAKE13      (NGX_CONF_TAKE1|NGX_CONF_TAKE3)
+#define NGX_CONF_TAKE23      (NGX_CONF_TAKE2|NGX_CONF_TAKE3)
+#define NGX_CONF_TAKE123     (NGX_CONF_TAKE1|NGX_CONF_TAKE2|NGX_CONF_TAKE3)
+#define NGX_CONF_TAKE1234    (NGX_CONF_TAKE1|NGX_CONF_TAKE2|NGX_CONF_TAKE3   \
+                              |NGX_CONF_TAKE4)
+
+#define NGX_CONF_ARGS_NUMBER 0x000000ff
+#define NGX_CONF_BLOCK       0x00000100
+#define NGX_CONF_FLAG        0x00000200
+#define NGX_CONF_ANY         0x00000400
+#define NGX_CONF_1MORE       0x00000800
+#define NGX_CONF_2MORE       0x00001000
+
+#define NGX_MAIN_CONF        0x01000000
+
+#define NGX_CONF_UNSET       -1
+#define NGX_CONF_UNSET_UINT  (ngx_uint_t) -1
+#define NGX_CONF_UNSET_PTR   (void *) -1
+#define NGX_CONF_UNSET_SIZE  (size_t) -1
+#define NGX_CONF_UNSET_MSEC  (ngx_msec_t) -1
+
+#define NGX_CONF_OK          NULL
+#define NGX_CONF_ERROR       (void *) -1
+
+typedef struct ngx_command_s  ngx_command_t;
+
+struct ngx_command_s {
+    ngx_str_t             name;
+    ngx_uint_t            type;
+    char               *(*set)(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+    ngx_uint_t            conf;
+    ngx_uint_t            offset;
+    void                 *post;
+};
+
+#define ngx_null_command  { ngx_null_string, 0, NULL, 0, 0, NULL }
+
+struct ngx_conf_s {
+    char                 *name;
+    ngx_array_t          *args;
+
+    ngx_cycle_t          *cycle;
+    ngx_pool_t           *pool;
+    ngx_pool_t           *temp_pool;
+    ngx_conf_file_t      *conf_file;
+    ngx_log_t            *log;
+
+    void                 *ctx;
+    ngx_uint_t            module_type;
+    ngx_uint_t            cmd_type;
+};
+
+void ngx_cdecl ngx_conf_log_error(ngx_uint_t level, ngx_conf_t *cf,
+    ngx_err_t err, const char *fmt, ...);
+
+char *ngx_conf_set_flag_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+char *ngx_conf_set_num_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+char *ngx_conf_set_msec_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+
+#define ngx_conf_init_value(conf, default)                                   \
+    if (conf == NGX_CONF_UNSET) {                                            \
+        conf = default;                                                      \
+    }
+
+#define ngx_conf_init_uint_value(conf, default)                              \
+    if (conf == NGX_CONF_UNSET_UINT) {                                       \
+        conf = default;                                                      \
+    }
+
+#define ngx_conf_init_msec_value(conf, default)                              \
+    if (conf == NGX_CONF_UNSET_MSEC) {                                       \
+        conf = default;                                                      \
+    }
+
+#define ngx_conf_merge_value(conf, prev, default)                            \
+    if (conf == NGX_CONF_UNSET) {                                            \
+        conf = (prev == NGX_CONF_UNSET) ? default : prev;                    \
+    }
+
+#define ngx_conf_merge_uint_value(conf, prev, default)                       \
+    if (conf == NGX_CONF_UNSET_UINT) {                                       \
+        conf = (prev == NGX_CONF_UNSET_UINT) ? default : prev;               \
+    }
+
+
+/* modules and cycle */
+
+#define NGX_MODULE_UNSET_INDEX  (ngx_uint_t) -1
+
+#define NGX_MODULE_V1          0, 0, 0, 0, 0, 0, 1
+#define NGX_MODULE_V1_PADDING  0, 0, 0, 0, 0, 0, 0, 0
+
+struct ngx_module_s {
+    ngx_uint_t            ctx_index;
+    ngx_uint_t            index;
+
+    ngx_uint_t            spare0;
+    ngx_uint_t            spare1;
+    ngx_uint_t            spare2;
+    ngx_uint_t            spare3;
+
+    ngx_uint_t            version;
+
+    void                 *ctx;
+    ngx_command_t        *commands;
+    ngx_uint_t            type;
+
+    ngx_int_t           (*init_master)(ngx_log_t *log);
+
+    ngx_int_t           (*init_module)(ngx_cycle_t *cycle);
+
+    ngx_int_t           (*init_process)(ngx_cycle_t *cycle);
+    ngx_int_t           (*init_thread)(ngx_cycle_t *cycle);
+    void                (*exit_thread)(ngx_cycle_t *cycle);
+    void                (*exit_process)(ngx_cycle_t *cycle);
+
+    void                (*exit_master)(ngx_cycle_t *cycle);
+
+    uintptr_t             spare_hook0;
+    uintptr_t             spare_hook1;
+    uintptr_t             spare_hook2;
+    uintptr_t             spare_hook3;
+    uintptr_t             spare_hook4;
+    uintptr_t             spare_hook5;
+    uintptr_t             spare_hook6;
+    uintptr_t             spare_hook7;
+};
+
+struct ngx_cycle_s {
+    void                  ****conf_ctx;
+    ngx_pool_t               *pool;
+
+    ngx_log_t                *log;
+
+    ngx_list_t                shared_memory;
+
+    ngx_uint_t                connection_n;
+
+    ngx_cycle_t              *old_cycle;
+};
+
+extern volatile ngx_cycle_t  *ngx_cycle;
+
+#define ngx_get_conf(conf_ctx, module)  conf_ctx[module.index]
+
+
+#endif /* _NGX_CORE_H_INCLUDED_ */
@@ -0,0 +1,167 @@
+/*
+ * Minimal stand-in for nginx's ngx_stream.h, the upstream part that the
+ * stream counterpart of jvm_route uses.
+ */
+
+
+#ifndef _NGX_STREAM_H_INCLUDED_
+#define _NGX_STREAM_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+typedef struct ngx_stream_session_s  ngx_stream_session_t;
+
+
+#define NGX_STREAM_MODULE         0x4d525453   /* "STRM" */
+
+#define NGX_STREAM_MAIN_CONF      0x02000000
+#define NGX_STREAM_SRV_CONF       0x04000000
+#define NGX_STREAM_UPS_CONF       0x08000000
+
+#define NGX_STREAM_MAIN_CONF_OFFSET  offsetof(ngx_stream_conf_ctx_t, main_conf)
+#define NGX_STREAM_SRV_CONF_OFFSET   offsetof(ngx_stream_conf_ctx_t, srv_conf)
+
+
+typedef struct {
+    void        **main_conf;
+    void        **srv_conf;
+} ngx_stream_conf_ctx_t;
+
+typedef struct {
+    ngx_int_t   (*preconfiguration)(ngx_conf_t *cf);
+    ngx_int_t   (*postconfiguration)(ngx_conf_t *cf);
+
+    void       *(*create_main_conf)(ngx_conf_t *cf);
+    char       *(*init_main_conf)(ngx_conf_t *cf, void *conf);
+
+    void       *(*create_srv_conf)(ngx_conf_t *cf);
+    char       *(*merge_srv_conf)(ngx_conf_t *cf, void *prev, void *conf);
+} ngx_stream_module_t;
+
+
+/* complex values */
+
+typedef struct {
+    ngx_str_t                      value;
+    ngx_uint_t                    *flushes;
+    void                          *lengths;
+    void                          *values;
+} ngx_stream_complex_value_t;
+
+typedef struct {
+    ngx_conf_t                    *cf;
+    ngx_str_t                     *value;
+    ngx_stream_complex_value_t    *complex_value;
+
+    unsigned                       zero:1;
+    unsigned                       conf_prefix:1;
+    unsigned                       root_prefix:1;
+} ngx_stream_compile_complex_value_t;
+
+ngx_int_t ngx_stream_complex_value(ngx_stream_session_t *s,
+    ngx_stream_complex_value_t *val, ngx_str_t *value);
+ngx_int_t ngx_stream_compile_complex_value(
+    ngx_stream_compile_complex_value_t *ccv);
+
+
+/* upstream */
+
+typedef struct ngx_stream_upstream_srv_conf_s  ngx_stream_upstream_srv_conf_t;
+
+typedef ngx_int_t (*ngx_stream_upstream_init_pt)(ngx_conf_t *cf,
+    ngx_stream_upstream_srv_conf_t *us);
+typedef ngx_int_t (*ngx_stream_upstream_init_peer_pt)(ngx_stream_session_t *s,
+    ngx_stream_upstream_srv_conf_t *us);
+
+typedef struct {
+    ngx_stream_upstream_init_pt       init_upstream;
+    ngx_stream_upstream_init_peer_pt  init;
+    void                             *data;
+} ngx_stream_upstream_peer_t;
+
+typedef struct {
+    ngx_str_t                         name;
+    ngx_addr_t                       *addrs;
+    ngx_uint_t                        naddrs;
+    ngx_uint_t                        weight;
+    ngx_uint_t                        max_conns;
+    ngx_uint_t                        max_fails;
+    time_t                            fail_timeout;
+    ngx_msec_t                        slow_start;
+    ngx_uint_t                        down;
+
+    unsigned                          backup:1;
+} ngx_stream_upstream_server_t;
+
+#define NGX_STREAM_UPSTREAM_CREATE        0x0001
+#define NGX_STREAM_UPSTREAM_WEIGHT        0x0002
+#define NGX_STREAM_UPSTREAM_MAX_FAILS     0x0004
+#define NGX_STREAM_UPSTREAM_FAIL_TIMEOUT  0x0008
+#define NGX_STREAM_UPSTREAM_DOWN          0x0010
+#define NGX_STREAM_UPSTREAM_BACKUP        0x0020
+#define NGX_STREAM_UPSTREAM_MAX_CONNS     0x0100
+
+struct ngx_stream_upstream_srv_conf_s {
+    ngx_stream_upstream_peer_t        peer;
+    void                            **srv_conf;
+
+    ngx_array_t                      *servers;
+                                            /* ngx_stream_upstream_server_t */
+
+    ngx_uint_t                        flags;
+    ngx_str_t                         host;
+    u_char                           *file_name;
+    ngx_uint_t                        line;
+    in_port_t                         port;
+    ngx_uint_t                        no_port;  /* unsigned no_port:1 */
+};
+
+typedef struct {
+    ngx_peer_connection_t             peer;
+
+    ngx_stream_upstream_srv_conf_t   *upstream;
+} ngx_stream_upstream_t;
+
+typedef struct {
+    ngx_array_t                       upstreams;
+                                            /* ngx_stream_upstream_srv_conf_t */
+} ngx_stream_upstream_main_conf_t;
+
+extern ngx_module_t  ngx_stream_upstream_module;
+
+
+/* sessions */
+
+struct ngx_stream_session_s {
+    uint32_t                          signature;         /* "STRM" */
+
+    ngx_connection_t                 *connection;
+
+    ngx_stream_upstream_t            *upstream;
+
+    void                            **main_conf;
+    void                            **srv_conf;
+};
+
+
+#define ngx_stream_conf_get_module_main_conf(cf, module)                      \
+    ((ngx_stream_conf_ctx_t *) cf->ctx)->main_conf[module.ctx_index]
+#define ngx_stream_conf_get_module_srv_conf(cf, module)                       \
+    ((ngx_stream_conf_ctx_t *) cf->ctx)->srv_conf[module.ctx_index]
+
+#define ngx_stream_cycle_get_module_main_conf(cycle, module)                  \
+    (cycle->conf_ctx[ngx_stream_module.index] ?                               \
+        ((ngx_stream_conf_ctx_t *) cycle->conf_ctx[ngx_stream_module.index])  \
+            ->main_conf[module.ctx_index]:                                    \
+        NULL)
+
+#define ngx_stream_conf_upstream_srv_conf(uscf, module)                       \
+    uscf->srv_conf[module.ctx_index]
+
+extern ngx_module_t  ngx_stream_module;
+
+
+#endif /* _NGX_STREAM_H_INCLUDED_ */
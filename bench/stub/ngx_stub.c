@@ -0,0 +1,1184 @@
+
+/*
+ * Just enough of the nginx runtime to link the jvm_route module into
+ * standalone tools.  Configuration and request plumbing are stubbed out;
+ * pools, strings, time and the spinlock behave like the real thing.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+#if (NGX_STREAM)
+#include <ngx_stream.h>
+#endif
+
+
+ngx_uint_t  ngx_pagesize = 4096;
+ngx_uint_t  ngx_pagesize_shift = 12;
+ngx_uint_t  ngx_cacheline_size = 64;
+ngx_uint_t  ngx_ncpu = 1;
+
+ngx_pid_t   ngx_pid;
+ngx_uint_t  ngx_worker;
+ngx_uint_t  ngx_exiting;
+ngx_uint_t  ngx_quit;
+ngx_uint_t  ngx_terminate;
+
+static ngx_time_t     ngx_stub_time;
+volatile ngx_msec_t   ngx_current_msec;
+volatile ngx_time_t  *ngx_cached_time = &ngx_stub_time;
+
+volatile ngx_cycle_t  *ngx_cycle;
+
+ngx_module_t  ngx_http_module;
+ngx_module_t  ngx_http_core_module;
+ngx_module_t  ngx_http_upstream_module;
+
+#if (NGX_STREAM)
+ngx_module_t  ngx_stream_module;
+ngx_module_t  ngx_stream_upstream_module;
+#endif
+
+
+void
+ngx_time_update(void)
+{
+    struct timeval  tv;
+
+    gettimeofday(&tv, NULL);
+
+    ngx_stub_time.sec = tv.tv_sec;
+    ngx_stub_time.msec = tv.tv_usec / 1000;
+    ngx_current_msec = (ngx_msec_t) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+
+/* pools are plain malloc() here: tools reset them by exiting */
+
+void *
+ngx_alloc(size_t size, ngx_log_t *log)
+{
+    return malloc(size);
+}
+
+
+void *
+ngx_calloc(size_t size, ngx_log_t *log)
+{
+    return calloc(1, size);
+}
+
+
+void *
+ngx_palloc(ngx_pool_t *pool, size_t size)
+{
+    return malloc(size ? size : 1);
+}
+
+
+void *
+ngx_pnalloc(ngx_pool_t *pool, size_t size)
+{
+    return malloc(size ? size : 1);
+}
+
+
+void *
+ngx_pcalloc(ngx_pool_t *pool, size_t size)
+{
+    return calloc(1, size ? size : 1);
+}
+
+
+ngx_int_t
+ngx_pfree(ngx_pool_t *pool, void *p)
+{
+    free(p);
+    return NGX_OK;
+}
+
+
+ngx_pool_cleanup_t *
+ngx_pool_cleanup_add(ngx_pool_t *p, size_t size)
+{
+    ngx_pool_cleanup_t  *c;
+
+    c = calloc(1, sizeof(ngx_pool_cleanup_t));
+    if (c == NULL) {
+        return NULL;
+    }
+
+    if (size) {
+        c->data = calloc(1, size);
+        if (c->data == NULL) {
+            free(c);
+            return NULL;
+        }
+    }
+
+    return c;
+}
+
+
+ngx_array_t *
+ngx_array_create(ngx_pool_t *p, ngx_uint_t n, size_t size)
+{
+    ngx_array_t  *a;
+
+    a = ngx_palloc(p, sizeof(ngx_array_t));
+    if (a == NULL) {
+        return NULL;
+    }
+
+    if (ngx_array_init(a, p, n, size) != NGX_OK) {
+        return NULL;
+    }
+
+    return a;
+}
+
+
+void *
+ngx_array_push_n(ngx_array_t *a, ngx_uint_t n)
+{
+    void        *elt, *new;
+    ngx_uint_t   nalloc;
+
+    if (a->nelts + n > a->nalloc) {
+        nalloc = 2 * ((n >= a->nalloc) ? n : a->nalloc);
+
+        new = realloc(a->elts, nalloc * a->size);
+        if (new == NULL) {
+            return NULL;
+        }
+
+        a->elts = new;
+        a->nalloc = nalloc;
+    }
+
+    elt = (u_char *) a->elts + a->size * a->nelts;
+    a->nelts += n;
+
+    return elt;
+}
+
+
+void *
+ngx_array_push(ngx_array_t *a)
+{
+    return ngx_array_push_n(a, 1);
+}
+
+
+ngx_int_t
+ngx_strncasecmp(u_char *s1, u_char *s2, size_t n)
+{
+    ngx_uint_t  c1, c2;
+
+    while (n) {
+        c1 = (ngx_uint_t) *s1++;
+        c2 = (ngx_uint_t) *s2++;
+
+        c1 = (c1 >= 'A' && c1 <= 'Z') ? (c1 | 0x20) : c1;
+        c2 = (c2 >= 'A' && c2 <= 'Z') ? (c2 | 0x20) : c2;
+
+        if (c1 == c2) {
+
+            if (c1) {
+                n--;
+                continue;
+            }
+
+            return 0;
+        }
+
+        return c1 - c2;
+    }
+
+    return 0;
+}
+
+
+ngx_int_t
+ngx_strcasecmp(u_char *s1, u_char *s2)
+{
+    return ngx_strncasecmp(s1, s2, (size_t) -1);
+}
+
+
+ngx_int_t
+ngx_atoi(u_char *line, size_t n)
+{
+    ngx_int_t  value;
+
+    if (n == 0) {
+        return NGX_ERROR;
+    }
+
+    for (value = 0; n--; line++) {
+        if (*line < '0' || *line > '9') {
+            return NGX_ERROR;
+        }
+
+        value = value * 10 + (*line - '0');
+    }
+
+    return value;
+}
+
+
+ssize_t
+ngx_atosz(u_char *line, size_t n)
+{
+    return (ssize_t) ngx_atoi(line, n);
+}
+
+
+ngx_int_t
+ngx_hextoi(u_char *line, size_t n)
+{
+    u_char     c, ch;
+    ngx_int_t  value;
+
+    if (n == 0) {
+        return NGX_ERROR;
+    }
+
+    for (value = 0; n--; line++) {
+        ch = *line;
+
+        if (ch >= '0' && ch <= '9') {
+            value = value * 16 + (ch - '0');
+            continue;
+        }
+
+        c = (u_char) (ch | 0x20);
+
+        if (c >= 'a' && c <= 'f') {
+            value = value * 16 + (c - 'a' + 10);
+            continue;
+        }
+
+        return NGX_ERROR;
+    }
+
+    return value;
+}
+
+
+u_char *
+ngx_cpystrn(u_char *dst, u_char *src, size_t n)
+{
+    if (n == 0) {
+        return dst;
+    }
+
+    while (--n) {
+        *dst = *src;
+
+        if (*dst == '\0') {
+            return dst;
+        }
+
+        dst++;
+        src++;
+    }
+
+    *dst = '\0';
+
+    return dst;
+}
+
+
+u_char *
+ngx_pstrdup(ngx_pool_t *pool, ngx_str_t *src)
+{
+    u_char  *dst;
+
+    dst = ngx_pnalloc(pool, src->len);
+    if (dst == NULL) {
+        return NULL;
+    }
+
+    ngx_memcpy(dst, src->data, src->len);
+
+    return dst;
+}
+
+
+/* a subset of ngx_vslprintf(): %[0][width][u][x][X]{d,D,i,l,z,A,T,M,O,p,c},
+ * %V, %s, %*s and %% */
+
+u_char *
+ngx_vslprintf(u_char *buf, u_char *last, const char *fmt, va_list args)
+{
+    u_char      *p, zero, tmp[NGX_INT_T_LEN + 1];
+    size_t       len, width, slen;
+    int64_t      i64;
+    uint64_t     ui64;
+    ngx_str_t   *v;
+    ngx_uint_t   sign, hex;
+
+    while (*fmt && buf < last) {
+
+        if (*fmt != '%') {
+            *buf++ = (u_char) *fmt++;
+            continue;
+        }
+
+        fmt++;
+
+        zero = (u_char) ((*fmt == '0') ? '0' : ' ');
+        width = 0;
+        sign = 1;
+        hex = 0;
+        slen = (size_t) -1;
+        i64 = 0;
+        ui64 = 0;
+
+        while (*fmt >= '0' && *fmt <= '9') {
+            width = width * 10 + (*fmt++ - '0');
+        }
+
+        for ( ;; ) {
+            switch (*fmt) {
+
+            case 'u':
+                sign = 0;
+                fmt++;
+                continue;
+
+            case 'x':
+                hex = 1;
+                sign = 0;
+                fmt++;
+                continue;
+
+            case 'X':
+                hex = 2;
+                sign = 0;
+                fmt++;
+                continue;
+
+            case '*':
+                slen = va_arg(args, size_t);
+                fmt++;
+                continue;
+
+            default:
+                break;
+            }
+
+            break;
+        }
+
+        switch (*fmt) {
+
+        case 'V':
+            v = va_arg(args, ngx_str_t *);
+            len = ngx_min((size_t) (last - buf), v->len);
+            buf = ngx_cpymem(buf, v->data, len);
+            fmt++;
+            continue;
+
+        case 's':
+            p = va_arg(args, u_char *);
+
+            if (slen == (size_t) -1) {
+                while (*p && buf < last) {
+                    *buf++ = *p++;
+                }
+
+            } else {
+                len = ngx_min((size_t) (last - buf), slen);
+                buf = ngx_cpymem(buf, p, len);
+            }
+
+            fmt++;
+            continue;
+
+        case 'c':
+            *buf++ = (u_char) va_arg(args, int);
+            fmt++;
+            continue;
+
+        case '%':
+            *buf++ = '%';
+            fmt++;
+            continue;
+
+        case 'p':
+            ui64 = (uintptr_t) va_arg(args, void *);
+            hex = 2;
+            sign = 0;
+            zero = '0';
+            width = 2 * sizeof(void *);
+            break;
+
+        case 'T':
+            i64 = (int64_t) va_arg(args, time_t);
+            sign = 1;
+            break;
+
+        case 'M':
+            if (sign) {
+                i64 = (int64_t) va_arg(args, ngx_msec_int_t);
+            } else {
+                ui64 = (uint64_t) va_arg(args, ngx_msec_t);
+            }
+            break;
+
+        case 'O':
+            i64 = (int64_t) va_arg(args, off_t);
+            sign = 1;
+            break;
+
+        case 'z':
+            if (sign) {
+                i64 = (int64_t) va_arg(args, ssize_t);
+            } else {
+                ui64 = (uint64_t) va_arg(args, size_t);
+            }
+            break;
+
+        case 'i':
+            if (sign) {
+                i64 = (int64_t) va_arg(args, ngx_int_t);
+            } else {
+                ui64 = (uint64_t) va_arg(args, ngx_uint_t);
+            }
+            break;
+
+        case 'D':
+            if (sign) {
+                i64 = (int64_t) va_arg(args, int32_t);
+            } else {
+                ui64 = (uint64_t) va_arg(args, uint32_t);
+            }
+            break;
+
+        case 'd':
+            if (sign) {
+                i64 = (int64_t) va_arg(args, int);
+            } else {
+                ui64 = (uint64_t) va_arg(args, u_int);
+            }
+            break;
+
+        case 'l':
+            if (sign) {
+                i64 = (int64_t) va_arg(args, long);
+            } else {
+                ui64 = (uint64_t) va_arg(args, u_long);
+            }
+            break;
+
+        case 'A':
+            if (sign) {
+                i64 = (int64_t) va_arg(args, ngx_atomic_int_t);
+            } else {
+                ui64 = (uint64_t) va_arg(args, ngx_atomic_uint_t);
+            }
+            break;
+
+        default:
+            *buf++ = (u_char) *fmt++;
+            continue;
+        }
+
+        fmt++;
+
+        if (sign) {
+            if (i64 < 0) {
+                *buf++ = '-';
+                ui64 = (uint64_t) -i64;
+
+            } else {
+                ui64 = (uint64_t) i64;
+            }
+        }
+
+        p = tmp + NGX_INT_T_LEN;
+
+        do {
+            if (hex) {
+                *--p = (u_char) ((hex == 1 ? "0123456789abcdef"
+                                           : "0123456789ABCDEF")[ui64 & 0xf]);
+                ui64 >>= 4;
+
+            } else {
+                *--p = (u_char) (ui64 % 10 + '0');
+                ui64 /= 10;
+            }
+
+        } while (ui64);
+
+        len = (tmp + NGX_INT_T_LEN) - p;
+
+        while (len < width-- && buf < last) {
+            *buf++ = zero;
+        }
+
+        len = ngx_min((size_t) (last - buf), len);
+        buf = ngx_cpymem(buf, p, len);
+    }
+
+    return buf;
+}
+
+
+u_char * ngx_cdecl
+ngx_sprintf(u_char *buf, const char *fmt, ...)
+{
+    u_char   *p;
+    va_list   args;
+
+    va_start(args, fmt);
+    p = ngx_vslprintf(buf, (void *) -1, fmt, args);
+    va_end(args);
+
+    return p;
+}
+
+
+u_char * ngx_cdecl
+ngx_snprintf(u_char *buf, size_t max, const char *fmt, ...)
+{
+    u_char   *p;
+    va_list   args;
+
+    va_start(args, fmt);
+    p = ngx_vslprintf(buf, buf + max, fmt, args);
+    va_end(args);
+
+    return p;
+}
+
+
+u_char * ngx_cdecl
+ngx_slprintf(u_char *buf, u_char *last, const char *fmt, ...)
+{
+    u_char   *p;
+    va_list   args;
+
+    va_start(args, fmt);
+    p = ngx_vslprintf(buf, last, fmt, args);
+    va_end(args);
+
+    return p;
+}
+
+
+void
+ngx_log_error_core(ngx_uint_t level, ngx_log_t *log, ngx_err_t err,
+    const char *fmt, ...)
+{
+    u_char   *p, errstr[2048];
+    va_list   args;
+
+    va_start(args, fmt);
+    p = ngx_vslprintf(errstr, errstr + sizeof(errstr) - 1, fmt, args);
+    va_end(args);
+
+    *p++ = '\n';
+
+    (void) write(STDERR_FILENO, errstr, p - errstr);
+}
+
+
+void ngx_cdecl
+ngx_conf_log_error(ngx_uint_t level, ngx_conf_t *cf, ngx_err_t err,
+    const char *fmt, ...)
+{
+    u_char   *p, errstr[2048];
+    va_list   args;
+
+    va_start(args, fmt);
+    p = ngx_vslprintf(errstr, errstr + sizeof(errstr) - 1, fmt, args);
+    va_end(args);
+
+    *p++ = '\n';
+
+    (void) write(STDERR_FILENO, errstr, p - errstr);
+}
+
+
+void
+ngx_sort(void *base, size_t n, size_t size,
+    ngx_int_t (*cmp)(const void *, const void *))
+{
+    u_char  *p1, *p2, *p;
+
+    p = malloc(size);
+    if (p == NULL) {
+        return;
+    }
+
+    for (p1 = (u_char *) base + size;
+         p1 < (u_char *) base + n * size;
+         p1 += size)
+    {
+        ngx_memcpy(p, p1, size);
+
+        for (p2 = p1;
+             p2 > (u_char *) base && cmp(p2 - size, p) > 0;
+             p2 -= size)
+        {
+            ngx_memcpy(p2, p2 - size, size);
+        }
+
+        ngx_memcpy(p2, p, size);
+    }
+
+    free(p);
+}
+
+
+static uint32_t  ngx_crc32_table[256];
+
+
+static void
+ngx_crc32_table_init(void)
+{
+    uint32_t    c;
+    ngx_uint_t  i, k;
+
+    for (i = 0; i < 256; i++) {
+        c = (uint32_t) i;
+
+        for (k = 0; k < 8; k++) {
+            c = (c & 1) ? (0xedb88320 ^ (c >> 1)) : (c >> 1);
+        }
+
+        ngx_crc32_table[i] = c;
+    }
+}
+
+
+void
+ngx_crc32_update(uint32_t *crc, u_char *p, size_t len)
+{
+    uint32_t  c;
+
+    if (ngx_crc32_table[1] == 0) {
+        ngx_crc32_table_init();
+    }
+
+    c = *crc;
+
+    while (len--) {
+        c = ngx_crc32_table[(c ^ *p++) & 0xff] ^ (c >> 8);
+    }
+
+    *crc = c;
+}
+
+
+uint32_t
+ngx_crc32_short(u_char *p, size_t len)
+{
+    uint32_t  crc;
+
+    ngx_crc32_init(crc);
+    ngx_crc32_update(&crc, p, len);
+    ngx_crc32_final(crc);
+
+    return crc;
+}
+
+
+uint32_t
+ngx_crc32_long(u_char *p, size_t len)
+{
+    return ngx_crc32_short(p, len);
+}
+
+
+uint32_t
+ngx_murmur_hash2(u_char *data, size_t len)
+{
+    uint32_t  h, k;
+
+    h = 0 ^ (uint32_t) len;
+
+    while (len >= 4) {
+        k  = data[0];
+        k |= data[1] << 8;
+        k |= data[2] << 16;
+        k |= (uint32_t) data[3] << 24;
+
+        k *= 0x5bd1e995;
+        k ^= k >> 24;
+        k *= 0x5bd1e995;
+
+        h *= 0x5bd1e995;
+        h ^= k;
+
+        data += 4;
+        len -= 4;
+    }
+
+    switch (len) {
+    case 3:
+        h ^= data[2] << 16;
+        /* fall through */
+    case 2:
+        h ^= data[1] << 8;
+        /* fall through */
+    case 1:
+        h ^= data[0];
+        h *= 0x5bd1e995;
+    }
+
+    h ^= h >> 13;
+    h *= 0x5bd1e995;
+    h ^= h >> 15;
+
+    return h;
+}
+
+
+ngx_uint_t
+ngx_hash_key(u_char *data, size_t len)
+{
+    ngx_uint_t  i, key;
+
+    key = 0;
+
+    for (i = 0; i < len; i++) {
+        key = ngx_hash(key, data[i]);
+    }
+
+    return key;
+}
+
+
+/* the contended acquisitions and the time spent waiting in them */
+ngx_uint_t  ngx_stub_lock_waits;
+uint64_t    ngx_stub_lock_wait_ns;
+
+
+static uint64_t
+ngx_stub_lock_now(void)
+{
+    struct timespec  ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+void
+ngx_spinlock(ngx_atomic_t *lock, ngx_atomic_int_t value, ngx_uint_t spin)
+{
+    uint64_t    start;
+    ngx_uint_t  i, n;
+
+    if (*lock == 0 && ngx_atomic_cmp_set(lock, 0, value)) {
+        return;
+    }
+
+    ngx_stub_lock_waits++;
+    start = ngx_stub_lock_now();
+
+    for ( ;; ) {
+
+        if (*lock == 0 && ngx_atomic_cmp_set(lock, 0, value)) {
+            ngx_stub_lock_wait_ns += ngx_stub_lock_now() - start;
+            return;
+        }
+
+        if (ngx_ncpu > 1) {
+
+            for (n = 1; n < spin; n <<= 1) {
+
+                for (i = 0; i < n; i++) {
+                    ngx_cpu_pause();
+                }
+
+                if (*lock == 0 && ngx_atomic_cmp_set(lock, 0, value)) {
+                    ngx_stub_lock_wait_ns += ngx_stub_lock_now() - start;
+                    return;
+                }
+            }
+        }
+
+        sched_yield();
+    }
+}
+
+
+/*
+ * A bump allocator over the zone: good enough for tools that build the
+ * shared state once and never free it.
+ */
+
+void *
+ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
+{
+    u_char  *p;
+
+    p = ngx_align_ptr(pool->addr, NGX_ALIGNMENT);
+
+    if (p + size > pool->end) {
+        return NULL;
+    }
+
+    pool->addr = p + size;
+
+    return p;
+}
+
+
+void *
+ngx_slab_alloc(ngx_slab_pool_t *pool, size_t size)
+{
+    void  *p;
+
+    ngx_shmtx_lock(pool);
+    p = ngx_slab_alloc_locked(pool, size);
+    ngx_shmtx_unlock(pool);
+
+    return p;
+}
+
+
+void *
+ngx_slab_calloc_locked(ngx_slab_pool_t *pool, size_t size)
+{
+    void  *p;
+
+    p = ngx_slab_alloc_locked(pool, size);
+    if (p) {
+        ngx_memzero(p, size);
+    }
+
+    return p;
+}
+
+
+void *
+ngx_slab_calloc(ngx_slab_pool_t *pool, size_t size)
+{
+    void  *p;
+
+    ngx_shmtx_lock(pool);
+    p = ngx_slab_calloc_locked(pool, size);
+    ngx_shmtx_unlock(pool);
+
+    return p;
+}
+
+
+void
+ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
+{
+}
+
+
+void
+ngx_slab_free(ngx_slab_pool_t *pool, void *p)
+{
+}
+
+
+/* everything below is configuration or request plumbing the tools never
+ * reach; it exists so that the module links */
+
+ngx_int_t
+ngx_parse_time(ngx_str_t *line, ngx_uint_t is_sec)
+{
+    return NGX_ERROR;
+}
+
+
+ssize_t
+ngx_parse_size(ngx_str_t *line)
+{
+    return NGX_ERROR;
+}
+
+
+ngx_int_t
+ngx_http_arg(ngx_http_request_t *r, u_char *name, size_t len,
+    ngx_str_t *value)
+{
+    return NGX_DECLINED;
+}
+
+
+void
+ngx_destroy_pool(ngx_pool_t *pool)
+{
+}
+
+
+ngx_connection_t *
+ngx_get_connection(ngx_socket_t s, ngx_log_t *log)
+{
+    ngx_event_t       *ev;
+    ngx_connection_t  *c;
+
+    c = calloc(1, sizeof(ngx_connection_t));
+    ev = calloc(2, sizeof(ngx_event_t));
+    if (c == NULL || ev == NULL) {
+        free(c);
+        free(ev);
+        return NULL;
+    }
+
+    c->fd = s;
+    c->read = &ev[0];
+    c->write = &ev[1];
+    c->read->data = c;
+    c->write->data = c;
+    c->log = log;
+
+    return c;
+}
+
+
+void
+ngx_close_connection(ngx_connection_t *c)
+{
+}
+
+
+void
+ngx_event_add_timer(ngx_event_t *ev, ngx_msec_t timer)
+{
+    ev->timer_set = 1;
+}
+
+
+void
+ngx_event_del_timer(ngx_event_t *ev)
+{
+    ev->timer_set = 0;
+}
+
+
+ngx_int_t
+ngx_handle_read_event(ngx_event_t *rev, ngx_uint_t flags)
+{
+    return NGX_OK;
+}
+
+
+ngx_resolver_ctx_t *
+ngx_resolve_start(ngx_resolver_t *r, ngx_resolver_ctx_t *temp)
+{
+    return NGX_NO_RESOLVER;
+}
+
+
+ngx_int_t
+ngx_resolve_name(ngx_resolver_ctx_t *ctx)
+{
+    return NGX_ERROR;
+}
+
+
+void
+ngx_resolve_name_done(ngx_resolver_ctx_t *ctx)
+{
+}
+
+
+char *
+ngx_resolver_strerror(ngx_int_t err)
+{
+    return "stub resolver";
+}
+
+
+in_port_t
+ngx_inet_get_port(struct sockaddr *sa)
+{
+    return ntohs(((struct sockaddr_in *) sa)->sin_port);
+}
+
+
+void
+ngx_inet_set_port(struct sockaddr *sa, in_port_t port)
+{
+    ((struct sockaddr_in *) sa)->sin_port = htons(port);
+}
+
+
+ngx_int_t
+ngx_cmp_sockaddr(struct sockaddr *sa1, socklen_t slen1,
+    struct sockaddr *sa2, socklen_t slen2, ngx_uint_t cmp_port)
+{
+    struct sockaddr_in  *sin1, *sin2;
+
+    sin1 = (struct sockaddr_in *) sa1;
+    sin2 = (struct sockaddr_in *) sa2;
+
+    if (sa1->sa_family != sa2->sa_family
+        || sin1->sin_addr.s_addr != sin2->sin_addr.s_addr
+        || (cmp_port && sin1->sin_port != sin2->sin_port))
+    {
+        return NGX_DECLINED;
+    }
+
+    return NGX_OK;
+}
+
+
+size_t
+ngx_sock_ntop(struct sockaddr *sa, socklen_t socklen, u_char *text, size_t len,
+    ngx_uint_t port)
+{
+    u_char              *p;
+    struct sockaddr_in  *sin;
+
+    sin = (struct sockaddr_in *) sa;
+    p = (u_char *) &sin->sin_addr;
+
+    if (port) {
+        p = ngx_snprintf(text, len, "%ud.%ud.%ud.%ud:%d",
+                         p[0], p[1], p[2], p[3], ntohs(sin->sin_port));
+    } else {
+        p = ngx_snprintf(text, len, "%ud.%ud.%ud.%ud",
+                         p[0], p[1], p[2], p[3]);
+    }
+
+    return (p - text);
+}
+
+
+ngx_int_t
+ngx_inet_resolve_host(ngx_pool_t *pool, ngx_url_t *u)
+{
+    return NGX_ERROR;
+}
+
+
+ngx_int_t
+ngx_parse_url(ngx_pool_t *pool, ngx_url_t *u)
+{
+    return NGX_ERROR;
+}
+
+
+ngx_shm_zone_t *
+ngx_shared_memory_add(ngx_conf_t *cf, ngx_str_t *name, size_t size, void *tag)
+{
+    return NULL;
+}
+
+
+ngx_int_t
+ngx_http_compile_complex_value(ngx_http_compile_complex_value_t *ccv)
+{
+    *ccv->complex_value = (ngx_http_complex_value_t) { *ccv->value, NULL,
+                                                       NULL, NULL };
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_http_complex_value(ngx_http_request_t *r, ngx_http_complex_value_t *val,
+    ngx_str_t *value)
+{
+    *value = val->value;
+    return NGX_OK;
+}
+
+
+#if (NGX_STREAM)
+
+ngx_int_t
+ngx_stream_compile_complex_value(ngx_stream_compile_complex_value_t *ccv)
+{
+    *ccv->complex_value = (ngx_stream_complex_value_t) { *ccv->value, NULL,
+                                                         NULL, NULL };
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_stream_complex_value(ngx_stream_session_t *s,
+    ngx_stream_complex_value_t *val, ngx_str_t *value)
+{
+    *value = val->value;
+    return NGX_OK;
+}
+
+#endif
+
+
+ngx_int_t
+ngx_http_get_variable_index(ngx_conf_t *cf, ngx_str_t *name)
+{
+    return NGX_ERROR;
+}
+
+
+ngx_http_variable_value_t *
+ngx_http_get_indexed_variable(ngx_http_request_t *r, ngx_uint_t index)
+{
+    return NULL;
+}
+
+
+ngx_http_variable_value_t *
+ngx_http_get_flushed_variable(ngx_http_request_t *r, ngx_uint_t index)
+{
+    return NULL;
+}
+
+
+ngx_buf_t *
+ngx_create_temp_buf(ngx_pool_t *pool, size_t size)
+{
+    ngx_buf_t  *b;
+
+    b = ngx_calloc_buf(pool);
+    if (b == NULL) {
+        return NULL;
+    }
+
+    b->start = ngx_palloc(pool, size);
+    if (b->start == NULL) {
+        return NULL;
+    }
+
+    b->pos = b->start;
+    b->last = b->start;
+    b->end = b->last + size;
+    b->temporary = 1;
+
+    return b;
+}
+
+
+ngx_int_t
+ngx_http_send_header(ngx_http_request_t *r)
+{
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_http_output_filter(ngx_http_request_t *r, ngx_chain_t *chain)
+{
+    ngx_chain_t  *cl;
+
+    for (cl = chain; cl; cl = cl->next) {
+        (void) write(STDOUT_FILENO, cl->buf->pos, cl->buf->last - cl->buf->pos);
+    }
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_http_discard_request_body(ngx_http_request_t *r)
+{
+    return NGX_OK;
+}
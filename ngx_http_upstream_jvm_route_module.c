@@ -15,46 +15,256 @@
 #include <ngx_core.h>
 #include <ngx_http.h>
 
+#if (NGX_STREAM)
+#include <ngx_stream.h>
+#endif
+
+#if (NGX_HAVE_SSE2)
+#include <emmintrin.h>
+#endif
+
 #define SHM_NAME_LEN 256
 
+/* how the route is taken out of the session value */
+#define NGX_JVM_ROUTE_PREFIX         0    /* srun_id is a prefix (resin) */
+#define NGX_JVM_ROUTE_REVERSE        1    /* srun_id is a suffix (tomcat) */
+#define NGX_JVM_ROUTE_SUFFIX_AFTER   2    /* route follows the last delimiter */
+#define NGX_JVM_ROUTE_PREFIX_BEFORE  3    /* route precedes the first delimiter */
+#define NGX_JVM_ROUTE_PREFIX_LEN     4    /* route is the first route_len bytes */
+#define NGX_JVM_ROUTE_JETTY          5    /* route is ".nodeN" at the tail */
+
+
+typedef struct {
+    ngx_int_t                        index;      /* of the variable */
+    ngx_str_t                        name;       /* looked up in the URI */
+} ngx_http_upstream_jvm_route_source_t;
 
 typedef struct {
-    ngx_http_complex_value_t         cookie;
+    /* tried in order, the first nonempty one is the session */
+    ngx_array_t                     *sources;
+
+    ngx_uint_t                       route_format;
+    size_t                           route_len;
+    u_char                           route_delimiter;
+
+    /* requests without a session go to the consistent hash of this key */
+    ngx_http_complex_value_t        *hash_key;
+    unsigned                         hash:1;
+
+    /* new sessions and failovers prefer the peers of this group */
+    ngx_http_complex_value_t        *local_group;
+
+    /* idle connections cached for each peer in each worker */
+    ngx_uint_t                       max_idle;
+    ngx_msec_t                       idle_timeout;
+
+    /* peers tried for a request, and retries per 100 requests */
+    ngx_uint_t                       tries;
+    ngx_uint_t                       retry_budget;
+
+    /* sticky requests are sent to a peer over its max_rps */
+    unsigned                         rps_keep:1;
+
+    /* how often the servers with "resolve" are resolved again */
+    ngx_msec_t                       resolve_interval;
+
+    /* the zone shared with other upstreams, NULL for a zone of its own */
+    ngx_shm_zone_t                  *shm_zone;
+
+    /* the heaviest sessions kept in the zone, and the limits of a session */
+    ngx_uint_t                       hot_sessions;
+    ngx_uint_t                       session_max_busy;
+    ngx_uint_t                       session_max_rps;
+    ngx_uint_t                       session_status;
 
-    ngx_str_t                        session_cookie;
-    ngx_str_t                        session_url;
+    /* long-lived requests, counted apart from nreq, and their limit */
+    ngx_http_complex_value_t        *long_lived;
+    ngx_uint_t                       long_max_busy;
 
-    unsigned                         reverse:1; 
+    /* requests without a session are refused above this load */
+    ngx_uint_t                       shed;
+    ngx_uint_t                       shed_status;
+    unsigned                         shed_percent:1;
+
+    /* requests without a session are sent again after the hedge delay */
+    ngx_msec_t                       hedge_delay;        /* or its maximum */
+    ngx_uint_t                       hedge_percentile;   /* 1/10 percent */
+    ngx_uint_t                       hedge_budget;
 } ngx_http_upstream_jvm_route_srv_conf_t;
 
+typedef struct ngx_http_upstream_jvm_route_peers_s ngx_http_upstream_jvm_route_peers_t;
+
 typedef struct {
     ngx_str_t shm_name;
+
+    /* the upstream shown, NULL for all of them */
+    ngx_http_upstream_jvm_route_peers_t  *peers;
 } ngx_http_upstream_jvm_route_loc_conf_t;
 
-typedef struct ngx_http_upstream_jvm_route_peers_s ngx_http_upstream_jvm_route_peers_t;
+/* what jvm_route_sync last read from a node */
+typedef struct {
+    uint32_t                              seq;
+    ngx_uint_t                            seen;
+} ngx_http_upstream_jvm_route_sync_node_t;
+
+typedef struct {
+    /* the peers of every jvm_route upstream, found once per cycle */
+    ngx_array_t                           upstreams;
+
+    /* the locations with jvm_route_status */
+    ngx_array_t                           status;
+
+    /* jvm_route_sync: this node, the other nodes and how often */
+    ngx_addr_t                           *sync_listen;
+    ngx_array_t                          *sync_nodes;     /* ngx_addr_t */
+    ngx_http_upstream_jvm_route_sync_node_t *sync_last;   /* per node */
+    ngx_msec_t                            sync_interval;
+
+    /* the worker process that has the address, and its timer */
+    ngx_connection_t                     *sync_connection;
+    ngx_event_t                           sync_event;
+    uint32_t                              sync_node;
+    uint32_t                              sync_seq;
+    ngx_uint_t                            sync_sends;
+} ngx_http_upstream_jvm_route_main_conf_t;
+
+/* the seconds kept for the rates of a peer, a power of two past 60 */
+#define NGX_JVM_ROUTE_SECONDS           64
+
+typedef struct {
+    uint32_t                            second;
+    uint32_t                            requests;
+    uint32_t                            done;
+    uint32_t                            fails;
+    uint32_t                            msec;      /* of the requests done */
+} ngx_http_upstream_jvm_route_second_t;
 
 typedef struct {
     ngx_uint_t                          nreq; /* active requests to the peer */
+    ngx_uint_t                          long_nreq; /* long-lived ones */
     ngx_uint_t                          total_req;
     ngx_uint_t                          last_req_id;
     ngx_uint_t                          fails;
     ngx_uint_t                          total_fails;
     time_t                              accessed;
     ngx_int_t                           current_weight;
+
+    /* the max_rps bucket, in 1/1000 of a request */
+    ngx_int_t                           rps_tokens;
+    ngx_msec_t                          rps_refilled;
+
+    /* the last seconds of the peer, a ring indexed by the second */
+    ngx_http_upstream_jvm_route_second_t  seconds[NGX_JVM_ROUTE_SECONDS];
+
+#if (NGX_HTTP_SSL || NGX_STREAM_SSL)
+    /* the last session saved by any worker, serialized into the zone */
+    u_char                             *ssl_session;
+    size_t                              ssl_session_len;
+    ngx_uint_t                          ssl_session_version;
+#endif
 } ngx_http_upstream_jvm_route_shared_t;
 
+/* the count-min sketch of the sessions, NGX_JVM_ROUTE_SKETCH_DEPTH rows */
+#define NGX_JVM_ROUTE_SKETCH_DEPTH      4
+#define NGX_JVM_ROUTE_SKETCH_WIDTH      1024
+
+/* the most sessions in the top, and the bytes of a session shown */
+#define NGX_JVM_ROUTE_HOT_SESSIONS_MAX  64
+#define NGX_JVM_ROUTE_SESSION_SHOWN     8
+
+typedef struct {
+    uint32_t                             hash;
+    uint32_t                             len;
+    u_char                               session[NGX_JVM_ROUTE_SESSION_SHOWN];
+    ngx_uint_t                           peer;
+
+    /* the most requests in a second, halved every second */
+    ngx_uint_t                           rps;
+    ngx_uint_t                           limited;
+} ngx_http_upstream_jvm_route_hot_session_t;
+
+/*
+ * The requests of each session in the current second and the requests in
+ * flight, counted in a count-min sketch, and a min-heap of the sessions
+ * with the most requests per second.  Both are updated under the lock of
+ * the block, by the requests with a route only.
+ */
+typedef struct {
+    time_t                               second;
+    ngx_uint_t                           size;
+    ngx_uint_t                           number;
+
+    uint32_t                             rps[NGX_JVM_ROUTE_SKETCH_DEPTH]
+                                            [NGX_JVM_ROUTE_SKETCH_WIDTH];
+    uint32_t                             busy[NGX_JVM_ROUTE_SKETCH_DEPTH]
+                                             [NGX_JVM_ROUTE_SKETCH_WIDTH];
+
+    ngx_http_upstream_jvm_route_hot_session_t  top[1];
+} ngx_http_upstream_jvm_route_sessions_t;
+
+/* the buckets of the response times, up to about two minutes */
+#define NGX_JVM_ROUTE_HEDGE_BUCKETS     64
+
+/* the response times needed before a percentile is trusted */
+#define NGX_JVM_ROUTE_HEDGE_SAMPLES     100
+
 typedef struct {
     ngx_uint_t                           generation;
     ngx_http_upstream_jvm_route_peers_t *peers; 
+
+    /* in the blocks of a jvm_route_zone */
+    ngx_queue_t                          queue;
+    ngx_str_t                            upstream;
+    ngx_uint_t                           number;
+
     ngx_uint_t                           total_nreq;
     ngx_uint_t                           total_requests;
+    ngx_uint_t                           total_shed;
+    ngx_int_t                            retry_tokens;  /* 1/100 of a retry */
+
+    /* jvm_route_hedge: the response times, halved every second */
+    ngx_uint_t                           hedge_times[NGX_JVM_ROUTE_HEDGE_BUCKETS];
+    ngx_uint_t                           hedge_samples;
+    time_t                               hedge_second;
+    ngx_msec_t                           hedge_delay;
+    ngx_int_t                            hedge_tokens;  /* 1/100 of a hedge */
+    ngx_int_t                            hedge_reserve; /* the most tokens */
+    time_t                               hedge_now;
+    ngx_uint_t                           hedge_requests[2];  /* now, before */
+    ngx_uint_t                           total_hedged;
+    ngx_http_upstream_jvm_route_sessions_t *sessions;
     ngx_atomic_t                         lock;
     ngx_http_upstream_jvm_route_shared_t stats[1];
 } ngx_http_upstream_jvm_route_shm_block_t;
 
+/* retries allowed by the budget before any request has paid for them */
+#define NGX_JVM_ROUTE_RETRY_RESERVE     10
+
+/* the largest serialized upstream session kept in the zone */
+#define NGX_JVM_ROUTE_SSL_SESSION_SIZE  4096
+
+/* the upstreams in a jvm_route_zone, kept in the zone across reloads */
+typedef struct {
+    ngx_queue_t                          blocks;
+} ngx_http_upstream_jvm_route_zone_t;
+
 /* ngx_spinlock is defined without a matching unlock primitive */
 #define ngx_spinlock_unlock(lock)       (void) ngx_atomic_cmp_set(lock, ngx_pid, 0)
 
+typedef struct {
+    ngx_queue_t                     cache;
+    ngx_queue_t                     free;
+} ngx_http_upstream_jvm_route_keepalive_t;
+
+typedef struct {
+    ngx_http_upstream_jvm_route_keepalive_t *keepalive;
+    ngx_queue_t                     queue;
+    ngx_connection_t               *connection;
+} ngx_http_upstream_jvm_route_cache_t;
+
+typedef struct ngx_http_upstream_jvm_route_resolve_s
+    ngx_http_upstream_jvm_route_resolve_t;
+
 typedef struct {
     ngx_http_upstream_jvm_route_shared_t *shared;
     struct sockaddr                *sockaddr;
@@ -64,23 +274,96 @@ typedef struct {
     ngx_int_t                       weight;
     ngx_uint_t                      max_fails;
     ngx_uint_t                      max_busy;
+    ngx_uint_t                      max_rps;
     time_t                          fail_timeout;
     ngx_uint_t                      down;          /* unsigned  down:1; */
     ngx_str_t                       srun_id;
+    ngx_str_t                       group;
 
-#if (NGX_HTTP_SSL)
+    /* the peers with a copy of its sessions, tried first when it cannot be */
+    ngx_str_t                       buddy;
+    ngx_uint_t                     *buddies;
+    ngx_uint_t                      nbuddies;
+
+    /* idle connections, local to a process */
+    ngx_http_upstream_jvm_route_keepalive_t *keepalive;
+
+    /* what jvm_route_sync last sent of the peer, local to its process */
+    ngx_uint_t                      sync_fails;
+    time_t                          sync_accessed;
+
+    /* the server name resolved again by each process, if "resolve" */
+    ngx_str_t                       host;
+    ngx_http_upstream_jvm_route_resolve_t   *resolve;
+
+#if (NGX_HTTP_SSL || NGX_STREAM_SSL)
     ngx_ssl_session_t              *ssl_session;   /* local to a process */
+    ngx_uint_t                      ssl_session_version;
 #endif
 } ngx_http_upstream_jvm_route_peer_t;
 
+/* the bytes of srun_id kept in the hot table, its head or its tail */
+#define NGX_JVM_ROUTE_KEY_LEN       8
+
+/*
+ * What the selection loops read of a peer, packed two to a cache line and
+ * indexed like peer[]: the cold fields stay in the peer.
+ */
+typedef struct {
+    u_char                          key[NGX_JVM_ROUTE_KEY_LEN];
+    uint32_t                        srun_id_len;
+    uint16_t                        group;         /* 0 if none */
+    u_char                          down;
+    u_char                          max_rps;       /* set if limited */
+    ngx_uint_t                      max_busy;
+    ngx_uint_t                      max_fails;
+} ngx_http_upstream_jvm_route_hot_t;
+
+typedef struct {
+    uint32_t                        hash;
+    ngx_uint_t                      peer;
+} ngx_http_upstream_jvm_route_point_t;
+
+typedef struct {
+    ngx_uint_t                            number;
+    ngx_http_upstream_jvm_route_point_t   point[1];
+} ngx_http_upstream_jvm_route_points_t;
+
+/* points on the hash ring for each unit of weight */
+#define NGX_JVM_ROUTE_POINTS        160
+
+/* ring points to try before falling back to round-robin */
+#define NGX_JVM_ROUTE_HASH_TRIES    20
+
 struct ngx_http_upstream_jvm_route_peers_s {
     /* data should be shared between processes */
     ngx_http_upstream_jvm_route_shm_block_t *shared;
+    ngx_slab_pool_t                         *shpool;
+
+    /* the consistent hash ring, built at configuration time */
+    ngx_http_upstream_jvm_route_points_t    *points;
+
+    /* the hot fields of peer[] */
+    ngx_http_upstream_jvm_route_hot_t       *hot;
 
     ngx_uint_t                               current;
     ngx_uint_t                               number;
     ngx_str_t                               *name;
     ngx_str_t                                shm_name;
+
+    /* the size of the top of the sessions, 0 if they are not counted */
+    ngx_uint_t                               hot_sessions;
+
+    /* the total_nreq from which requests without a session are refused */
+    ngx_uint_t                               shed;
+
+    /* set if long-lived requests are counted in long_nreq */
+    ngx_uint_t                               long_lived;
+    ngx_uint_t                               long_max_busy;
+
+    /* the hedge delay, or its maximum if it follows a percentile */
+    ngx_msec_t                               hedge_delay;
+    ngx_uint_t                               hedge_percentile;
     
     /* for backup peers support, not really used yet */
     ngx_http_upstream_jvm_route_peers_t     *next;  
@@ -90,28 +373,81 @@ struct ngx_http_upstream_jvm_route_peers_s {
 
 #define NGX_PEER_INVALID (~0UL)
 
+/* a peer with "resolve" keeps its slot and stats, only its address moves */
+struct ngx_http_upstream_jvm_route_resolve_s {
+    ngx_http_upstream_jvm_route_peers_t    *peers;
+    ngx_uint_t                              peer;
+
+    ngx_event_t                             event;
+    ngx_resolver_t                         *resolver;
+    ngx_msec_t                              resolver_timeout;
+    ngx_msec_t                              interval;
+
+    in_port_t                               port;
+    u_char                                  sockaddr[NGX_SOCKADDRLEN];
+    u_char                                  name[NGX_SOCKADDR_STRLEN];
+};
+
 typedef struct {
     ngx_http_upstream_jvm_route_srv_conf_t *conf;
     ngx_http_upstream_jvm_route_peers_t    *peers;
+    ngx_http_upstream_t                    *upstream;
 
     ngx_uint_t                              current;
     uintptr_t                              *tried;
-    uintptr_t                               data;
 
     ngx_str_t                               cookie;
+    ngx_str_t                               route;
+
+    uint32_t                                hash;
+    unsigned                                hashed:1;
+    unsigned                                budgeted:1;
+    unsigned                                long_lived:1;
+
+    /* may be hedged, the hedge delay was given and it is on this try */
+    unsigned                                hedge:1;
+    unsigned                                hedge_given:1;
+    unsigned                                hedge_timer:1;
+    ngx_msec_t                              start;
+
+    /* the hash of the session value, for jvm_route_hot_sessions */
+    uint32_t                                session_hash;
+    unsigned                                session:1;
+    unsigned                                counted:1;
+
+    ngx_str_t                               group;
 
     ngx_uint_t                              index;
+
+    /* the tried bits, allocated past the end for big upstreams */
+    uintptr_t                               data[1];
 } ngx_http_upstream_jvm_route_peer_data_t;
 
 
+static void * ngx_http_upstream_jvm_route_create_main_conf(ngx_conf_t *cf);
 static void * ngx_http_upstream_jvm_route_create_conf(ngx_conf_t *cf);
 static void * ngx_http_upstream_jvm_route_create_loc_conf(ngx_conf_t *cf);
+static ngx_int_t ngx_http_upstream_jvm_route_postconf(ngx_conf_t *cf);
+static ngx_int_t ngx_http_upstream_init_jvm_route(ngx_conf_t *cf,
+    ngx_http_upstream_srv_conf_t *us);
 static ngx_int_t ngx_http_upstream_init_jvm_route_peer(ngx_http_request_t *r,
     ngx_http_upstream_srv_conf_t *us);
 static ngx_int_t ngx_http_upstream_get_jvm_route_peer(ngx_peer_connection_t *pc,
     void *data);
 static char *ngx_http_upstream_jvm_route(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static char *ngx_http_upstream_jvm_route_hash(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+static char *ngx_http_upstream_jvm_route_local_group(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+static char *ngx_http_upstream_jvm_route_keepalive(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+static char *ngx_http_upstream_jvm_route_tries(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+static char *ngx_http_upstream_jvm_route_retry_budget(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+static char *ngx_http_upstream_jvm_route_rps_sticky(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
 static char *ngx_http_upstream_jvm_route_set_status(ngx_conf_t *cf, 
         ngx_command_t *cmd, void *conf);
  
@@ -120,7 +456,19 @@ ngx_http_upstream_get_jvm_route_peer(ngx_peer_connection_t *pc, void *data);
 static void
 ngx_http_upstream_free_jvm_route_peer(ngx_peer_connection_t *pc, void *data,
     ngx_uint_t state);
-#if (NGX_HTTP_SSL)
+static ngx_uint_t ngx_http_upstream_jvm_route_find_route(
+    ngx_http_upstream_jvm_route_peer_data_t *jrp);
+static ngx_int_t ngx_http_upstream_jvm_route_session_limit(
+    ngx_http_upstream_jvm_route_peer_data_t *jrp);
+static ngx_int_t ngx_http_upstream_jvm_route_get_cached(ngx_peer_connection_t *pc,
+    ngx_http_upstream_jvm_route_peer_t *peer);
+static void ngx_http_upstream_jvm_route_keepalive_save(ngx_peer_connection_t *pc,
+    ngx_http_upstream_jvm_route_peer_data_t *jrp,
+    ngx_http_upstream_jvm_route_peer_t *peer, ngx_uint_t state);
+static void ngx_http_upstream_jvm_route_keepalive_dummy_handler(ngx_event_t *ev);
+static void ngx_http_upstream_jvm_route_keepalive_close_handler(ngx_event_t *ev);
+static void ngx_http_upstream_jvm_route_keepalive_close(ngx_connection_t *c);
+#if (NGX_HTTP_SSL || NGX_STREAM_SSL)
 static ngx_int_t
 ngx_http_upstream_jvm_route_set_session(ngx_peer_connection_t *pc, void *data);
 static void
@@ -128,19 +476,147 @@ ngx_http_upstream_jvm_route_save_session(ngx_peer_connection_t *pc, void *data);
 #endif
 
 static ngx_int_t ngx_http_upstream_jvm_route_init_module(ngx_cycle_t *cycle);
+static ngx_int_t ngx_http_upstream_jvm_route_init_process(ngx_cycle_t *cycle);
+static void ngx_http_upstream_jvm_route_resolve_timer(ngx_event_t *ev);
+static void ngx_http_upstream_jvm_route_resolve_handler(ngx_resolver_ctx_t *ctx);
+static char *ngx_http_upstream_jvm_route_resolve_interval(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+static char *ngx_http_upstream_jvm_route_zone(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+static char *ngx_http_upstream_jvm_route_hot_sessions(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+static char *ngx_http_upstream_jvm_route_shed(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+static char *ngx_http_upstream_jvm_route_long_lived(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+static char *ngx_http_upstream_jvm_route_hedge(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+static char *ngx_http_upstream_jvm_route_sync(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+static void ngx_http_upstream_jvm_route_sync_timer(ngx_event_t *ev);
+static void ngx_http_upstream_jvm_route_sync_read(ngx_event_t *rev);
+static ngx_int_t ngx_http_upstream_jvm_route_sync_open(
+    ngx_http_upstream_jvm_route_main_conf_t *ujrmcf, ngx_log_t *log);
+static void ngx_http_upstream_jvm_route_sync_send(
+    ngx_http_upstream_jvm_route_main_conf_t *ujrmcf, ngx_log_t *log);
+static void ngx_http_upstream_jvm_route_sync_merge(
+    ngx_http_upstream_jvm_route_main_conf_t *ujrmcf, u_char *p, size_t size,
+    ngx_str_t *from, ngx_http_upstream_jvm_route_sync_node_t *node,
+    ngx_log_t *log);
+
+#if (NGX_STREAM)
+static ngx_int_t ngx_stream_upstream_init_jvm_route(ngx_conf_t *cf,
+    ngx_stream_upstream_srv_conf_t *us);
+static ngx_int_t ngx_stream_upstream_init_jvm_route_peer(
+    ngx_stream_session_t *s, ngx_stream_upstream_srv_conf_t *us);
+static ngx_int_t ngx_stream_upstream_jvm_route_check_names(ngx_conf_t *cf);
+static ngx_int_t ngx_stream_upstream_jvm_route_add_upstreams(
+    ngx_cycle_t *cycle);
+#endif
 
 
 static ngx_command_t  ngx_http_upstream_jvm_route_commands[] = {
 
     { ngx_string("jvm_route"),
-      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE12,
+      NGX_HTTP_UPS_CONF|NGX_CONF_1MORE,
       ngx_http_upstream_jvm_route,
       0,
       0,
       NULL },
 
+    { ngx_string("jvm_route_hash"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_NOARGS|NGX_CONF_TAKE1,
+      ngx_http_upstream_jvm_route_hash,
+      0,
+      0,
+      NULL },
+
+    { ngx_string("jvm_route_local_group"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE1,
+      ngx_http_upstream_jvm_route_local_group,
+      0,
+      0,
+      NULL },
+
+    { ngx_string("jvm_route_keepalive"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE12,
+      ngx_http_upstream_jvm_route_keepalive,
+      0,
+      0,
+      NULL },
+
+    { ngx_string("jvm_route_tries"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE1,
+      ngx_http_upstream_jvm_route_tries,
+      0,
+      0,
+      NULL },
+
+    { ngx_string("jvm_route_retry_budget"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE1,
+      ngx_http_upstream_jvm_route_retry_budget,
+      0,
+      0,
+      NULL },
+
+    { ngx_string("jvm_route_rps_sticky"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE1,
+      ngx_http_upstream_jvm_route_rps_sticky,
+      0,
+      0,
+      NULL },
+
+    { ngx_string("jvm_route_resolve_interval"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE1,
+      ngx_http_upstream_jvm_route_resolve_interval,
+      0,
+      0,
+      NULL },
+
+    { ngx_string("jvm_route_zone"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE12,
+      ngx_http_upstream_jvm_route_zone,
+      0,
+      0,
+      NULL },
+
+    { ngx_string("jvm_route_hot_sessions"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE1234,
+      ngx_http_upstream_jvm_route_hot_sessions,
+      0,
+      0,
+      NULL },
+
+    { ngx_string("jvm_route_shed"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE12,
+      ngx_http_upstream_jvm_route_shed,
+      0,
+      0,
+      NULL },
+
+    { ngx_string("jvm_route_long_lived"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE12,
+      ngx_http_upstream_jvm_route_long_lived,
+      0,
+      0,
+      NULL },
+
+    { ngx_string("jvm_route_hedge"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE123,
+      ngx_http_upstream_jvm_route_hedge,
+      0,
+      0,
+      NULL },
+
+    { ngx_string("jvm_route_sync"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_1MORE,
+      ngx_http_upstream_jvm_route_sync,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      0,
+      NULL },
+
     { ngx_string("jvm_route_status"),
-      NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_NOARGS|NGX_CONF_TAKE1,
       ngx_http_upstream_jvm_route_set_status,
       NGX_HTTP_LOC_CONF_OFFSET,
       0,
@@ -152,9 +628,9 @@ static ngx_command_t  ngx_http_upstream_jvm_route_commands[] = {
 
 static ngx_http_module_t  ngx_http_upstream_jvm_route_module_ctx = {
     NULL,                                         /* preconfiguration */
-    NULL,                                         /* postconfiguration */
+    ngx_http_upstream_jvm_route_postconf,         /* postconfiguration */
 
-    NULL,                                         /* create main configuration */
+    ngx_http_upstream_jvm_route_create_main_conf, /* create main configuration */
     NULL,                                         /* init main configuration */
 
     ngx_http_upstream_jvm_route_create_conf,      /* create server configuration */
@@ -172,7 +648,7 @@ ngx_module_t  ngx_http_upstream_jvm_route_module = {
     NGX_HTTP_MODULE,                         /* module type */
     NULL,                                    /* init master */
     ngx_http_upstream_jvm_route_init_module, /* init module */
-    NULL,                                    /* init process */
+    ngx_http_upstream_jvm_route_init_process, /* init process */
     NULL,                                    /* init thread */
     NULL,                                    /* exit thread */
     NULL,                                    /* exit process */
@@ -189,1221 +665,5777 @@ static ngx_int_t
 ngx_http_upstream_jvm_route_init_module(ngx_cycle_t *cycle)
 {
     ngx_http_upstream_jvm_route_generation++;
+
+#if (NGX_STREAM)
+    if (ngx_stream_upstream_jvm_route_add_upstreams(cycle) != NGX_OK) {
+        return NGX_ERROR;
+    }
+#endif
+
     return NGX_OK;
 }
 
 
-static uintptr_t *
-ngx_bitvector_alloc(ngx_pool_t *pool, ngx_uint_t size, uintptr_t *small)
+static ngx_int_t
+ngx_http_upstream_jvm_route_init_process(ngx_cycle_t *cycle)
 {
-    ngx_uint_t nelts = (size + NGX_BITVECTOR_ELT_SIZE - 1) / NGX_BITVECTOR_ELT_SIZE;
+    ngx_uint_t                              i, j;
+    ngx_http_upstream_srv_conf_t          **uscfp;
+    ngx_http_upstream_main_conf_t          *umcf;
+    ngx_http_upstream_jvm_route_peers_t    *peers;
+    ngx_http_upstream_jvm_route_resolve_t  *rs;
+    ngx_http_upstream_jvm_route_main_conf_t *ujrmcf;
 
-    if (small && nelts == 1) {
-        *small = 0;
-        return small;
+    umcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_upstream_module);
+    if (umcf == NULL) {
+        return NGX_OK;
     }
 
-    return ngx_pcalloc(pool, nelts * NGX_BITVECTOR_ELT_SIZE);
-}
+    ujrmcf = ngx_http_cycle_get_module_main_conf(cycle,
+                                           ngx_http_upstream_jvm_route_module);
 
+    /* the first worker process syncs, it is replaced if it dies */
 
-static ngx_int_t
-ngx_bitvector_test(uintptr_t *bv, ngx_uint_t bit)
-{
-    ngx_uint_t                      n, m;
+    if (ujrmcf->sync_listen && ngx_worker == 0) {
+        ujrmcf->sync_event.handler = ngx_http_upstream_jvm_route_sync_timer;
+        ujrmcf->sync_event.data = ujrmcf;
+        ujrmcf->sync_event.log = cycle->log;
+        ujrmcf->sync_event.cancelable = 1;
 
-    n = bit / NGX_BITVECTOR_ELT_SIZE;
-    m = 1 << (bit % NGX_BITVECTOR_ELT_SIZE);
+        ngx_add_timer(&ujrmcf->sync_event, 1);
+    }
 
-    return bv[n] & m;
-}
+    uscfp = umcf->upstreams.elts;
 
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
 
-static void
-ngx_bitvector_set(uintptr_t *bv, ngx_uint_t bit)
-{
-    ngx_uint_t                      n, m;
+        if (uscfp[i]->peer.init_upstream != ngx_http_upstream_init_jvm_route) {
+            continue;
+        }
 
-    n = bit / NGX_BITVECTOR_ELT_SIZE;
-    m = 1 << (bit % NGX_BITVECTOR_ELT_SIZE);
+        peers = uscfp[i]->peer.data;
 
-    bv[n] |= m;
-}
+        for (j = 0; peers && j < peers->number; j++) {
+            rs = peers->peer[j].resolve;
 
+            if (rs == NULL) {
+                continue;
+            }
 
-/* string1 compares with the string2 in reverse order. */
-static ngx_int_t
-ngx_strncmp_r(u_char *s1, u_char *s2, size_t len1, size_t len2)
-{
-    if (len2 == 0 || len1 == 0) {
-        return -1;
-    }
+            rs->event.handler = ngx_http_upstream_jvm_route_resolve_timer;
+            rs->event.data = rs;
+            rs->event.log = cycle->log;
+            rs->event.cancelable = 1;
 
-    while (s1[--len1] == s2[--len2]) {
-        if (len2 == 0 || len1 == 0) {
-            return 0;
+            ngx_add_timer(&rs->event, rs->interval);
         }
     }
 
-    return s1[len1] - s2[len2];
+    return NGX_OK;
 }
 
 
-static ngx_int_t 
-ngx_strntok(u_char *s, const char *delim, size_t len, size_t count)
+static void
+ngx_http_upstream_jvm_route_resolve_timer(ngx_event_t *ev)
 {
-    ngx_uint_t i, j;
+    ngx_resolver_ctx_t                     *ctx;
+    ngx_http_upstream_jvm_route_peer_t     *peer;
+    ngx_http_upstream_jvm_route_resolve_t  *rs;
 
-    for (i = 0; i < len; i++) {
-        for (j = 0; j < count; j++) {
-            if (s[i] == delim[j])
-                return i;
-        }
+    rs = ev->data;
+    peer = &rs->peers->peer[rs->peer];
+
+    if (ngx_exiting) {
+        return;
     }
 
-    return -1;
+    ctx = ngx_resolve_start(rs->resolver, NULL);
+
+    if (ctx == NGX_NO_RESOLVER) {
+        ngx_log_error(NGX_LOG_ERR, ev->log, 0,
+                      "[upstream_jvm_route] no resolver to resolve \"%V\"",
+                      &peer->host);
+        return;
+    }
+
+    if (ctx == NULL) {
+        goto again;
+    }
+
+    ctx->name = peer->host;
+    ctx->handler = ngx_http_upstream_jvm_route_resolve_handler;
+    ctx->data = rs;
+    ctx->timeout = rs->resolver_timeout;
+
+    if (ngx_resolve_name(ctx) == NGX_OK) {
+        return;
+    }
+
+again:
+
+    ngx_add_timer(ev, rs->interval);
 }
 
 
-static u_char *
-ngx_strncasestrn(u_char *s1, u_char *s2, size_t len1, size_t len2)
+static void
+ngx_http_upstream_jvm_route_resolve_handler(ngx_resolver_ctx_t *ctx)
 {
-    u_char  c1, c2;
-    size_t  n;
-
-    if (len2 == 0 || len1 == 0) {
-        return NULL;
+    size_t                                  len;
+    u_char                                  text[NGX_SOCKADDR_STRLEN];
+    ngx_uint_t                              i;
+    ngx_queue_t                            *q;
+    ngx_http_upstream_jvm_route_peer_t     *peer;
+    ngx_http_upstream_jvm_route_cache_t    *item;
+    ngx_http_upstream_jvm_route_resolve_t  *rs;
+
+    rs = ctx->data;
+    peer = &rs->peers->peer[rs->peer];
+
+    if (ctx->state) {
+        ngx_log_error(NGX_LOG_ERR, rs->event.log, 0,
+                      "[upstream_jvm_route] \"%V\" could not be resolved "
+                      "(%i: %s), %V is kept", &ctx->name, ctx->state,
+                      ngx_resolver_strerror(ctx->state), &peer->name);
+        goto done;
     }
 
-    c2 = *s2++;
-    c2  = (c2 >= 'A' && c2 <= 'Z') ? (c2 | 0x20) : c2;
+    /* the peer stays where it is while its address is still returned */
 
-    n = len2 - 1;
+    for (i = 0; i < ctx->naddrs; i++) {
+        if (ngx_cmp_sockaddr(ctx->addrs[i].sockaddr, ctx->addrs[i].socklen,
+                             peer->sockaddr, peer->socklen, 0)
+            == NGX_OK)
+        {
+            goto done;
+        }
+    }
 
-    do {
-        do {
-            if (len1-- == 0) {
-                return NULL;
-            }
+    if (ctx->naddrs == 0 || ctx->addrs[0].socklen > NGX_SOCKADDRLEN) {
+        goto done;
+    }
 
-            c1 = *s1++;
+    ngx_memcpy(rs->sockaddr, ctx->addrs[0].sockaddr, ctx->addrs[0].socklen);
+    ngx_inet_set_port((struct sockaddr *) rs->sockaddr, rs->port);
 
-            if (c1 == 0) {
-                return NULL;
-            }
+    len = ngx_sock_ntop((struct sockaddr *) rs->sockaddr,
+                        ctx->addrs[0].socklen, text, NGX_SOCKADDR_STRLEN, 1);
 
-            c1  = (c1 >= 'A' && c1 <= 'Z') ? (c1 | 0x20) : c1;
+    ngx_log_error(NGX_LOG_NOTICE, rs->event.log, 0,
+                  "[upstream_jvm_route] \"%V\" of upstream \"%V\" "
+                  "moved from %V to %*s", &peer->host, rs->peers->name,
+                  &peer->name, len, text);
 
-        } while (c1 != c2 || c1 != c2);
+    peer->socklen = ctx->addrs[0].socklen;
+    peer->name.len = ngx_cpymem(rs->name, text, len) - rs->name;
 
-        if (n > len1) {
-            return NULL;
-        }
+    /* the idle connections go to the old address */
 
-    } while (ngx_strncasecmp(s1, s2, n) != 0);
+    while (peer->keepalive && !ngx_queue_empty(&peer->keepalive->cache)) {
+        q = ngx_queue_head(&peer->keepalive->cache);
+        ngx_queue_remove(q);
+        ngx_queue_insert_head(&peer->keepalive->free, q);
 
-    return --s1;
-}
+        item = ngx_queue_data(q, ngx_http_upstream_jvm_route_cache_t, queue);
 
+        ngx_http_upstream_jvm_route_keepalive_close(item->connection);
+    }
 
-static ngx_int_t
-ngx_http_upstream_cmp_servers(const void *one, const void *two)
-{
-    ngx_http_upstream_jvm_route_peer_t  *first, *second;
+done:
 
-    first = (ngx_http_upstream_jvm_route_peer_t *) one;
-    second = (ngx_http_upstream_jvm_route_peer_t *) two;
+    ngx_resolve_name_done(ctx);
 
-    return (first->weight < second->weight);
+    if (!ngx_exiting) {
+        ngx_add_timer(&rs->event, rs->interval);
+    }
 }
 
 
-/* Have not support the backup server yet. */
-static ngx_int_t
-ngx_http_upstream_init_jvm_route_rr(ngx_conf_t *cf,
-    ngx_http_upstream_srv_conf_t *us)
-{
+/*
+ * jvm_route_sync: the nodes of a cluster tell each other the failures of
+ * their peers, so that a backend seen failing by one nginx is skipped by
+ * all of them until its fail_timeout.  One worker process has the UDP
+ * address of the node; the others see what it merges through the zones.
+ *
+ * A datagram is a header and its entries, in network byte order:
+ *
+ *     "JVMR", version (1), 0 (1), entries (2), node (4), sequence (4)
+ *
+ *     upstream length (1), upstream, srun_id length (1), srun_id,
+ *     fails (2), seconds since the last failure (4)
+ *
+ * A server without srun_id, as in the stream upstreams, is sent under its
+ * name instead, and the names of the upstreams are unique across the http
+ * and stream blocks.
+ *
+ * The age is relative, so the clocks of the nodes need not agree.  An
+ * entry is only merged when it has more failures than the peer has here,
+ * which makes the echo of an entry back to its sender a no-op.
+ *
+ * A send carries the entries that changed since the last one, and every
+ * NGX_JVM_ROUTE_SYNC_REFRESH sends all of them, for the datagrams lost.
+ * The sequence goes up by one a datagram, from the time the address was
+ * bound, and a datagram at most NGX_JVM_ROUTE_SYNC_WINDOW behind the last
+ * one read from its node is a late or repeated one and is dropped; further
+ * behind, the node has been restarted after its clock went back.
+ */
+
+#define NGX_JVM_ROUTE_SYNC_SIZE     1400
+#define NGX_JVM_ROUTE_SYNC_HEADER   16
+#define NGX_JVM_ROUTE_SYNC_VERSION  1
+#define NGX_JVM_ROUTE_SYNC_REFRESH  10
+#define NGX_JVM_ROUTE_SYNC_WINDOW   1024
+
+#define ngx_jvm_route_sync_get16(p)  ((ngx_uint_t) (p)[0] << 8 | (p)[1])
+
+#define ngx_jvm_route_sync_get32(p)                                          \
+    ((uint32_t) (p)[0] << 24 | (uint32_t) (p)[1] << 16                       \
+     | (uint32_t) (p)[2] << 8 | (p)[3])
+
+
+static u_char *
+ngx_jvm_route_sync_put32(u_char *p, uint32_t n)
+{
+    *p++ = (u_char) (n >> 24);
+    *p++ = (u_char) (n >> 16);
+    *p++ = (u_char) (n >> 8);
+    *p++ = (u_char) n;
+
+    return p;
+}
+
+
+static void
+ngx_http_upstream_jvm_route_sync_timer(ngx_event_t *ev)
+{
+    ngx_http_upstream_jvm_route_main_conf_t  *ujrmcf;
+
+    ujrmcf = ev->data;
+
+    if (ngx_exiting) {
+        return;
+    }
+
+    /* the address may still be held by a worker of the previous cycle */
+
+    if (ujrmcf->sync_connection != NULL
+        || ngx_http_upstream_jvm_route_sync_open(ujrmcf, ev->log) == NGX_OK)
+    {
+        ngx_http_upstream_jvm_route_sync_send(ujrmcf, ev->log);
+    }
+
+    ngx_add_timer(ev, ujrmcf->sync_interval);
+}
+
+
+static ngx_int_t
+ngx_http_upstream_jvm_route_sync_open(
+    ngx_http_upstream_jvm_route_main_conf_t *ujrmcf, ngx_log_t *log)
+{
+    ngx_err_t          err;
+    ngx_addr_t        *addr;
+    ngx_socket_t       s;
+    ngx_connection_t  *c;
+
+    addr = ujrmcf->sync_listen;
+
+    s = ngx_socket(addr->sockaddr->sa_family, SOCK_DGRAM, 0);
+
+    if (s == (ngx_socket_t) -1) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_socket_errno,
+                      "[upstream_jvm_route] " ngx_socket_n " failed");
+        return NGX_ERROR;
+    }
+
+    if (bind(s, addr->sockaddr, addr->socklen) == -1) {
+        err = ngx_socket_errno;
+
+        if (err == NGX_EADDRINUSE) {
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, log, 0,
+                           "[upstream_jvm_route] sync address %V is in use",
+                           &addr->name);
+        } else {
+            ngx_log_error(NGX_LOG_ALERT, log, err,
+                          "[upstream_jvm_route] bind() to %V failed",
+                          &addr->name);
+        }
+
+        goto failed;
+    }
+
+    if (ngx_nonblocking(s) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_socket_errno,
+                      "[upstream_jvm_route] " ngx_nonblocking_n " failed");
+        goto failed;
+    }
+
+    c = ngx_get_connection(s, log);
+    if (c == NULL) {
+        goto failed;
+    }
+
+    /* closed by ngx_close_idle_connections() when the worker exits */
+
+    c->data = ujrmcf;
+    c->log = log;
+    c->idle = 1;
+
+    c->read->handler = ngx_http_upstream_jvm_route_sync_read;
+    c->read->log = log;
+    c->write->log = log;
+
+    if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+        ngx_close_connection(c);
+        return NGX_ERROR;
+    }
+
+    ujrmcf->sync_connection = c;
+
+    /* ahead of the sequence of a previous holder of the address */
+
+    ujrmcf->sync_seq = (uint32_t) ngx_time() << 10;
+    ujrmcf->sync_sends = 0;
+
+    ngx_log_error(NGX_LOG_NOTICE, log, 0,
+                  "[upstream_jvm_route] sync on %V", &addr->name);
+
+    return NGX_OK;
+
+failed:
+
+    if (ngx_close_socket(s) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_socket_errno,
+                      "[upstream_jvm_route] " ngx_close_socket_n " failed");
+    }
+
+    return NGX_ERROR;
+}
+
+
+static void
+ngx_http_upstream_jvm_route_sync_flush(
+    ngx_http_upstream_jvm_route_main_conf_t *ujrmcf, u_char *buf, u_char *last,
+    ngx_uint_t count, ngx_log_t *log)
+{
+    u_char      *p;
+    ngx_uint_t   i;
+    ngx_addr_t  *node;
+
+    p = ngx_cpymem(buf, "JVMR", 4);
+    *p++ = NGX_JVM_ROUTE_SYNC_VERSION;
+    *p++ = 0;
+    *p++ = (u_char) (count >> 8);
+    *p++ = (u_char) count;
+    p = ngx_jvm_route_sync_put32(p, ujrmcf->sync_node);
+    ngx_jvm_route_sync_put32(p, ujrmcf->sync_seq++);
+
+    node = ujrmcf->sync_nodes->elts;
+
+    for (i = 0; i < ujrmcf->sync_nodes->nelts; i++) {
+        if (sendto(ujrmcf->sync_connection->fd, buf, last - buf, 0,
+                   node[i].sockaddr, node[i].socklen)
+            == -1)
+        {
+            ngx_log_error(NGX_LOG_INFO, log, ngx_socket_errno,
+                          "[upstream_jvm_route] sendto() to %V failed",
+                          &node[i].name);
+        }
+    }
+}
+
+
+static void
+ngx_http_upstream_jvm_route_sync_send(
+    ngx_http_upstream_jvm_route_main_conf_t *ujrmcf, ngx_log_t *log)
+{
+    u_char                                 *p, buf[NGX_JVM_ROUTE_SYNC_SIZE];
+    size_t                                  len;
+    time_t                                  now, accessed;
+    ngx_str_t                              *id;
+    ngx_uint_t                              i, n, fails, count, full;
+    ngx_http_upstream_jvm_route_peer_t     *peer;
+    ngx_http_upstream_jvm_route_peers_t   **peersp, *peers;
+
+    now = ngx_time();
+    peersp = ujrmcf->upstreams.elts;
+
+    full = (ujrmcf->sync_sends++ % NGX_JVM_ROUTE_SYNC_REFRESH == 0);
+
+    p = buf + NGX_JVM_ROUTE_SYNC_HEADER;
+    count = 0;
+
+    for (i = 0; i < ujrmcf->upstreams.nelts; i++) {
+        peers = peersp[i];
+
+        if (peers->shared == NULL || peers->name->len > 255) {
+            continue;
+        }
+
+        for (n = 0; n < peers->number; n++) {
+            peer = &peers->peer[n];
+
+            ngx_spinlock(&peers->shared->lock, ngx_pid, 1024);
+
+            if (peers->shared->peers != peers
+                || peers->shared->generation
+                   != ngx_http_upstream_jvm_route_generation)
+            {
+                ngx_spinlock_unlock(&peers->shared->lock);
+                break;
+            }
+
+            fails = peers->shared->stats[n].fails;
+            accessed = peers->shared->stats[n].accessed;
+
+            ngx_spinlock_unlock(&peers->shared->lock);
+
+            /* a peer without srun_id, such as a stream one, goes by name */
+
+            id = peer->srun_id.len ? &peer->srun_id : &peer->name;
+
+            if (fails == 0 || id->len > 255
+                || now - accessed > peer->fail_timeout)
+            {
+                peer->sync_fails = 0;
+                continue;
+            }
+
+            if (!full && fails == peer->sync_fails
+                && accessed == peer->sync_accessed)
+            {
+                continue;
+            }
+
+            peer->sync_fails = fails;
+            peer->sync_accessed = accessed;
+
+            len = 2 + peers->name->len + id->len + 6;
+
+            if (p + len > buf + NGX_JVM_ROUTE_SYNC_SIZE) {
+                ngx_http_upstream_jvm_route_sync_flush(ujrmcf, buf, p, count,
+                                                       log);
+                p = buf + NGX_JVM_ROUTE_SYNC_HEADER;
+                count = 0;
+            }
+
+            *p++ = (u_char) peers->name->len;
+            p = ngx_cpymem(p, peers->name->data, peers->name->len);
+            *p++ = (u_char) id->len;
+            p = ngx_cpymem(p, id->data, id->len);
+
+            fails = ngx_min(fails, 0xffff);
+            *p++ = (u_char) (fails >> 8);
+            *p++ = (u_char) fails;
+            p = ngx_jvm_route_sync_put32(p, (uint32_t) (now - accessed));
+
+            count++;
+        }
+    }
+
+    if (count) {
+        ngx_http_upstream_jvm_route_sync_flush(ujrmcf, buf, p, count, log);
+    }
+}
+
+
+static void
+ngx_http_upstream_jvm_route_sync_read(ngx_event_t *rev)
+{
+    u_char                                    buf[NGX_JVM_ROUTE_SYNC_SIZE];
+    u_char                                    sa[NGX_SOCKADDRLEN];
+    ssize_t                                   n;
+    socklen_t                                 socklen;
+    ngx_err_t                                 err;
+    ngx_uint_t                                i;
+    ngx_addr_t                               *node;
+    ngx_connection_t                         *c;
+    ngx_http_upstream_jvm_route_main_conf_t  *ujrmcf;
+
+    c = rev->data;
+    ujrmcf = c->data;
+
+    if (c->close) {
+        ngx_close_connection(c);
+        ujrmcf->sync_connection = NULL;
+        return;
+    }
+
+    for ( ;; ) {
+        socklen = NGX_SOCKADDRLEN;
+
+        n = recvfrom(c->fd, buf, NGX_JVM_ROUTE_SYNC_SIZE, 0,
+                     (struct sockaddr *) sa, &socklen);
+
+        if (n == -1) {
+            err = ngx_socket_errno;
+
+            if (err != NGX_EAGAIN) {
+                ngx_log_error(NGX_LOG_ALERT, rev->log, err,
+                              "[upstream_jvm_route] recvfrom() failed");
+            }
+
+            break;
+        }
+
+        /* only the configured nodes are listened to */
+
+        node = ujrmcf->sync_nodes->elts;
+
+        for (i = 0; i < ujrmcf->sync_nodes->nelts; i++) {
+            if (ngx_cmp_sockaddr((struct sockaddr *) sa, socklen,
+                                 node[i].sockaddr, node[i].socklen, 1)
+                == NGX_OK)
+            {
+                break;
+            }
+        }
+
+        if (i == ujrmcf->sync_nodes->nelts) {
+            ngx_log_debug0(NGX_LOG_DEBUG_HTTP, rev->log, 0,
+                           "[upstream_jvm_route] sync datagram from an "
+                           "unknown node");
+            continue;
+        }
+
+        ngx_http_upstream_jvm_route_sync_merge(ujrmcf, buf, n, &node[i].name,
+                                               &ujrmcf->sync_last[i], rev->log);
+    }
+
+    if (ngx_handle_read_event(rev, 0) != NGX_OK) {
+        ngx_close_connection(c);
+        ujrmcf->sync_connection = NULL;
+    }
+}
+
+
+static void
+ngx_http_upstream_jvm_route_sync_merge(
+    ngx_http_upstream_jvm_route_main_conf_t *ujrmcf, u_char *p, size_t size,
+    ngx_str_t *from, ngx_http_upstream_jvm_route_sync_node_t *node,
+    ngx_log_t *log)
+{
+    u_char                                 *last;
+    int32_t                                 behind;
+    uint32_t                                seq;
+    time_t                                  now, age;
+    ngx_str_t                               upstream, srun_id, *id;
+    ngx_uint_t                              i, n, count, fails, local;
+    ngx_http_upstream_jvm_route_peer_t     *peer;
+    ngx_http_upstream_jvm_route_peers_t   **peersp, *peers;
+    ngx_http_upstream_jvm_route_shared_t   *sh;
+
+    last = p + size;
+
+    if (size < NGX_JVM_ROUTE_SYNC_HEADER || ngx_memcmp(p, "JVMR", 4) != 0
+        || p[4] != NGX_JVM_ROUTE_SYNC_VERSION)
+    {
+        goto invalid;
+    }
+
+    if (ngx_jvm_route_sync_get32(p + 8) == ujrmcf->sync_node) {
+        return;
+    }
+
+    seq = ngx_jvm_route_sync_get32(p + 12);
+    behind = (int32_t) (node->seq - seq);
+
+    if (node->seen && behind >= 0 && behind <= NGX_JVM_ROUTE_SYNC_WINDOW) {
+        ngx_log_debug3(NGX_LOG_DEBUG_HTTP, log, 0,
+                       "[upstream_jvm_route] sync datagram %uD from %V is "
+                       "%D behind, dropped", seq, from, behind);
+        return;
+    }
+
+    node->seq = seq;
+    node->seen = 1;
+
+    count = ngx_jvm_route_sync_get16(p + 6);
+    p += NGX_JVM_ROUTE_SYNC_HEADER;
+
+    now = ngx_time();
+    peersp = ujrmcf->upstreams.elts;
+
+    while (count--) {
+
+        if (p == last || *p >= last - p) {
+            goto invalid;
+        }
+
+        upstream.len = *p++;
+        upstream.data = p;
+        p += upstream.len;
+
+        if (p == last || *p >= last - p) {
+            goto invalid;
+        }
+
+        srun_id.len = *p++;
+        srun_id.data = p;
+        p += srun_id.len;
+
+        if (last - p < 6) {
+            goto invalid;
+        }
+
+        fails = ngx_jvm_route_sync_get16(p);
+        age = ngx_jvm_route_sync_get32(p + 2);
+        p += 6;
+
+        for (i = 0; i < ujrmcf->upstreams.nelts; i++) {
+            peers = peersp[i];
+
+            if (peers->name->len == upstream.len
+                && ngx_strncmp(peers->name->data, upstream.data,
+                               upstream.len) == 0)
+            {
+                break;
+            }
+        }
+
+        if (i == ujrmcf->upstreams.nelts || peers->shared == NULL) {
+            continue;
+        }
+
+        for (n = 0; n < peers->number; n++) {
+            peer = &peers->peer[n];
+            id = peer->srun_id.len ? &peer->srun_id : &peer->name;
+
+            if (id->len == srun_id.len
+                && ngx_strncmp(id->data, srun_id.data, srun_id.len) == 0)
+            {
+                break;
+            }
+        }
+
+        if (n == peers->number || age > peer->fail_timeout) {
+            continue;
+        }
+
+        ngx_spinlock(&peers->shared->lock, ngx_pid, 1024);
+
+        if (peers->shared->peers == peers
+            && peers->shared->generation
+               == ngx_http_upstream_jvm_route_generation)
+        {
+            sh = &peers->shared->stats[n];
+
+            /* failures past their fail_timeout do not count here either */
+
+            local = (now - sh->accessed > peer->fail_timeout) ? 0 : sh->fails;
+
+            if (fails > local) {
+                ngx_log_debug5(NGX_LOG_DEBUG_HTTP, log, 0,
+                               "[upstream_jvm_route] %V of \"%V\": %ui fails "
+                               "%T seconds ago, from %V",
+                               id, &upstream, fails, age, from);
+
+                sh->fails = fails;
+
+                if (sh->accessed < now - age) {
+                    sh->accessed = now - age;
+                }
+            }
+        }
+
+        ngx_spinlock_unlock(&peers->shared->lock);
+    }
+
+    return;
+
+invalid:
+
+    ngx_log_error(NGX_LOG_INFO, log, 0,
+                  "[upstream_jvm_route] invalid sync datagram from %V", from);
+}
+
+
+#define ngx_bitvector_nelts(size)                                            \
+    (((size) + NGX_BITVECTOR_ELT_SIZE - 1) / NGX_BITVECTOR_ELT_SIZE)
+
+
+static ngx_int_t
+ngx_bitvector_test(uintptr_t *bv, ngx_uint_t bit)
+{
+    ngx_uint_t                      n;
+    uintptr_t                       m;
+
+    n = bit / NGX_BITVECTOR_ELT_SIZE;
+    m = (uintptr_t) 1 << (bit % NGX_BITVECTOR_ELT_SIZE);
+
+    return (bv[n] & m) != 0;
+}
+
+
+static void
+ngx_bitvector_set(uintptr_t *bv, ngx_uint_t bit)
+{
+    ngx_uint_t                      n;
+    uintptr_t                       m;
+
+    n = bit / NGX_BITVECTOR_ELT_SIZE;
+    m = (uintptr_t) 1 << (bit % NGX_BITVECTOR_ELT_SIZE);
+
+    bv[n] |= m;
+}
+
+
+/* the first clear bit in [from, to), or "to" if all of them are set */
+
+static ngx_uint_t
+ngx_bitvector_next_zero(uintptr_t *bv, ngx_uint_t from, ngx_uint_t to)
+{
+    ngx_uint_t                      n, bit;
+    uintptr_t                       w;
+
+    while (from < to) {
+        n = from / NGX_BITVECTOR_ELT_SIZE;
+        bit = from % NGX_BITVECTOR_ELT_SIZE;
+
+        /* the clear bits at or above "from" in this word */
+        w = ~bv[n] & ((uintptr_t) -1 << bit);
+
+        if (w) {
+#if (defined __GNUC__)
+            bit = __builtin_ctzll((unsigned long long) w);
+#else
+            for (bit = 0; !(w & ((uintptr_t) 1 << bit)); bit++) { /* void */ }
+#endif
+            from = n * NGX_BITVECTOR_ELT_SIZE + bit;
+
+            return ngx_min(from, to);
+        }
+
+        from = (n + 1) * NGX_BITVECTOR_ELT_SIZE;
+    }
+
+    return to;
+}
+
+
+/* string1 compares with the string2 in reverse order. */
+static ngx_int_t
+ngx_strncmp_r(u_char *s1, u_char *s2, size_t len1, size_t len2)
+{
+    if (len2 == 0 || len1 == 0) {
+        return -1;
+    }
+
+    while (s1[--len1] == s2[--len2]) {
+        if (len2 == 0 || len1 == 0) {
+            return 0;
+        }
+    }
+
+    return s1[len1] - s2[len2];
+}
+
+
+static ngx_int_t 
+ngx_strntok(u_char *s, const char *delim, size_t len, size_t count)
+{
+    ngx_uint_t i, j;
+#if (NGX_HAVE_SSE2)
+    int        mask;
+    __m128i    block, match;
+#endif
+
+    i = 0;
+
+#if (NGX_HAVE_SSE2)
+
+    /* 16 bytes against every delimiter at once, the tail is done below */
+
+    for ( /* void */ ; i + 16 <= len; i += 16) {
+        block = _mm_loadu_si128((__m128i *) &s[i]);
+        match = _mm_setzero_si128();
+
+        for (j = 0; j < count; j++) {
+            match = _mm_or_si128(match,
+                        _mm_cmpeq_epi8(block, _mm_set1_epi8(delim[j])));
+        }
+
+        mask = _mm_movemask_epi8(match);
+
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+
+#endif
+
+    for ( /* void */ ; i < len; i++) {
+        for (j = 0; j < count; j++) {
+            if (s[i] == delim[j])
+                return i;
+        }
+    }
+
+    return -1;
+}
+
+
+static u_char *
+ngx_strncasestrn(u_char *s1, u_char *s2, size_t len1, size_t len2)
+{
+    u_char  c1, c2;
+    size_t  n;
+#if (NGX_HAVE_SSE2)
+    int      mask, zero;
+    u_char   c3;
+    __m128i  first_lc, first_uc, last_lc, last_uc, nul, head, tail;
+#endif
+
+    if (len2 == 0 || len1 == 0) {
+        return NULL;
+    }
+
+    c2 = *s2;
+    c2  = (c2 >= 'A' && c2 <= 'Z') ? (c2 | 0x20) : c2;
+
+#if (NGX_HAVE_SSE2)
+
+    /*
+     * Check 16 start positions at a time: a position is a candidate only if
+     * both the first and the last byte of s2 match in either case.  Only
+     * candidates are compared in full, the scalar loop does the tail.
+     */
+
+    c3 = s2[len2 - 1];
+    c3  = (c3 >= 'A' && c3 <= 'Z') ? (c3 | 0x20) : c3;
+
+    first_lc = _mm_set1_epi8((char) c2);
+    first_uc = _mm_set1_epi8((char) ((c2 >= 'a' && c2 <= 'z')
+                                     ? (c2 & ~0x20) : c2));
+    last_lc = _mm_set1_epi8((char) c3);
+    last_uc = _mm_set1_epi8((char) ((c3 >= 'a' && c3 <= 'z')
+                                    ? (c3 & ~0x20) : c3));
+    nul = _mm_setzero_si128();
+
+    while (len1 >= len2 + 15) {
+        head = _mm_loadu_si128((__m128i *) s1);
+        tail = _mm_loadu_si128((__m128i *) (s1 + len2 - 1));
+
+        mask = _mm_movemask_epi8(
+                   _mm_and_si128(_mm_or_si128(_mm_cmpeq_epi8(head, first_lc),
+                                              _mm_cmpeq_epi8(head, first_uc)),
+                                 _mm_or_si128(_mm_cmpeq_epi8(tail, last_lc),
+                                              _mm_cmpeq_epi8(tail, last_uc))));
+
+        zero = _mm_movemask_epi8(_mm_cmpeq_epi8(head, nul));
+
+        if (zero) {
+            /* as in the scalar loop, nothing matches past a NUL */
+            mask &= (zero & -zero) - 1;
+        }
+
+        while (mask) {
+            n = __builtin_ctz(mask);
+
+            if (ngx_strncasecmp(s1 + n + 1, s2 + 1, len2 - 1) == 0) {
+                return s1 + n;
+            }
+
+            mask &= mask - 1;
+        }
+
+        if (zero) {
+            return NULL;
+        }
+
+        s1 += 16;
+        len1 -= 16;
+    }
+
+#endif
+
+    s2++;
+    n = len2 - 1;
+
+    do {
+        do {
+            if (len1-- == 0) {
+                return NULL;
+            }
+
+            c1 = *s1++;
+
+            if (c1 == 0) {
+                return NULL;
+            }
+
+            c1  = (c1 >= 'A' && c1 <= 'Z') ? (c1 | 0x20) : c1;
+
+        } while (c1 != c2 || c1 != c2);
+
+        if (n > len1) {
+            return NULL;
+        }
+
+    } while (ngx_strncasecmp(s1, s2, n) != 0);
+
+    return --s1;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_cmp_servers(const void *one, const void *two)
+{
+    ngx_http_upstream_jvm_route_peer_t  *first, *second;
+
+    first = (ngx_http_upstream_jvm_route_peer_t *) one;
+    second = (ngx_http_upstream_jvm_route_peer_t *) two;
+
+    return (first->weight < second->weight);
+}
+
+
+/* Have not support the backup server yet. */
+static ngx_int_t
+ngx_http_upstream_init_jvm_route_rr(ngx_conf_t *cf,
+    ngx_http_upstream_srv_conf_t *us)
+{
     ngx_url_t                      u;
     ngx_uint_t                     i, j, n;
     ngx_http_upstream_server_t    *server;
     ngx_http_upstream_jvm_route_peers_t  *peers, *backup;
 
-    if (us->servers) {
-        server = us->servers->elts;
+    if (us->servers) {
+        server = us->servers->elts;
+
+        n = 0;
+
+        for (i = 0; i < us->servers->nelts; i++) {
+            if (server[i].backup) {
+                continue;
+            }
+
+            /* a server to resolve again is one peer at its first address */
+            n += server[i].resolve ? 1 : server[i].naddrs;
+        }
+
+        peers = ngx_pcalloc(cf->pool, sizeof(ngx_http_upstream_jvm_route_peers_t)
+                              + sizeof(ngx_http_upstream_jvm_route_peer_t) * (n - 1));
+        if (peers == NULL) {
+            return NGX_ERROR;
+        }
+
+        peers->number = n;
+        peers->name = &us->host;
+
+        n = 0;
+
+        for (i = 0; i < us->servers->nelts; i++) {
+            for (j = 0; j < server[i].naddrs; j++) {
+                if (server[i].backup) {
+                    continue;
+                }
+
+                if (server[i].resolve) {
+                    if (j > 0) {
+                        break;
+                    }
+
+                    peers->peer[n].host = server[i].host;
+                }
+
+                peers->peer[n].sockaddr = server[i].addrs[j].sockaddr;
+                peers->peer[n].socklen = server[i].addrs[j].socklen;
+                peers->peer[n].name = server[i].addrs[j].name;
+                peers->peer[n].srun_id = server[i].srun_id;
+                peers->peer[n].group = server[i].group;
+                peers->peer[n].buddy = server[i].buddy;
+                peers->peer[n].max_fails = server[i].max_fails;
+                peers->peer[n].max_busy = server[i].max_busy;
+                peers->peer[n].max_rps = server[i].max_rps;
+                peers->peer[n].fail_timeout = server[i].fail_timeout;
+                peers->peer[n].down = server[i].down;
+                peers->peer[n].weight = server[i].down ? 0 : server[i].weight;
+
+                n++;
+            }
+        }
+
+        us->peer.data = peers;
+
+        ngx_sort(&peers->peer[0], (size_t) n,
+                 sizeof(ngx_http_upstream_jvm_route_peer_t),
+                 ngx_http_upstream_cmp_servers);
+
+        /* backup servers */
+
+        n = 0;
+
+        for (i = 0; i < us->servers->nelts; i++) {
+            if (!server[i].backup) {
+                continue;
+            }
+
+            n += server[i].naddrs;
+        }
+
+        if (n == 0) {
+            return NGX_OK;
+        }
+
+        backup = ngx_pcalloc(cf->pool, sizeof(ngx_http_upstream_jvm_route_peers_t)
+                              + sizeof(ngx_http_upstream_jvm_route_peer_t) * (n - 1));
+        if (backup == NULL) {
+            return NGX_ERROR;
+        }
+
+        backup->number = n;
+        backup->name = &us->host;
+
+        n = 0;
+
+        for (i = 0; i < us->servers->nelts; i++) {
+            for (j = 0; j < server[i].naddrs; j++) {
+                if (!server[i].backup) {
+                    continue;
+                }
+
+                backup->peer[n].sockaddr = server[i].addrs[j].sockaddr;
+                backup->peer[n].socklen = server[i].addrs[j].socklen;
+                backup->peer[n].name = server[i].addrs[j].name;
+                backup->peer[n].weight = server[i].weight;
+                backup->peer[n].srun_id = server[i].srun_id;
+                backup->peer[n].group = server[i].group;
+                backup->peer[n].buddy = server[i].buddy;
+                backup->peer[n].max_fails = server[i].max_fails;
+                backup->peer[n].max_busy = server[i].max_busy;
+                backup->peer[n].max_rps = server[i].max_rps;
+                backup->peer[n].fail_timeout = server[i].fail_timeout;
+                backup->peer[n].down = server[i].down;
+
+                n++;
+            }
+        }
+
+        peers->next = backup;
+
+        ngx_sort(&backup->peer[0], (size_t) n,
+                 sizeof(ngx_http_upstream_jvm_route_peer_t),
+                 ngx_http_upstream_cmp_servers);
+
+        return NGX_OK;
+    }
+
+    /* an upstream implicitly defined by proxy_pass, etc. */
+
+    if (us->port == 0) {
+        ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                      "no port in upstream \"%V\" in %s:%ui",
+                      &us->host, us->file_name, us->line);
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(&u, sizeof(ngx_url_t));
+
+    u.host = us->host;
+    u.port = us->port;
+
+    if (ngx_inet_resolve_host(cf->pool, &u) != NGX_OK) {
+        if (u.err) {
+            ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                          "%s in upstream \"%V\" in %s:%ui",
+                          u.err, &us->host, us->file_name, us->line);
+        }
+
+        return NGX_ERROR;
+    }
+
+    n = u.naddrs;
+
+    peers = ngx_pcalloc(cf->pool, sizeof(ngx_http_upstream_jvm_route_peers_t)
+                              + sizeof(ngx_http_upstream_jvm_route_peer_t) * (n - 1));
+    if (peers == NULL) {
+        return NGX_ERROR;
+    }
+
+    peers->number = n;
+    peers->name = &us->host;
+
+    for (i = 0; i < u.naddrs; i++) {
+        peers->peer[i].sockaddr = u.addrs[i].sockaddr;
+        peers->peer[i].socklen = u.addrs[i].socklen;
+        peers->peer[i].name = u.addrs[i].name;
+        peers->peer[i].weight = 1;
+        peers->peer[i].max_fails = 1;
+        peers->peer[i].max_busy = 0;
+        peers->peer[i].max_rps = 0;
+        peers->peer[i].fail_timeout = 10;
+    }
+
+    us->peer.data = peers;
+
+    /* implicitly defined upstream has no backup servers */
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_jvm_route_init_block(ngx_http_upstream_jvm_route_shm_block_t *shm_block,
+    ngx_http_upstream_jvm_route_peers_t *peers, ngx_slab_pool_t *shpool,
+    ngx_uint_t reused)
+{
+    size_t                                  size;
+    ngx_uint_t                              i;
+    ngx_atomic_t                           *lock;
+    ngx_http_upstream_jvm_route_sessions_t *sessions;
+
+    peers->shared = shm_block;
+    peers->shpool = shpool;
+
+    lock = &shm_block->lock;
+    ngx_spinlock(lock, ngx_pid, 1024);
+
+    shm_block->generation = ngx_http_upstream_jvm_route_generation + 1;
+    shm_block->peers = peers;
+    shm_block->total_nreq = 0;
+    shm_block->total_requests = 0;
+    shm_block->total_shed = 0;
+    shm_block->retry_tokens = NGX_JVM_ROUTE_RETRY_RESERVE * 100;
+
+    ngx_memzero(shm_block->hedge_times, sizeof(shm_block->hedge_times));
+    shm_block->hedge_samples = 0;
+    shm_block->hedge_second = 0;
+    shm_block->hedge_delay = peers->hedge_delay;
+    shm_block->hedge_tokens = NGX_JVM_ROUTE_RETRY_RESERVE * 100;
+    shm_block->hedge_reserve = NGX_JVM_ROUTE_RETRY_RESERVE * 100;
+    shm_block->hedge_now = 0;
+    shm_block->hedge_requests[0] = 0;
+    shm_block->hedge_requests[1] = 0;
+    shm_block->total_hedged = 0;
+
+    for (i = 0; i < peers->number; i++) {
+        shm_block->stats[i].nreq = 0;
+        shm_block->stats[i].long_nreq = 0;
+        shm_block->stats[i].last_req_id = 0;
+        shm_block->stats[i].total_req = 0;
+        shm_block->stats[i].fails = 0;
+        shm_block->stats[i].total_fails = 0;
+        shm_block->stats[i].accessed = 0;
+        shm_block->stats[i].current_weight = peers->peer[i].weight;
+        shm_block->stats[i].rps_tokens = peers->peer[i].max_rps * 1000;
+        shm_block->stats[i].rps_refilled = ngx_current_msec;
+
+        ngx_memzero(shm_block->stats[i].seconds,
+                    sizeof(shm_block->stats[i].seconds));
+
+#if (NGX_HTTP_SSL || NGX_STREAM_SSL)
+        if (reused && shm_block->stats[i].ssl_session) {
+            ngx_slab_free(shpool, shm_block->stats[i].ssl_session);
+        }
+
+        shm_block->stats[i].ssl_session = NULL;
+        shm_block->stats[i].ssl_session_len = 0;
+        shm_block->stats[i].ssl_session_version = 0;
+#endif
+
+        peers->peer[i].shared = &shm_block->stats[i];
+    }
+
+    /* the sessions are counted again, in a sketch of the new size */
+
+    sessions = reused ? shm_block->sessions : NULL;
+
+    if (sessions && sessions->size != peers->hot_sessions) {
+        ngx_slab_free(shpool, sessions);
+        sessions = NULL;
+    }
+
+    if (sessions == NULL && peers->hot_sessions) {
+        size = sizeof(ngx_http_upstream_jvm_route_sessions_t)
+               + (peers->hot_sessions - 1)
+                 * sizeof(ngx_http_upstream_jvm_route_hot_session_t);
+
+        sessions = ngx_slab_alloc(shpool, size);
+        if (sessions == NULL) {
+            shm_block->sessions = NULL;
+            ngx_spinlock_unlock(lock);
+            return NGX_ERROR;
+        }
+
+        sessions->size = peers->hot_sessions;
+    }
+
+    if (sessions) {
+        sessions->second = 0;
+        sessions->number = 0;
+        ngx_memzero(sessions->rps, sizeof(sessions->rps));
+        ngx_memzero(sessions->busy, sizeof(sessions->busy));
+    }
+
+    shm_block->sessions = sessions;
+
+    ngx_spinlock_unlock(lock);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_jvm_route_init_shm_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_slab_pool_t                        *shpool;
+    ngx_http_upstream_jvm_route_peers_t    *peers;
+    ngx_http_upstream_jvm_route_shm_block_t *shm_block;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, shm_zone->shm.log, 0,
+            "[upstream_jvm_route] data:%p, shm_zone->data:%p", data, shm_zone->data);
+
+    peers = shm_zone->data;
+    if (peers) {
+
+        shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+        if (data == NULL) {
+
+            if (shm_zone->shm.exists) {
+                shm_zone->data = shpool->data;
+                return NGX_OK;
+            }
+
+            shm_block = ngx_slab_alloc(shpool, sizeof(*shm_block) +
+                    (peers->number - 1) * sizeof(ngx_http_upstream_jvm_route_shared_t));
+
+            if (shm_block == NULL) {
+                ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                        "upstream_jvm_route_shm_size is too small!");
+                return NGX_ERROR;
+            }
+        }
+        else {
+            /* kill -HUP */
+            shm_block = data;
+        }
+
+        shm_zone->data = shm_block;
+
+        if (data == NULL) {
+            shm_block->sessions = NULL;
+        }
+
+        if (ngx_http_upstream_jvm_route_init_block(shm_block, peers, shpool,
+                                                   data != NULL)
+            != NGX_OK)
+        {
+            ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                    "upstream_jvm_route_shm_size is too small!");
+            return NGX_ERROR;
+        }
+
+        return NGX_OK;
+    }
+
+    ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+            "[upstream_jvm_route] can't find the peers!");
+
+    return NGX_ERROR;
+}
+
+
+/*
+ * A jvm_route_zone keeps one block per upstream.  On reload the block of
+ * an upstream with the same name and number of peers is used again.  The
+ * blocks of upstreams that are gone are freed one reload later, as the
+ * workers of the previous configuration may still use them.
+ */
+
+static ngx_int_t
+ngx_http_upstream_jvm_route_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    size_t                                   size;
+    ngx_uint_t                               i, generation, reused;
+    ngx_queue_t                             *q, *next;
+    ngx_slab_pool_t                         *shpool;
+    ngx_http_upstream_srv_conf_t           **uscfp;
+    ngx_http_upstream_main_conf_t           *umcf;
+    ngx_http_upstream_jvm_route_zone_t      *zone;
+    ngx_http_upstream_jvm_route_peers_t     *peers;
+    ngx_http_upstream_jvm_route_srv_conf_t  *ujrscf;
+    ngx_http_upstream_jvm_route_shm_block_t *shm_block;
+
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        return NGX_OK;
+    }
+
+    if (data) {
+        zone = shpool->data;
+
+    } else {
+        zone = ngx_slab_alloc(shpool, sizeof(ngx_http_upstream_jvm_route_zone_t));
+        if (zone == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_queue_init(&zone->blocks);
+        shpool->data = zone;
+    }
+
+    generation = ngx_http_upstream_jvm_route_generation + 1;
+
+    umcf = shm_zone->data;
+    uscfp = umcf->upstreams.elts;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+
+        if (uscfp[i]->peer.init_upstream != ngx_http_upstream_init_jvm_route) {
+            continue;
+        }
+
+        ujrscf = ngx_http_conf_upstream_srv_conf(uscfp[i],
+                                           ngx_http_upstream_jvm_route_module);
+
+        if (ujrscf->shm_zone != shm_zone) {
+            continue;
+        }
+
+        peers = uscfp[i]->peer.data;
+        shm_block = NULL;
+        reused = 0;
+
+        for (q = ngx_queue_head(&zone->blocks);
+             q != ngx_queue_sentinel(&zone->blocks);
+             q = ngx_queue_next(q))
+        {
+            shm_block = ngx_queue_data(q, ngx_http_upstream_jvm_route_shm_block_t,
+                                       queue);
+
+            if (shm_block->generation != generation
+                && shm_block->number == peers->number
+                && shm_block->upstream.len == peers->name->len
+                && ngx_strncmp(shm_block->upstream.data, peers->name->data,
+                               peers->name->len) == 0)
+            {
+                reused = 1;
+                break;
+            }
+        }
+
+        if (!reused) {
+            size = sizeof(ngx_http_upstream_jvm_route_shm_block_t)
+                   + (peers->number - 1)
+                     * sizeof(ngx_http_upstream_jvm_route_shared_t);
+
+            shm_block = ngx_slab_alloc(shpool, size + peers->name->len);
+
+            if (shm_block == NULL) {
+                ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                        "jvm_route_zone \"%V\" of %uz bytes is too small, "
+                        "no room for the %uz bytes of upstream \"%V\"",
+                        &shm_zone->shm.name, shm_zone->shm.size,
+                        size + peers->name->len, peers->name);
+                return NGX_ERROR;
+            }
+
+            ngx_memzero(shm_block, size);
+
+            shm_block->upstream.data = (u_char *) shm_block + size;
+            shm_block->upstream.len = peers->name->len;
+            ngx_memcpy(shm_block->upstream.data, peers->name->data,
+                       peers->name->len);
+
+            shm_block->number = peers->number;
+
+            ngx_queue_insert_tail(&zone->blocks, &shm_block->queue);
+        }
+
+        if (ngx_http_upstream_jvm_route_init_block(shm_block, peers, shpool,
+                                                   reused)
+            != NGX_OK)
+        {
+            ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                    "jvm_route_zone \"%V\" of %uz bytes is too small, "
+                    "no room for the hot sessions of upstream \"%V\"",
+                    &shm_zone->shm.name, shm_zone->shm.size, peers->name);
+            return NGX_ERROR;
+        }
+    }
+
+    for (q = ngx_queue_head(&zone->blocks);
+         q != ngx_queue_sentinel(&zone->blocks);
+         q = next)
+    {
+        next = ngx_queue_next(q);
+
+        shm_block = ngx_queue_data(q, ngx_http_upstream_jvm_route_shm_block_t,
+                                   queue);
+
+        if (shm_block->generation + 1 >= generation) {
+            continue;
+        }
+
+        ngx_queue_remove(q);
+
+        if (shm_block->sessions) {
+            ngx_slab_free(shpool, shm_block->sessions);
+        }
+
+#if (NGX_HTTP_SSL || NGX_STREAM_SSL)
+        for (i = 0; i < shm_block->number; i++) {
+            if (shm_block->stats[i].ssl_session) {
+                ngx_slab_free(shpool, shm_block->stats[i].ssl_session);
+            }
+        }
+#endif
+
+        ngx_slab_free(shpool, shm_block);
+    }
+
+    return NGX_OK;
+}
+
+
+static int
+ngx_http_upstream_jvm_route_cmp_points(const void *one, const void *two)
+{
+    ngx_http_upstream_jvm_route_point_t *first, *second;
+
+    first = (ngx_http_upstream_jvm_route_point_t *) one;
+    second = (ngx_http_upstream_jvm_route_point_t *) two;
+
+    if (first->hash < second->hash) {
+        return -1;
+    }
+
+    if (first->hash > second->hash) {
+        return 1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Ketama: every peer gets NGX_JVM_ROUTE_POINTS points per unit of weight,
+ * hashed from its srun_id (or its name if it has none), so adding or
+ * removing a peer moves only the keys next to its own points.
+ */
+static ngx_int_t
+ngx_http_upstream_jvm_route_init_points(ngx_conf_t *cf,
+    ngx_http_upstream_jvm_route_peers_t *peers)
+{
+    u_char                                *p, *buf;
+    ngx_str_t                             *id;
+    ngx_uint_t                             i, j, n, npoints;
+    ngx_http_upstream_jvm_route_points_t  *points;
+
+    npoints = 0;
+
+    for (i = 0; i < peers->number; i++) {
+        npoints += peers->peer[i].weight * NGX_JVM_ROUTE_POINTS;
+    }
+
+    if (npoints == 0) {
+        return NGX_OK;
+    }
+
+    points = ngx_palloc(cf->pool, sizeof(ngx_http_upstream_jvm_route_points_t)
+                   + sizeof(ngx_http_upstream_jvm_route_point_t) * (npoints - 1));
+    if (points == NULL) {
+        return NGX_ERROR;
+    }
+
+    npoints = 0;
+
+    for (i = 0; i < peers->number; i++) {
+
+        id = peers->peer[i].srun_id.len ? &peers->peer[i].srun_id
+                                        : &peers->peer[i].name;
+
+        buf = ngx_pnalloc(cf->pool, id->len + 1 + NGX_INT_T_LEN);
+        if (buf == NULL) {
+            return NGX_ERROR;
+        }
+
+        n = peers->peer[i].weight * NGX_JVM_ROUTE_POINTS;
+
+        for (j = 0; j < n; j++) {
+            p = ngx_sprintf(buf, "%V-%ui", id, j);
+
+            points->point[npoints].hash = ngx_murmur_hash2(buf, p - buf);
+            points->point[npoints].peer = i;
+            npoints++;
+        }
+    }
+
+    points->number = npoints;
+
+    ngx_qsort(points->point, npoints, sizeof(ngx_http_upstream_jvm_route_point_t),
+              ngx_http_upstream_jvm_route_cmp_points);
+
+    peers->points = points;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_jvm_route_init_hot(ngx_conf_t *cf,
+    ngx_http_upstream_jvm_route_peers_t *peers, ngx_uint_t route_format)
+{
+    size_t                                  k;
+    ngx_uint_t                              i, j, groups;
+    ngx_http_upstream_jvm_route_hot_t      *hot;
+    ngx_http_upstream_jvm_route_peer_t     *peer;
+
+    hot = ngx_pcalloc(cf->pool,
+                      peers->number * sizeof(ngx_http_upstream_jvm_route_hot_t));
+    if (hot == NULL) {
+        return NGX_ERROR;
+    }
+
+    groups = 0;
+
+    for (i = 0; i < peers->number; i++) {
+        peer = &peers->peer[i];
+
+        k = ngx_min(peer->srun_id.len, NGX_JVM_ROUTE_KEY_LEN);
+
+        if (route_format == NGX_JVM_ROUTE_REVERSE) {
+            ngx_memcpy(hot[i].key, peer->srun_id.data + peer->srun_id.len - k, k);
+
+        } else {
+            ngx_memcpy(hot[i].key, peer->srun_id.data, k);
+        }
+
+        hot[i].srun_id_len = peer->srun_id.len;
+        hot[i].down = peer->down ? 1 : 0;
+        hot[i].max_rps = peer->max_rps ? 1 : 0;
+        hot[i].max_busy = peer->max_busy;
+        hot[i].max_fails = peer->max_fails;
+
+        if (peer->group.len == 0) {
+            continue;
+        }
+
+        /* the peers of a group share the number of its first peer */
+
+        for (j = 0; j < i; j++) {
+            if (peers->peer[j].group.len == peer->group.len
+                && ngx_strncmp(peers->peer[j].group.data, peer->group.data,
+                               peer->group.len) == 0)
+            {
+                hot[i].group = hot[j].group;
+                break;
+            }
+        }
+
+        if (j < i) {
+            continue;
+        }
+
+        if (groups == 0xffff) {
+            ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                          "too many groups in upstream \"%V\"", peers->name);
+            return NGX_ERROR;
+        }
+
+        hot[i].group = ++groups;
+    }
+
+    peers->hot = hot;
+
+    return NGX_OK;
+}
+
+
+/*
+ * The buddies of a peer are the other peers whose srun_id is in its
+ * "buddy=" list, in the order of the list, resolved once the peers are
+ * sorted.  A server of several addresses gives them all.
+ */
+
+static ngx_int_t
+ngx_http_upstream_jvm_route_init_buddies(ngx_conf_t *cf,
+    ngx_http_upstream_jvm_route_peers_t *peers)
+{
+    u_char                              *p, *last, *comma;
+    ngx_str_t                            name;
+    ngx_uint_t                           i, j, k, found;
+    ngx_http_upstream_jvm_route_peer_t  *peer;
+
+    for (i = 0; i < peers->number; i++) {
+        peer = &peers->peer[i];
+
+        if (peer->buddy.len == 0) {
+            continue;
+        }
+
+        peer->buddies = ngx_palloc(cf->pool, peers->number * sizeof(ngx_uint_t));
+        if (peer->buddies == NULL) {
+            return NGX_ERROR;
+        }
+
+        p = peer->buddy.data;
+        last = peer->buddy.data + peer->buddy.len;
+
+        for ( ;; ) {
+            comma = ngx_strlchr(p, last, ',');
+
+            if (comma == NULL) {
+                comma = last;
+            }
+
+            name.data = p;
+            name.len = comma - p;
+
+            found = 0;
+
+            for (j = 0; j < peers->number; j++) {
+                if (j == i
+                    || peers->peer[j].srun_id.len != name.len
+                    || ngx_strncmp(peers->peer[j].srun_id.data, name.data,
+                                   name.len) != 0)
+                {
+                    continue;
+                }
+
+                found = 1;
+
+                for (k = 0; k < peer->nbuddies; k++) {
+                    if (peer->buddies[k] == j) {
+                        break;
+                    }
+                }
+
+                if (k == peer->nbuddies) {
+                    peer->buddies[peer->nbuddies++] = j;
+                }
+            }
+
+            if (!found) {
+                ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                              "no other server with srun_id \"%V\" to be "
+                              "a buddy of \"%V\" in upstream \"%V\"",
+                              &name, &peer->name, peers->name);
+                return NGX_ERROR;
+            }
+
+            if (comma == last) {
+                break;
+            }
+
+            p = comma + 1;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_jvm_route_init_keepalive(ngx_conf_t *cf,
+    ngx_http_upstream_jvm_route_peers_t *peers, ngx_uint_t max_idle)
+{
+    ngx_uint_t                               i, j;
+    ngx_http_upstream_jvm_route_cache_t     *cached;
+    ngx_http_upstream_jvm_route_keepalive_t *keepalive;
+
+    keepalive = ngx_palloc(cf->pool,
+                    peers->number * sizeof(ngx_http_upstream_jvm_route_keepalive_t));
+    if (keepalive == NULL) {
+        return NGX_ERROR;
+    }
+
+    cached = ngx_pcalloc(cf->pool, peers->number * max_idle
+                                   * sizeof(ngx_http_upstream_jvm_route_cache_t));
+    if (cached == NULL) {
+        return NGX_ERROR;
+    }
+
+    for (i = 0; i < peers->number; i++) {
+        ngx_queue_init(&keepalive[i].cache);
+        ngx_queue_init(&keepalive[i].free);
+
+        for (j = 0; j < max_idle; j++) {
+            cached->keepalive = &keepalive[i];
+            ngx_queue_insert_head(&keepalive[i].free, &cached->queue);
+            cached++;
+        }
+
+        peers->peer[i].keepalive = &keepalive[i];
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_jvm_route_init_resolve(ngx_conf_t *cf,
+    ngx_http_upstream_srv_conf_t *us, ngx_http_upstream_jvm_route_peers_t *peers,
+    ngx_http_upstream_jvm_route_srv_conf_t *ujrscf)
+{
+    ngx_uint_t                              i;
+    ngx_http_core_loc_conf_t               *clcf;
+    ngx_http_upstream_jvm_route_peer_t     *peer;
+    ngx_http_upstream_jvm_route_resolve_t  *rs;
+
+    /* the http level, the servers are not merged yet */
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+
+    for (i = 0; i < peers->number; i++) {
+        peer = &peers->peer[i];
+
+        if (peer->host.len == 0) {
+            continue;
+        }
+
+        if (clcf->resolver == NULL) {
+            ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                          "no resolver defined to resolve \"%V\" "
+                          "in upstream \"%V\", put it in the http block",
+                          &peer->host, &us->host);
+            return NGX_ERROR;
+        }
+
+        if (peer->socklen > NGX_SOCKADDRLEN
+            || peer->name.len > NGX_SOCKADDR_STRLEN)
+        {
+            return NGX_ERROR;
+        }
+
+        rs = ngx_pcalloc(cf->pool, sizeof(ngx_http_upstream_jvm_route_resolve_t));
+        if (rs == NULL) {
+            return NGX_ERROR;
+        }
+
+        rs->peers = peers;
+        rs->peer = i;
+        rs->resolver = clcf->resolver;
+        rs->resolver_timeout = (clcf->resolver_timeout == NGX_CONF_UNSET_MSEC)
+                               ? 30000 : clcf->resolver_timeout;
+        rs->interval = ujrscf->resolve_interval ? ujrscf->resolve_interval
+                                                : 30000;
+        rs->port = ngx_inet_get_port(peer->sockaddr);
+
+        /* the address is changed in place, so it is copied out of the url */
+
+        ngx_memcpy(rs->sockaddr, peer->sockaddr, peer->socklen);
+        ngx_memcpy(rs->name, peer->name.data, peer->name.len);
+
+        peer->sockaddr = (struct sockaddr *) rs->sockaddr;
+        peer->name.data = rs->name;
+        peer->resolve = rs;
+    }
+
+    return NGX_OK;
+}
+
+
+/*
+ * A jvm_route_shed in percent is of the capacity of the upstream, the sum
+ * of the max_busy of the servers that are not down.
+ */
+
+static ngx_int_t
+ngx_http_upstream_jvm_route_init_shed(ngx_conf_t *cf,
+    ngx_http_upstream_srv_conf_t *us, ngx_http_upstream_jvm_route_peers_t *peers,
+    ngx_http_upstream_jvm_route_srv_conf_t *ujrscf)
+{
+    ngx_uint_t  i, capacity;
+
+    if (!ujrscf->shed_percent) {
+        peers->shed = ujrscf->shed;
+        return NGX_OK;
+    }
+
+    capacity = 0;
+
+    for (i = 0; i < peers->number; i++) {
+
+        if (peers->peer[i].down) {
+            continue;
+        }
+
+        if (peers->peer[i].max_busy == 0) {
+            ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                          "jvm_route_shed %ui%% of upstream \"%V\" needs "
+                          "max_busy on server \"%V\"", ujrscf->shed,
+                          &us->host, &peers->peer[i].name);
+            return NGX_ERROR;
+        }
+
+        capacity += peers->peer[i].max_busy;
+    }
+
+    peers->shed = ngx_max(capacity * ujrscf->shed / 100, 1);
+
+    return NGX_OK;
+}
+
+
+/*
+ * The zone of an upstream of its own, named after it and the generation;
+ * the prefix keeps the stream upstreams apart from the http ones.
+ */
+
+static ngx_int_t
+ngx_http_upstream_jvm_route_add_shm_zone(ngx_conf_t *cf,
+    ngx_http_upstream_jvm_route_peers_t *peers, char *prefix)
+{
+    u_char                                 *last;
+    ngx_str_t                              *shm_name;
+    ngx_uint_t                              shm_size;
+    ngx_shm_zone_t                         *shm_zone;
+
+    shm_name = &peers->shm_name;
+    shm_name->data = ngx_palloc(cf->pool, SHM_NAME_LEN);
+    if (shm_name->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    /*add the share memory with the generation*/
+    last = ngx_snprintf(shm_name->data, SHM_NAME_LEN, "%s%V_%ui", prefix,
+            peers->name, ngx_http_upstream_jvm_route_generation + 1);
+    shm_name->len = last - shm_name->data;
+
+    shm_size = sizeof(ngx_http_upstream_jvm_route_shm_block_t) +
+            (peers->number - 1) * sizeof(ngx_http_upstream_jvm_route_shared_t);
+    
+    shm_size = ngx_align(shm_size, ngx_pagesize) + 8 * ngx_pagesize;
+
+#if (NGX_HTTP_SSL || NGX_STREAM_SSL)
+    /* a saved session per peer, and a second one while it is replaced */
+    shm_size += 2 * peers->number * NGX_JVM_ROUTE_SSL_SESSION_SIZE;
+#endif
+
+    if (peers->hot_sessions) {
+        shm_size += ngx_align(sizeof(ngx_http_upstream_jvm_route_sessions_t)
+                              + peers->hot_sessions
+                                * sizeof(ngx_http_upstream_jvm_route_hot_session_t),
+                              ngx_pagesize);
+    }
+
+    shm_zone = ngx_shared_memory_add(cf, shm_name, shm_size, 
+            &ngx_http_upstream_jvm_route_module);
+    if (shm_zone == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (shm_zone->data) {
+
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                   "[upstream_jvm_route] shm_zone: \"%V\" is already built.", 
+                   peers->name);
+
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, cf->log, 0,
+            "[upstream_jvm_route] upsteam:%V, shm_zone size:%ui", 
+            peers->name, shm_size);
+
+    shm_zone->data = peers;
+    shm_zone->init = ngx_http_upstream_jvm_route_init_shm_zone;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_init_jvm_route(ngx_conf_t *cf, ngx_http_upstream_srv_conf_t *us)
+{
+    ngx_http_upstream_jvm_route_peers_t    *peers;
+    ngx_http_upstream_jvm_route_srv_conf_t *ujrscf;
+
+    if (ngx_http_upstream_init_jvm_route_rr(cf, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    peers = us->peer.data;
+    if (peers == NULL) {
+        ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                "[upstream_jvm_route] can't find the peers!");
+        return NGX_ERROR;
+    }
+
+    ujrscf = ngx_http_conf_upstream_srv_conf(us,
+                                          ngx_http_upstream_jvm_route_module);
+
+    if (ujrscf->hash
+        && ngx_http_upstream_jvm_route_init_points(cf, peers) != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    if (ngx_http_upstream_jvm_route_init_hot(cf, peers, ujrscf->route_format)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    if (ngx_http_upstream_jvm_route_init_buddies(cf, peers) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    if (ujrscf->max_idle
+        && ngx_http_upstream_jvm_route_init_keepalive(cf, peers, ujrscf->max_idle)
+           != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    if (ngx_http_upstream_jvm_route_init_resolve(cf, us, peers, ujrscf)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    peers->current = peers->number - 1;
+    peers->hot_sessions = ujrscf->hot_sessions;
+    peers->long_lived = (ujrscf->long_lived != NULL);
+    peers->long_max_busy = ujrscf->long_max_busy;
+    peers->hedge_delay = ujrscf->hedge_delay;
+    peers->hedge_percentile = ujrscf->hedge_percentile;
+
+    if (ngx_http_upstream_jvm_route_init_shed(cf, us, peers, ujrscf) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    us->peer.init = ngx_http_upstream_init_jvm_route_peer;
+
+    if (ujrscf->shm_zone) {
+
+        if (ujrscf->shm_zone->shm.size == 0) {
+            ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                          "jvm_route_zone \"%V\" of upstream \"%V\" "
+                          "has no size", &ujrscf->shm_zone->shm.name,
+                          &us->host);
+            return NGX_ERROR;
+        }
+
+        peers->shm_name = ujrscf->shm_zone->shm.name;
+
+        return NGX_OK;
+    }
+
+    return ngx_http_upstream_jvm_route_add_shm_zone(cf, peers, "");
+}
+
+
+static ngx_int_t
+ngx_http_upstream_jvm_route_get_uri_session(ngx_http_request_t *r,
+    ngx_str_t *name, ngx_str_t *val)
+{
+    ngx_str_t *uri;
+    ngx_int_t  i; 
+    size_t     offset;
+    u_char    *start;
+
+    uri = &r->unparsed_uri;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+            "[upstream jvm_route] URI: \"%V\", session_name: \"%V\"", uri, name);
+
+    start = ngx_strncasestrn(uri->data, name->data, uri->len, name->len);
+    if (start != NULL) {
+        start = start + name->len;
+        while (*start != '=') {
+            if (start >= (uri->data + uri->len)) {
+                ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                        "upstream_jvm_route find the session in URI error!");
+                return NGX_ERROR;
+            }
+            start++;
+        }
+
+        start++;
+        offset = start - uri->data;
+        if (offset < uri->len) {
+            val->data = start;
+
+            i = ngx_strntok(start, "?&;", uri->len - offset, sizeof("?&;")-1);
+            if (i > 0) {
+                val->len = i;
+            }
+            else {
+                val->len = uri->len - offset;
+            }
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_jvm_route_get_session_value(ngx_http_request_t *r,
+    ngx_http_upstream_jvm_route_srv_conf_t *us, ngx_str_t *val)
+{
+    ngx_uint_t                             i;
+    ngx_http_variable_value_t             *vv;
+    ngx_http_upstream_jvm_route_source_t  *src;
+
+    val->len = 0;
+
+    src = us->sources->elts;
+
+    for (i = 0; i < us->sources->nelts; i++) {
+
+        vv = ngx_http_get_indexed_variable(r, src[i].index);
+
+        if (vv != NULL && !vv->not_found && vv->len != 0) {
+            val->data = vv->data;
+            val->len = vv->len;
+
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                    "[upstream_jvm_route] session from source %ui", i);
+
+            return NGX_OK;
+        }
+
+        /* session in url, only for the cookie sources */
+        if (src[i].name.len != 0) {
+
+            if (ngx_http_upstream_jvm_route_get_uri_session(r, &src[i].name, val)
+                != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+
+            if (val->len != 0) {
+                return NGX_OK;
+            }
+        }
+    }
+
+    ngx_log_error(NGX_LOG_WARN, r->connection->log, 0,
+            "[upstream_jvm_route] can't find the session in any source!");
+
+    return NGX_OK;
+}
+
+
+/*
+ * Cuts the route out of the session value in one pass.  The old prefix and
+ * reverse formats keep the whole value and compare it with each srun_id.
+ */
+static void
+ngx_http_upstream_jvm_route_get_route(ngx_http_upstream_jvm_route_srv_conf_t *us,
+    ngx_str_t *val, ngx_str_t *route)
+{
+    u_char  *p, *last;
+
+    route->data = val->data;
+    route->len = 0;
+
+    if (val->len == 0) {
+        return;
+    }
+
+    last = val->data + val->len;
+
+    switch (us->route_format) {
+
+    case NGX_JVM_ROUTE_SUFFIX_AFTER:
+    case NGX_JVM_ROUTE_JETTY:
+
+        for (p = last - 1; p >= val->data; p--) {
+            if (*p == us->route_delimiter) {
+                break;
+            }
+        }
+
+        if (p < val->data) {
+            return;
+        }
+
+        p++;
+
+        if (us->route_format == NGX_JVM_ROUTE_JETTY
+            && (last - p <= 4 || ngx_strncmp(p, "node", 4) != 0))
+        {
+            return;
+        }
+
+        route->data = p;
+        route->len = last - p;
+
+        return;
+
+    case NGX_JVM_ROUTE_PREFIX_BEFORE:
+
+        p = ngx_strlchr(val->data, last, us->route_delimiter);
+        if (p == NULL) {
+            return;
+        }
+
+        route->len = p - val->data;
+
+        return;
+
+    case NGX_JVM_ROUTE_PREFIX_LEN:
+
+        if (val->len < us->route_len) {
+            return;
+        }
+
+        route->len = us->route_len;
+
+        return;
+
+    default: /* NGX_JVM_ROUTE_PREFIX, NGX_JVM_ROUTE_REVERSE */
+
+        *route = *val;
+
+        return;
+    }
+}
+
+
+static ngx_int_t
+ngx_http_upstream_init_jvm_route_peer(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *us)
+{
+    ngx_str_t                                 val, lived;
+    ngx_uint_t                                nelts, nreq;
+    ngx_atomic_t                             *lock;
+    ngx_http_upstream_jvm_route_peer_data_t  *jrp;
+    ngx_http_upstream_jvm_route_peers_t      *jrps;
+    ngx_http_upstream_jvm_route_srv_conf_t   *ujrscf;
+
+    ujrscf = ngx_http_conf_upstream_srv_conf(us, ngx_http_upstream_jvm_route_module);
+
+    jrps = us->peer.data;
+
+    if (jrps == NULL || jrps->shared == NULL) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                "[upstream_jvm_route] peers or shm_zone data is NULL!");
+
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                "[upstream_jvm_route] jrps:%p, shared:%p", jrps, jrps->shared);
+
+    jrp = r->upstream->peer.data;
+
+    nelts = ngx_bitvector_nelts(jrps->number);
+
+    if (jrp == NULL || jrp->peers != jrps) {
+        jrp = ngx_pcalloc(r->pool, sizeof(ngx_http_upstream_jvm_route_peer_data_t)
+                                   + (nelts - 1) * sizeof(uintptr_t));
+        if (jrp == NULL) {
+            return NGX_ERROR;
+        }
+
+        r->upstream->peer.data = jrp;
+
+    } else {
+        /* the request is sent again to the same upstream: start afresh */
+
+        ngx_memzero(jrp->data, nelts * sizeof(uintptr_t));
+
+        jrp->budgeted = 0;
+        jrp->start = 0;
+    }
+
+    jrp->tried = jrp->data;
+
+    if (ngx_http_upstream_jvm_route_get_session_value(r, ujrscf, &val) != NGX_OK) {
+        return NGX_ERROR;
+    } 
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+            "[upstream_jvm_route] session_value:\"%V\"", &val);
+
+    jrp->group.len = 0;
+
+    if (ujrscf->local_group
+        && ngx_http_complex_value(r, ujrscf->local_group, &jrp->group) != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    jrp->long_lived = 0;
+
+    if (ujrscf->long_lived) {
+        if (ngx_http_complex_value(r, ujrscf->long_lived, &lived) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        if (lived.len && !(lived.len == 1 && lived.data[0] == '0')) {
+            jrp->long_lived = 1;
+        }
+    }
+
+    jrp->cookie = val;
+    ngx_http_upstream_jvm_route_get_route(ujrscf, &val, &jrp->route);
+
+    /*
+     * Only a GET or HEAD without a session may go to a second peer early,
+     * and only if a timeout is passed to the next peer at all.
+     */
+
+    jrp->hedge = (jrps->hedge_delay && jrp->route.len == 0 && !jrp->long_lived
+                  && (r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD))
+                  && (r->upstream->conf->next_upstream
+                      & NGX_HTTP_UPSTREAM_FT_TIMEOUT));
+    jrp->hedge_given = 0;
+    jrp->hedge_timer = 0;
+    r->upstream->response_timeout = 0;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+            "[upstream_jvm_route] route:\"%V\"", &jrp->route);
+
+    jrp->session = 0;
+    jrp->counted = 0;
+
+    if (jrps->hot_sessions && jrp->route.len > 0) {
+        jrp->session_hash = ngx_murmur_hash2(jrp->cookie.data, jrp->cookie.len);
+        jrp->session = 1;
+    }
+
+    jrp->hashed = 0;
+
+    if (jrp->route.len == 0 && jrps->points) {
+
+        if (ujrscf->hash_key == NULL) {
+            val = r->connection->addr_text;
+
+        } else if (ngx_http_complex_value(r, ujrscf->hash_key, &val) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        jrp->hash = ngx_murmur_hash2(val.data, val.len);
+        jrp->hashed = 1;
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                "[upstream_jvm_route] hash key:\"%V\", hash:%uD", &val, jrp->hash);
+    }
+
+    jrp->current = jrps->current;
+    jrp->peers = jrps;
+    jrp->upstream = r->upstream;
+    jrp->conf = ujrscf;
+
+    lock = &jrps->shared->lock;
+    ngx_spinlock(lock, ngx_pid, 1024);
+
+    /* at the load of jvm_route_shed only the sessions of a peer get one */
+
+    if (jrps->shed
+        && jrps->shared->total_nreq >= jrps->shed
+        && (jrp->route.len == 0
+            || ngx_http_upstream_jvm_route_find_route(jrp) == NGX_PEER_INVALID))
+    {
+        jrps->shared->total_shed++;
+        nreq = jrps->shared->total_nreq;
+
+        ngx_spinlock_unlock(lock);
+
+        ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+                "[upstream_jvm_route] upstream \"%V\" has %ui busy requests, "
+                "a request without a session is refused",
+                jrps->name, nreq);
+
+        return ujrscf->shed_status;
+    }
+
+    /* a session over its limits is not sent to any peer */
+
+    if (jrp->session
+        && jrps == jrps->shared->peers
+        && jrps->shared->generation == ngx_http_upstream_jvm_route_generation
+        && ngx_http_upstream_jvm_route_session_limit(jrp) != NGX_OK)
+    {
+        ngx_spinlock_unlock(lock);
+
+        ngx_log_error(NGX_LOG_WARN, r->connection->log, 0,
+                "[upstream_jvm_route] session %08xD of upstream \"%V\" "
+                "is over its limit", jrp->session_hash, jrps->name);
+
+        return ujrscf->session_status;
+    }
+
+    jrps->shared->total_requests++;
+
+    ngx_spinlock_unlock(lock);
+
+    r->upstream->peer.get = ngx_http_upstream_get_jvm_route_peer;
+    r->upstream->peer.free = ngx_http_upstream_free_jvm_route_peer;
+    r->upstream->peer.tries = jrps->number;
+
+    if (ujrscf->tries && ujrscf->tries < jrps->number) {
+        r->upstream->peer.tries = ujrscf->tries;
+    }
+
+#if (NGX_HTTP_SSL)
+    r->upstream->peer.set_session =
+                               ngx_http_upstream_jvm_route_set_session;
+    r->upstream->peer.save_session =
+                               ngx_http_upstream_jvm_route_save_session;
+#endif
+
+    return NGX_OK;
+}
+
+
+/*
+ * The bucket holds at most a second of max_rps.  Workers refill it with
+ * their own cached time, which may lag behind the last refill a little.
+ */
+
+static ngx_int_t
+ngx_http_upstream_jvm_route_rps_refill(ngx_http_upstream_jvm_route_peer_t *peer)
+{
+    ngx_msec_int_t                           elapsed;
+    ngx_http_upstream_jvm_route_shared_t    *sh;
+
+    sh = peer->shared;
+
+    elapsed = (ngx_msec_int_t) (ngx_current_msec - sh->rps_refilled);
+
+    if (elapsed > 0) {
+        sh->rps_refilled = ngx_current_msec;
+
+        if (elapsed > 1000) {
+            elapsed = 1000;
+        }
+
+        sh->rps_tokens += elapsed * peer->max_rps;
+
+        if (sh->rps_tokens > (ngx_int_t) peer->max_rps * 1000) {
+            sh->rps_tokens = peer->max_rps * 1000;
+        }
+    }
+
+    return sh->rps_tokens >= 1000 ? NGX_OK : NGX_BUSY;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_jvm_route_try_peer( ngx_http_upstream_jvm_route_peer_data_t *jrp,
+    ngx_uint_t peer_id, ngx_uint_t sticky)
+{
+    ngx_http_upstream_jvm_route_hot_t         *hot;
+    ngx_http_upstream_jvm_route_shared_t      *sh;
+
+    if (ngx_bitvector_test(jrp->tried, peer_id)) {
+        return NGX_BUSY;
+    }
+
+    hot = &jrp->peers->hot[peer_id];
+    sh = &jrp->peers->shared->stats[peer_id];
+
+    if (jrp->long_lived) {
+        if (jrp->peers->long_max_busy
+            && sh->long_nreq >= jrp->peers->long_max_busy)
+        {
+            return NGX_BUSY;
+        }
+
+    } else if (hot->max_busy != 0 && sh->nreq >= hot->max_busy) {
+        return NGX_BUSY;
+    }
+
+    if (hot->max_rps
+        && ngx_http_upstream_jvm_route_rps_refill(&jrp->peers->peer[peer_id])
+           != NGX_OK
+        && !(sticky && jrp->conf->rps_keep))
+    {
+        return NGX_BUSY;
+    }
+
+    if (!hot->down) {
+        if (hot->max_fails == 0 || sh->fails < hot->max_fails) {
+            return NGX_OK;
+        }
+
+        if (ngx_time() - sh->accessed > jrp->peers->peer[peer_id].fail_timeout) {
+            sh->fails = 0;
+            return NGX_OK;
+        }
+    }
+
+    return NGX_BUSY;
+}
+
+
+/*
+ * The untried peers in ring order from jrp->current: the first one after n,
+ * or after none if n is NGX_PEER_INVALID.  NGX_PEER_INVALID ends the ring.
+ */
+
+static ngx_uint_t
+ngx_http_upstream_jvm_route_next_untried(
+    ngx_http_upstream_jvm_route_peer_data_t *jrp, ngx_uint_t n)
+{
+    ngx_uint_t  m, from, start, npeers;
+
+    start = jrp->current;
+    npeers = jrp->peers->number;
+
+    if (n == NGX_PEER_INVALID || n >= start) {
+        from = (n == NGX_PEER_INVALID) ? start : n + 1;
+
+        m = ngx_bitvector_next_zero(jrp->tried, from, npeers);
+        if (m < npeers) {
+            return m;
+        }
+
+        from = 0;
+
+    } else {
+        from = n + 1;
+    }
+
+    m = ngx_bitvector_next_zero(jrp->tried, from, start);
+
+    return (m < start) ? m : NGX_PEER_INVALID;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_jvm_route_cmp_route(ngx_http_upstream_jvm_route_peer_data_t *jrp,
+    ngx_http_upstream_jvm_route_peer_t *peer)
+{
+    switch (jrp->conf->route_format) {
+
+    case NGX_JVM_ROUTE_PREFIX:
+        return ngx_strncmp(jrp->route.data, peer->srun_id.data,
+                           peer->srun_id.len);
+
+    case NGX_JVM_ROUTE_REVERSE:
+        return ngx_strncmp_r(jrp->route.data, peer->srun_id.data,
+                             jrp->route.len, peer->srun_id.len);
+
+    default:
+        if (jrp->route.len != peer->srun_id.len) {
+            return -1;
+        }
+
+        return ngx_strncmp(jrp->route.data, peer->srun_id.data,
+                           peer->srun_id.len);
+    }
+}
+
+
+/*
+ * Rules a peer out by the bytes of its srun_id in the hot table, without
+ * reading the peer: 0 means that cmp_route() has to tell.
+ */
+
+static ngx_inline ngx_int_t
+ngx_http_upstream_jvm_route_cmp_key(ngx_http_upstream_jvm_route_peer_data_t *jrp,
+    ngx_http_upstream_jvm_route_hot_t *hot)
+{
+    size_t  k;
+
+    k = ngx_min(hot->srun_id_len, NGX_JVM_ROUTE_KEY_LEN);
+
+    switch (jrp->conf->route_format) {
+
+    case NGX_JVM_ROUTE_PREFIX:
+        if (jrp->route.len < k) {
+            return 0;
+        }
+
+        return ngx_memcmp(jrp->route.data, hot->key, k);
+
+    case NGX_JVM_ROUTE_REVERSE:
+        if (jrp->route.len < k) {
+            return 0;
+        }
+
+        return ngx_memcmp(jrp->route.data + jrp->route.len - k, hot->key, k);
+
+    default:
+        if (jrp->route.len != hot->srun_id_len) {
+            return -1;
+        }
+
+        return ngx_memcmp(jrp->route.data, hot->key, k);
+    }
+}
+
+
+static ngx_int_t
+ngx_http_upstream_choose_by_jvm_route(ngx_http_upstream_jvm_route_peer_data_t *jrp)
+{
+    ngx_uint_t                          n;
+    ngx_http_upstream_jvm_route_hot_t  *hot;
+    ngx_http_upstream_jvm_route_peer_t *peer;
+
+    hot = jrp->peers->hot;
+
+    for (n = ngx_http_upstream_jvm_route_next_untried(jrp, NGX_PEER_INVALID);
+         n != NGX_PEER_INVALID;
+         n = ngx_http_upstream_jvm_route_next_untried(jrp, n))
+    {
+        if (ngx_http_upstream_jvm_route_cmp_key(jrp, &hot[n]) != 0) {
+            continue;
+        }
+
+        peer = &jrp->peers->peer[n];
+
+        if (ngx_http_upstream_jvm_route_cmp_route(jrp, peer) == 0) {
+            if (ngx_http_upstream_jvm_route_try_peer(jrp, n, 1) == NGX_OK) {
+                return n;
+            }
+        }
+    }
+
+    return NGX_PEER_INVALID;
+}
+
+
+/*
+ * The session has no peer to go to: the buddies of the peer that it names
+ * have a copy of it.
+ */
+
+static ngx_int_t
+ngx_http_upstream_choose_by_buddy(ngx_http_upstream_jvm_route_peer_data_t *jrp)
+{
+    ngx_uint_t                          i, n;
+    ngx_http_upstream_jvm_route_peer_t *owner;
+
+    n = ngx_http_upstream_jvm_route_find_route(jrp);
+
+    if (n == NGX_PEER_INVALID || jrp->peers->peer[n].nbuddies == 0) {
+        return NGX_PEER_INVALID;
+    }
+
+    owner = &jrp->peers->peer[n];
+
+    for (i = 0; i < owner->nbuddies; i++) {
+        n = owner->buddies[i];
+
+        if (ngx_http_upstream_jvm_route_try_peer(jrp, n, 1) == NGX_OK) {
+            return n;
+        }
+    }
+
+    return NGX_PEER_INVALID;
+}
+
+
+/* the peer that the route names, whatever its state */
+
+static ngx_uint_t
+ngx_http_upstream_jvm_route_find_route(ngx_http_upstream_jvm_route_peer_data_t *jrp)
+{
+    ngx_uint_t                          n;
+    ngx_http_upstream_jvm_route_hot_t  *hot;
+
+    hot = jrp->peers->hot;
+
+    for (n = 0; n < jrp->peers->number; n++) {
+        if (ngx_http_upstream_jvm_route_cmp_key(jrp, &hot[n]) == 0
+            && ngx_http_upstream_jvm_route_cmp_route(jrp, &jrp->peers->peer[n])
+               == 0)
+        {
+            return n;
+        }
+    }
+
+    return NGX_PEER_INVALID;
+}
+
+
+/* with a group, the points of its peers only are walked, from the same one */
+static ngx_int_t
+ngx_http_upstream_choose_by_hash(ngx_http_upstream_jvm_route_peer_data_t *jrp,
+    ngx_uint_t gid)
+{
+    ngx_uint_t                             i, n, lo, hi, mid, tries;
+    ngx_http_upstream_jvm_route_hot_t     *hot;
+    ngx_http_upstream_jvm_route_points_t  *points;
+
+    points = jrp->peers->points;
+    hot = jrp->peers->hot;
+
+    /* the first point clockwise from the hash */
+
+    lo = 0;
+    hi = points->number;
+
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+
+        if (points->point[mid].hash < jrp->hash) {
+            lo = mid + 1;
+
+        } else {
+            hi = mid;
+        }
+    }
+
+    tries = 0;
+
+    for (i = 0; tries < NGX_JVM_ROUTE_HASH_TRIES && i < points->number; i++) {
+        n = points->point[(lo + i) % points->number].peer;
+
+        if (gid && hot[n].group != gid) {
+            continue;
+        }
+
+        if (ngx_http_upstream_jvm_route_try_peer(jrp, n, 0) == NGX_OK) {
+            return n;
+        }
+
+        tries++;
+    }
+
+    return NGX_PEER_INVALID;
+}
+
+
+static ngx_inline ngx_int_t
+ngx_http_upstream_jvm_route_in_group(ngx_http_upstream_jvm_route_peer_t *peer,
+    ngx_str_t *group)
+{
+    return group == NULL
+           || (peer->group.len == group->len
+               && ngx_strncmp(peer->group.data, group->data, group->len) == 0);
+}
+
+
+/* the loops compare the number of the group, 0 if no peer is in it */
+static ngx_uint_t
+ngx_http_upstream_jvm_route_group_id(
+    ngx_http_upstream_jvm_route_peer_data_t *jrp, ngx_str_t *group)
+{
+    ngx_uint_t                            i;
+    ngx_http_upstream_jvm_route_hot_t    *hot;
+    ngx_http_upstream_jvm_route_peer_t   *peer;
+
+    hot = jrp->peers->hot;
+    peer = jrp->peers->peer;
+
+    for (i = 0; i < jrp->peers->number; i++) {
+        if (hot[i].group
+            && ngx_http_upstream_jvm_route_in_group(&peer[i], group))
+        {
+            return hot[i].group;
+        }
+    }
+
+    return 0;
+}
+
+
+/* with a group, only its peers are tried and their weights reset */
+static ngx_int_t
+ngx_http_upstream_choose_by_rr(ngx_http_upstream_jvm_route_peer_data_t *jrp,
+    ngx_uint_t gid)
+{
+    ngx_uint_t                            i, n, all_busy = 0;
+    ngx_uint_t                            npeers = jrp->peers->number;
+    ngx_http_upstream_jvm_route_hot_t    *hot;
+    ngx_http_upstream_jvm_route_peer_t   *peer;
+    ngx_http_upstream_jvm_route_shared_t *stats;
+
+    peer = jrp->peers->peer;
+    hot = jrp->peers->hot;
+    stats = jrp->peers->shared->stats;
+
+    while (1) {
+        for (n = ngx_http_upstream_jvm_route_next_untried(jrp, NGX_PEER_INVALID);
+             n != NGX_PEER_INVALID;
+             n = ngx_http_upstream_jvm_route_next_untried(jrp, n))
+        {
+
+            if (stats[n].current_weight <= 0) {
+                continue;
+            }
+
+            if (gid && hot[n].group != gid) {
+                continue;
+            }
+
+            if (ngx_http_upstream_jvm_route_try_peer(jrp, n, 0) == NGX_OK) {
+                return n;
+            }
+        }
+
+        if (all_busy) {
+            return NGX_PEER_INVALID;
+        }
+
+        for (i = 0; i < npeers; i++) {
+            if (gid == 0 || hot[i].group == gid) {
+                stats[i].current_weight = peer[i].weight;
+            }
+
+            all_busy = 1;
+        }
+    }
+
+    return NGX_PEER_INVALID;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_jvm_route_choose_peer(ngx_peer_connection_t *pc, 
+        ngx_http_upstream_jvm_route_peer_data_t *jrp)
+{
+    ngx_uint_t                          n, gid;
+    ngx_uint_t                          npeers = jrp->peers->number;
+    ngx_http_upstream_jvm_route_peer_t *peer;
+
+    if (npeers == 1) {
+        n = 0;
+        goto chosen;
+    }
+
+    if (jrp->route.len > 0) {
+        n = ngx_http_upstream_choose_by_jvm_route(jrp);
+        if (n != NGX_PEER_INVALID) {
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 
+                    0, "[upstream_jvm_route] choose peer %i by jvm_route", n);
+            goto chosen;
+        }
+
+        n = ngx_http_upstream_choose_by_buddy(jrp);
+        if (n != NGX_PEER_INVALID) {
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 
+                    0, "[upstream_jvm_route] choose peer %i by buddy", n);
+            goto chosen;
+        }
+    }
+
+    gid = 0;
+
+    if (jrp->group.len > 0) {
+        gid = ngx_http_upstream_jvm_route_group_id(jrp, &jrp->group);
+    }
+
+    if (jrp->hashed && gid) {
+        n = ngx_http_upstream_choose_by_hash(jrp, gid);
+        if (n != NGX_PEER_INVALID) {
+            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                    "[upstream_jvm_route] choose peer %i by hash "
+                    "in group \"%V\"", n, &jrp->group);
+            goto chosen;
+        }
+    }
+
+    if (jrp->hashed) {
+        n = ngx_http_upstream_choose_by_hash(jrp, 0);
+        if (n != NGX_PEER_INVALID) {
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 
+                    0, "[upstream_jvm_route] choose peer %i by hash", n);
+            goto chosen;
+        }
+    }
+
+    if (gid) {
+        n = ngx_http_upstream_choose_by_rr(jrp, gid);
+        if (n != NGX_PEER_INVALID) {
+            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                    "[upstream_jvm_route] choose peer %i by rr in group \"%V\"",
+                    n, &jrp->group);
+            goto chosen;
+        }
+    }
+
+    n = ngx_http_upstream_choose_by_rr(jrp, 0);
+    if (n != NGX_PEER_INVALID) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 
+                0, "[upstream_jvm_route] choose peer %i by rr", n);
+        goto chosen;
+    }
+
+    return NGX_BUSY;
+
+chosen:
+    ngx_bitvector_set(jrp->tried, n);
+
+    peer = &jrp->peers->peer[n];
+    if (peer->shared->current_weight > 0) {
+        peer->shared->current_weight--;
+    }
+
+    if (peer->max_rps) {
+        peer->shared->rps_tokens -= 1000;
+
+        if (peer->shared->rps_tokens < 0) {
+            peer->shared->rps_tokens = 0;
+        }
+    }
+
+    jrp->index = n;
+
+    return NGX_OK;
+}
+
+
+/*
+ * Adds delta to the counters of the session in every row of the sketch,
+ * and returns the smallest of them: the count of the session, or more if
+ * all its counters are shared with other sessions.  A delta of 0 reads it.
+ */
+
+static ngx_uint_t
+ngx_http_upstream_jvm_route_sketch_add(
+    uint32_t sketch[][NGX_JVM_ROUTE_SKETCH_WIDTH], uint32_t hash, ngx_int_t delta)
+{
+    uint32_t    *c, step, min;
+    ngx_uint_t   i;
+
+    step = (hash >> 16) | 1;
+    min = (uint32_t) -1;
+
+    for (i = 0; i < NGX_JVM_ROUTE_SKETCH_DEPTH; i++) {
+        c = &sketch[i][(hash + i * step) & (NGX_JVM_ROUTE_SKETCH_WIDTH - 1)];
+
+        if (delta >= 0 || *c >= (uint32_t) -delta) {
+            *c += delta;
+
+        } else {
+            *c = 0;
+        }
+
+        if (*c < min) {
+            min = *c;
+        }
+    }
+
+    return min;
+}
+
+
+/* a new second: the rates of the top are halved for each second gone */
+
+static void
+ngx_http_upstream_jvm_route_sessions_roll(
+    ngx_http_upstream_jvm_route_sessions_t *sessions)
+{
+    time_t      now, gone;
+    ngx_uint_t  i;
+
+    now = ngx_time();
+
+    if (sessions->second == now) {
+        return;
+    }
+
+    gone = now - sessions->second;
+
+    for (i = 0; i < sessions->number; i++) {
+        sessions->top[i].rps = (gone < 8) ? sessions->top[i].rps >> gone : 0;
+    }
+
+    ngx_memzero(sessions->rps, sizeof(sessions->rps));
+    sessions->second = now;
+}
+
+
+static void
+ngx_http_upstream_jvm_route_sessions_sift(
+    ngx_http_upstream_jvm_route_sessions_t *sessions, ngx_uint_t i)
+{
+    ngx_uint_t                                  child;
+    ngx_http_upstream_jvm_route_hot_session_t   tmp, *top;
+
+    top = sessions->top;
+
+    while (i > 0 && top[(i - 1) / 2].rps > top[i].rps) {
+        tmp = top[i];
+        top[i] = top[(i - 1) / 2];
+        top[(i - 1) / 2] = tmp;
+        i = (i - 1) / 2;
+    }
+
+    for ( ;; ) {
+        child = 2 * i + 1;
+
+        if (child >= sessions->number) {
+            return;
+        }
+
+        if (child + 1 < sessions->number && top[child + 1].rps < top[child].rps) {
+            child++;
+        }
+
+        if (top[i].rps <= top[child].rps) {
+            return;
+        }
+
+        tmp = top[i];
+        top[i] = top[child];
+        top[child] = tmp;
+        i = child;
+    }
+}
+
+
+static ngx_http_upstream_jvm_route_hot_session_t *
+ngx_http_upstream_jvm_route_sessions_find(
+    ngx_http_upstream_jvm_route_sessions_t *sessions, uint32_t hash)
+{
+    ngx_uint_t  i;
+
+    for (i = 0; i < sessions->number; i++) {
+        if (sessions->top[i].hash == hash) {
+            return &sessions->top[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+/*
+ * Called under the lock from init_peer, before a session is sent to a peer:
+ * NGX_BUSY if it is over jvm_route_hot_sessions max_rps or max_busy.
+ */
+
+static ngx_int_t
+ngx_http_upstream_jvm_route_session_limit(
+    ngx_http_upstream_jvm_route_peer_data_t *jrp)
+{
+    uint32_t                                    hash;
+    ngx_uint_t                                  rps, busy;
+    ngx_http_upstream_jvm_route_sessions_t     *sessions;
+    ngx_http_upstream_jvm_route_hot_session_t  *hs;
+
+    sessions = jrp->peers->shared->sessions;
+    hash = jrp->session_hash;
+
+    ngx_http_upstream_jvm_route_sessions_roll(sessions);
+
+    rps = ngx_http_upstream_jvm_route_sketch_add(sessions->rps, hash, 0);
+    busy = ngx_http_upstream_jvm_route_sketch_add(sessions->busy, hash, 0);
+
+    if ((jrp->conf->session_max_rps && rps >= jrp->conf->session_max_rps)
+        || (jrp->conf->session_max_busy && busy >= jrp->conf->session_max_busy))
+    {
+        hs = ngx_http_upstream_jvm_route_sessions_find(sessions, hash);
+        if (hs) {
+            hs->limited++;
+        }
+
+        return NGX_BUSY;
+    }
+
+    return NGX_OK;
+}
+
+
+/* a session is sent to peer jrp->index: count it and keep the top */
+
+static void
+ngx_http_upstream_jvm_route_session_count(
+    ngx_http_upstream_jvm_route_peer_data_t *jrp)
+{
+    uint32_t                                    hash;
+    ngx_uint_t                                  rps;
+    ngx_http_upstream_jvm_route_sessions_t     *sessions;
+    ngx_http_upstream_jvm_route_hot_session_t  *hs;
+
+    sessions = jrp->peers->shared->sessions;
+    hash = jrp->session_hash;
+
+    rps = ngx_http_upstream_jvm_route_sketch_add(sessions->rps, hash, 1);
+
+    hs = ngx_http_upstream_jvm_route_sessions_find(sessions, hash);
+
+    if (hs) {
+        hs->peer = jrp->index;
+
+        if (rps > hs->rps) {
+            hs->rps = rps;
+            ngx_http_upstream_jvm_route_sessions_sift(sessions,
+                                                      hs - sessions->top);
+        }
+
+        return;
+    }
+
+    if (sessions->number < sessions->size) {
+        hs = &sessions->top[sessions->number++];
+
+    } else if (rps > sessions->top[0].rps) {
+        hs = &sessions->top[0];
+
+    } else {
+        return;
+    }
+
+    hs->hash = hash;
+    hs->len = ngx_min(jrp->cookie.len, NGX_JVM_ROUTE_SESSION_SHOWN);
+    ngx_memcpy(hs->session, jrp->cookie.data, hs->len);
+    hs->peer = jrp->index;
+    hs->rps = rps;
+    hs->limited = 0;
+
+    ngx_http_upstream_jvm_route_sessions_sift(sessions, hs - sessions->top);
+}
+
+
+static void
+ngx_http_upstream_jvm_route_update_nreq(ngx_http_upstream_jvm_route_peer_data_t *jrp, 
+        int delta, ngx_log_t *log)
+{
+    /* "kill -HUP" will generate a new peers */
+    if (jrp->peers == jrp->peers->shared->peers && 
+            jrp->peers->shared->generation == ngx_http_upstream_jvm_route_generation) {
+
+        /* a long-lived request does not hold a thread of the JVM */
+
+        if (jrp->long_lived) {
+            jrp->peers->peer[jrp->current].shared->long_nreq += delta;
+
+        } else {
+            jrp->peers->peer[jrp->current].shared->nreq += delta;
+            jrp->peers->shared->total_nreq += delta;
+        }
+
+        if (jrp->session) {
+            ngx_http_upstream_jvm_route_sketch_add(
+                            jrp->peers->shared->sessions->busy,
+                            jrp->session_hash, delta);
+        }
+
+#if NGX_DEBUG
+        ngx_uint_t                          nreq;
+        ngx_uint_t                          total_nreq;
+
+        nreq = jrp->peers->peer[jrp->current].shared->nreq;
+        total_nreq = jrp->peers->shared->total_nreq;
+
+        ngx_log_debug6(NGX_LOG_DEBUG_HTTP, log, 0,
+                "[upstream_jvm_route] nreq for peer %ui @ %p/%p now %d, total %d, delta %d",
+                jrp->current, jrp->peers, jrp->peers->peer[jrp->current].shared, nreq,
+                total_nreq, delta);
+#endif
+    }
+}
+
+
+/*
+ * The bucket of the current second in the ring of a peer, emptied when the
+ * ring comes round to it.  Called under the lock of the block.
+ */
+
+static ngx_http_upstream_jvm_route_second_t *
+ngx_http_upstream_jvm_route_second(ngx_http_upstream_jvm_route_shared_t *sh)
+{
+    uint32_t                               now;
+    ngx_http_upstream_jvm_route_second_t  *second;
+
+    now = (uint32_t) ngx_time();
+    second = &sh->seconds[now & (NGX_JVM_ROUTE_SECONDS - 1)];
+
+    if (second->second != now) {
+        ngx_memzero(second, sizeof(ngx_http_upstream_jvm_route_second_t));
+        second->second = now;
+    }
+
+    return second;
+}
+
+
+/*
+ * The response times of the requests that may be hedged are counted in
+ * buckets of a quarter of a power of two of milliseconds: one millisecond
+ * each up to 7ms, then 8-9, 10-11, 12-13, 14-15, 16-19 and so on.
+ */
+
+static ngx_uint_t
+ngx_http_upstream_jvm_route_hedge_bucket(ngx_msec_t ms)
+{
+    ngx_uint_t  e;
+
+    if (ms < 4) {
+        return ms;
+    }
+
+    if (ms >= (ngx_msec_t) 1 << 17) {
+        return NGX_JVM_ROUTE_HEDGE_BUCKETS - 1;
+    }
+
+    for (e = 2; ms >> (e + 1); e++) { /* void */ }
+
+    return 4 * (e - 1) + ((ms >> (e - 2)) & 3);
+}
+
+
+/* the first time past a bucket */
+
+static ngx_msec_t
+ngx_http_upstream_jvm_route_hedge_bound(ngx_uint_t bucket)
+{
+    ngx_uint_t  e;
+
+    if (bucket < 4) {
+        return bucket + 1;
+    }
+
+    e = bucket / 4 - 1;
+
+    return (ngx_msec_t) (4 + bucket % 4 + 1) << e;
+}
+
+
+/*
+ * Once a second the delay follows the percentile of the response times,
+ * with at most the configured delay, and the older times count half.
+ * Called under the lock of the block.
+ */
+
+static void
+ngx_http_upstream_jvm_route_hedge_update(
+    ngx_http_upstream_jvm_route_peers_t *peers)
+{
+    ngx_msec_t                                delay;
+    ngx_uint_t                                i, rank, sum;
+    ngx_http_upstream_jvm_route_shm_block_t  *shm_block;
+
+    shm_block = peers->shared;
+
+    if (shm_block->hedge_second == ngx_time()) {
+        return;
+    }
+
+    shm_block->hedge_second = ngx_time();
+    shm_block->hedge_delay = peers->hedge_delay;
+
+    if (shm_block->hedge_samples >= NGX_JVM_ROUTE_HEDGE_SAMPLES) {
+        rank = shm_block->hedge_samples * peers->hedge_percentile / 1000;
+        sum = 0;
+
+        for (i = 0; i < NGX_JVM_ROUTE_HEDGE_BUCKETS - 1; i++) {
+            sum += shm_block->hedge_times[i];
+
+            if (sum > rank) {
+                break;
+            }
+        }
+
+        delay = ngx_http_upstream_jvm_route_hedge_bound(i);
+
+        if (delay < shm_block->hedge_delay) {
+            shm_block->hedge_delay = delay;
+        }
+    }
+
+    shm_block->hedge_samples = 0;
+
+    for (i = 0; i < NGX_JVM_ROUTE_HEDGE_BUCKETS; i++) {
+        shm_block->hedge_times[i] /= 2;
+        shm_block->hedge_samples += shm_block->hedge_times[i];
+    }
+}
+
+
+/*
+ * The budget holds up to hedge_budget percent of the requests that may be
+ * hedged in the last second, and at least the reserve: an armed delay takes
+ * a hedge out of it, so the delays armed at once follow the request rate
+ * while the hedges that fire stay within the budget.
+ */
+
+static void
+ngx_http_upstream_jvm_route_hedge_count(
+    ngx_http_upstream_jvm_route_shm_block_t *shm_block, ngx_uint_t budget)
+{
+    time_t      now;
+    ngx_uint_t  n;
+
+    now = ngx_time();
+
+    if (shm_block->hedge_now != now) {
+        shm_block->hedge_requests[1] = (shm_block->hedge_now == now - 1)
+                                       ? shm_block->hedge_requests[0] : 0;
+        shm_block->hedge_requests[0] = 0;
+        shm_block->hedge_now = now;
+    }
+
+    shm_block->hedge_requests[0]++;
+
+    n = ngx_max(shm_block->hedge_requests[0], shm_block->hedge_requests[1]);
+
+    shm_block->hedge_reserve = ngx_max((ngx_int_t) (n * budget),
+                                       NGX_JVM_ROUTE_RETRY_RESERVE * 100);
+}
+
+
+/*
+ * The first try of a request that may be hedged pays hedge_budget/100 of a
+ * hedge into the budget, and gets the hedge delay as the timeout of the
+ * response header if the budget has a hedge left and another peer may be
+ * tried.  Called under the lock of the block.
+ */
+
+static void
+ngx_http_upstream_jvm_route_hedge_arm(ngx_peer_connection_t *pc,
+    ngx_http_upstream_jvm_route_peer_data_t *jrp)
+{
+    ngx_http_upstream_jvm_route_shm_block_t  *shm_block;
+
+    shm_block = jrp->peers->shared;
+
+    jrp->hedge_timer = 0;
+
+    if (jrp->hedge_given) {
+        return;
+    }
+
+    jrp->hedge_given = 1;
+
+    ngx_http_upstream_jvm_route_hedge_count(shm_block, jrp->conf->hedge_budget);
+
+    shm_block->hedge_tokens += jrp->conf->hedge_budget;
+
+    if (shm_block->hedge_tokens > shm_block->hedge_reserve) {
+        shm_block->hedge_tokens = shm_block->hedge_reserve;
+    }
+
+    if (jrp->peers->hedge_percentile) {
+        ngx_http_upstream_jvm_route_hedge_update(jrp->peers);
+    }
+
+    if (pc->tries == 0 || shm_block->hedge_tokens < 100) {
+        return;
+    }
+
+    /* the hedge is paid for when the timer is armed, not when it fires */
+
+    shm_block->hedge_tokens -= 100;
+
+    jrp->hedge_timer = 1;
+    jrp->upstream->response_timeout = shm_block->hedge_delay;
+}
+
+
+/*
+ * A try that timed out on the hedge delay is not a failure of its peer: the
+ * request goes on to the next peer and the budget pays for it, and its time
+ * is counted at the delay, the least it would have taken.  The other tries
+ * count the time to their response header, which the delay is set on.
+ * Called under the lock of the block.
+ */
+
+static ngx_uint_t
+ngx_http_upstream_jvm_route_hedge_done(ngx_peer_connection_t *pc,
+    ngx_http_upstream_jvm_route_peer_data_t *jrp, ngx_uint_t state)
+{
+    ngx_msec_t                                ms;
+    ngx_http_upstream_state_t                *us;
+    ngx_http_upstream_jvm_route_shm_block_t  *shm_block;
+
+    shm_block = jrp->peers->shared;
+
+    if (jrp->hedge_timer
+        && (state & NGX_PEER_FAILED)
+        && pc->connection
+        && pc->connection->read->timedout)
+    {
+        jrp->hedge_timer = 0;
+
+        shm_block->total_hedged++;
+
+        if (jrp->peers->hedge_percentile) {
+            shm_block->hedge_times[ngx_http_upstream_jvm_route_hedge_bucket(
+                                       shm_block->hedge_delay)]++;
+            shm_block->hedge_samples++;
+        }
+
+        ngx_log_error(NGX_LOG_INFO, pc->log, 0,
+                "[upstream_jvm_route] \"%V\" of upstream \"%V\" has not "
+                "answered in %Mms, the request is hedged to another peer",
+                pc->name, jrp->peers->name, shm_block->hedge_delay);
+
+        return state & ~NGX_PEER_FAILED;
+    }
+
+    /* the try ended before the hedge delay: give the hedge back */
+
+    if (jrp->hedge_timer) {
+        jrp->hedge_timer = 0;
+
+        shm_block->hedge_tokens += 100;
+
+        if (shm_block->hedge_tokens > shm_block->hedge_reserve) {
+            shm_block->hedge_tokens = shm_block->hedge_reserve;
+        }
+    }
+
+    if (!jrp->peers->hedge_percentile || (state & NGX_PEER_FAILED)) {
+        return state;
+    }
+
+    /* set by the upstream once the response header of this try is read */
+
+    us = jrp->upstream->state;
+    ms = us ? us->header_time : (ngx_msec_t) -1;
+
+    if (ms != (ngx_msec_t) -1) {
+        shm_block->hedge_times[ngx_http_upstream_jvm_route_hedge_bucket(ms)]++;
+        shm_block->hedge_samples++;
+    }
+
+    return state;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_get_jvm_route_peer(ngx_peer_connection_t *pc, void *data)
+{
+    ngx_int_t                                ret;
+    ngx_uint_t                               n = 0;
+    ngx_atomic_t                            *lock;
+    ngx_http_upstream_jvm_route_peer_t      *peer = NULL;
+    ngx_http_upstream_jvm_route_peer_data_t *jrp = data;
+
+    if (jrp->current == NGX_PEER_INVALID) {
+        jrp->current = jrp->peers->current;
+    }
+
+    jrp->current = (jrp->current + 1) % jrp->peers->number;
+
+    if (jrp->hedge) {
+        jrp->upstream->response_timeout = 0;
+    }
+
+    lock = &jrp->peers->shared->lock;
+    ngx_spinlock(lock, ngx_pid, 1024);
+
+    ret = ngx_http_upstream_jvm_route_choose_peer(pc, jrp);
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, pc->log, 0, 
+            "[upstream_jvm_route] jrp->current = %d, peer_id = %d, ret = %d", 
+            jrp->current, jrp->index, ret);
+
+    pc->tries--;
+
+    if (ret == NGX_BUSY) {
+        ngx_log_error(NGX_LOG_ERR, pc->log, 0,
+                "[upstream_jvm_route] ALL the peers are busy now! "
+                "Flush all the peers' failure countor to zero.");
+
+        for (n = 0; n < jrp->peers->number; n++) {
+            jrp->peers->peer[n].shared->fails = 0;
+        }
+
+        pc->name = jrp->peers->name;
+        jrp->current = NGX_PEER_INVALID;
+        ngx_spinlock_unlock(lock);
+        return NGX_BUSY;
+    }
+
+    peer = &jrp->peers->peer[jrp->index];
+    jrp->current = jrp->index;
+
+    pc->sockaddr = peer->sockaddr;
+    pc->socklen = peer->socklen;
+    pc->name = &peer->name;
+
+    jrp->peers->current = jrp->current;
+
+    /* "kill -HUP" will generate a new peers */
+    if (jrp->peers != jrp->peers->shared->peers || 
+            jrp->peers->shared->generation != ngx_http_upstream_jvm_route_generation) {
+        ngx_spinlock_unlock(lock);
+        return ngx_http_upstream_jvm_route_get_cached(pc, peer);
+    }
+
+    peer->shared->last_req_id = jrp->peers->shared->total_requests;
+    ngx_http_upstream_jvm_route_update_nreq(jrp, 1, pc->log);
+    peer->shared->total_req++;
+
+    ngx_http_upstream_jvm_route_second(peer->shared)->requests++;
+    jrp->start = ngx_current_msec;
+
+    if (jrp->session && !jrp->counted) {
+        jrp->counted = 1;
+        ngx_http_upstream_jvm_route_session_count(jrp);
+    }
+
+    /* every request pays retry_budget/100 of a retry into the budget */
+
+    if (jrp->conf->retry_budget && !jrp->budgeted) {
+        jrp->budgeted = 1;
+
+        jrp->peers->shared->retry_tokens += jrp->conf->retry_budget;
+
+        if (jrp->peers->shared->retry_tokens > NGX_JVM_ROUTE_RETRY_RESERVE * 100) {
+            jrp->peers->shared->retry_tokens = NGX_JVM_ROUTE_RETRY_RESERVE * 100;
+        }
+    }
+
+    if (jrp->hedge) {
+        ngx_http_upstream_jvm_route_hedge_arm(pc, jrp);
+    }
+
+    ngx_spinlock_unlock(lock);
+
+    return ngx_http_upstream_jvm_route_get_cached(pc, peer);
+}
+
+
+static ngx_int_t
+ngx_http_upstream_jvm_route_get_cached(ngx_peer_connection_t *pc,
+    ngx_http_upstream_jvm_route_peer_t *peer)
+{
+    ngx_queue_t                          *q;
+    ngx_connection_t                     *c;
+    ngx_http_upstream_jvm_route_cache_t  *item;
+
+    if (peer->keepalive == NULL || ngx_queue_empty(&peer->keepalive->cache)) {
+        return NGX_OK;
+    }
+
+    /* the most recently used connection is the least likely to be closed */
+
+    q = ngx_queue_head(&peer->keepalive->cache);
+    ngx_queue_remove(q);
+
+    item = ngx_queue_data(q, ngx_http_upstream_jvm_route_cache_t, queue);
+    ngx_queue_insert_head(&peer->keepalive->free, q);
+
+    c = item->connection;
+
+    c->idle = 0;
+    c->data = NULL;
+    c->log = pc->log;
+    c->read->log = pc->log;
+    c->write->log = pc->log;
+    c->pool->log = pc->log;
+
+    if (c->read->timer_set) {
+        ngx_del_timer(c->read);
+    }
+
+    pc->connection = c;
+    pc->cached = 1;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "[upstream_jvm_route] get cached connection %p to \"%V\"",
+                   c, &peer->name);
+
+    return NGX_DONE;
+}
+
+
+static void
+ngx_http_upstream_jvm_route_keepalive_save(ngx_peer_connection_t *pc,
+    ngx_http_upstream_jvm_route_peer_data_t *jrp,
+    ngx_http_upstream_jvm_route_peer_t *peer, ngx_uint_t state)
+{
+    ngx_queue_t                          *q;
+    ngx_connection_t                     *c;
+    ngx_http_upstream_t                  *u;
+    ngx_http_upstream_jvm_route_cache_t  *item;
+
+    c = pc->connection;
+    u = jrp->upstream;
+
+    if (state & NGX_PEER_FAILED
+        || c == NULL
+        || c->read->eof
+        || c->read->error
+        || c->read->timedout
+        || c->write->error
+        || c->write->timedout)
+    {
+        return;
+    }
+
+    /* set by the upstream core and proxy_http_version 1.1, as for keepalive */
+
+    if (!u->keepalive || !u->request_body_sent) {
+        return;
+    }
+
+    if (ngx_terminate || ngx_exiting) {
+        return;
+    }
+
+    if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+        return;
+    }
+
+    if (ngx_queue_empty(&peer->keepalive->free)) {
+
+        /* the peer has max_idle connections cached, close the oldest */
+
+        q = ngx_queue_last(&peer->keepalive->cache);
+        ngx_queue_remove(q);
+
+        item = ngx_queue_data(q, ngx_http_upstream_jvm_route_cache_t, queue);
+
+        ngx_http_upstream_jvm_route_keepalive_close(item->connection);
+
+    } else {
+        q = ngx_queue_head(&peer->keepalive->free);
+        ngx_queue_remove(q);
+
+        item = ngx_queue_data(q, ngx_http_upstream_jvm_route_cache_t, queue);
+    }
+
+    ngx_queue_insert_head(&peer->keepalive->cache, q);
+
+    item->connection = c;
+
+    pc->connection = NULL;
+
+    c->read->delayed = 0;
+    ngx_add_timer(c->read, jrp->conf->idle_timeout);
+
+    if (c->write->timer_set) {
+        ngx_del_timer(c->write);
+    }
+
+    c->write->handler = ngx_http_upstream_jvm_route_keepalive_dummy_handler;
+    c->read->handler = ngx_http_upstream_jvm_route_keepalive_close_handler;
+
+    c->data = item;
+    c->idle = 1;
+    c->log = ngx_cycle->log;
+    c->read->log = ngx_cycle->log;
+    c->write->log = ngx_cycle->log;
+    c->pool->log = ngx_cycle->log;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "[upstream_jvm_route] cache connection %p to \"%V\"",
+                   c, &peer->name);
+
+    if (c->read->ready) {
+        ngx_http_upstream_jvm_route_keepalive_close_handler(c->read);
+    }
+}
+
+
+static void
+ngx_http_upstream_jvm_route_keepalive_dummy_handler(ngx_event_t *ev)
+{
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ev->log, 0,
+                   "[upstream_jvm_route] keepalive dummy handler");
+}
+
+
+static void
+ngx_http_upstream_jvm_route_keepalive_close_handler(ngx_event_t *ev)
+{
+    int                                   n;
+    char                                  buf[1];
+    ngx_connection_t                     *c;
+    ngx_http_upstream_jvm_route_cache_t  *item;
+
+    c = ev->data;
+
+    if (c->close || c->read->timedout) {
+        goto close;
+    }
+
+    /* the backend must not send anything on an idle connection */
+
+    n = recv(c->fd, buf, 1, MSG_PEEK);
+
+    if (n == -1 && ngx_socket_errno == NGX_EAGAIN) {
+        ev->ready = 0;
+
+        if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+            goto close;
+        }
+
+        return;
+    }
+
+close:
+
+    item = c->data;
+
+    ngx_http_upstream_jvm_route_keepalive_close(c);
+
+    ngx_queue_remove(&item->queue);
+    ngx_queue_insert_head(&item->keepalive->free, &item->queue);
+}
+
+
+static void
+ngx_http_upstream_jvm_route_keepalive_close(ngx_connection_t *c)
+{
+#if (NGX_HTTP_SSL)
+
+    if (c->ssl) {
+        c->ssl->no_wait_shutdown = 1;
+        c->ssl->no_send_shutdown = 1;
+
+        if (ngx_ssl_shutdown(c) == NGX_AGAIN) {
+            c->ssl->handler = ngx_http_upstream_jvm_route_keepalive_close;
+            return;
+        }
+    }
+
+#endif
+
+    ngx_destroy_pool(c->pool);
+    ngx_close_connection(c);
+}
+
+
+static void
+ngx_http_upstream_free_jvm_route_peer(ngx_peer_connection_t *pc, void *data,
+    ngx_uint_t state)
+{
+    ngx_atomic_t                                *lock;
+    ngx_http_upstream_jvm_route_peer_t          *peer;
+    ngx_http_upstream_jvm_route_second_t        *second;
+    ngx_http_upstream_jvm_route_peer_data_t     *jrp = data;
+
+    ngx_log_debug4(NGX_LOG_DEBUG_HTTP, pc->log, 0, 
+            "[upstream_jvm_route] jrp->current = %d, state = %ui, pc->tries = %d, pc->data = %p",
+        jrp->current, state, pc->tries, pc->data);
+
+    if (jrp->current == NGX_PEER_INVALID) {
+        return;
+    }
+
+    peer = &jrp->peers->peer[jrp->current];
+
+    if (peer->keepalive) {
+        ngx_http_upstream_jvm_route_keepalive_save(pc, jrp, peer, state);
+    }
+
+    lock = &jrp->peers->shared->lock;
+    ngx_spinlock(lock, ngx_pid, 1024);
+
+    /* "kill -HUP" will generate a new peers */
+    if (jrp->peers != jrp->peers->shared->peers || 
+            jrp->peers->shared->generation != ngx_http_upstream_jvm_route_generation) {
+        ngx_spinlock_unlock(lock);
+        return;
+    }
+
+    ngx_http_upstream_jvm_route_update_nreq(jrp, -1, pc->log);
+
+    if (jrp->peers->number == 1) {
+        pc->tries = 0;
+    }
+
+    if (jrp->hedge) {
+        state = ngx_http_upstream_jvm_route_hedge_done(pc, jrp, state);
+    }
+
+    second = ngx_http_upstream_jvm_route_second(peer->shared);
+
+    if (state & NGX_PEER_FAILED) {
+        second->fails++;
+
+    } else {
+        second->done++;
+        second->msec += (uint32_t) (ngx_current_msec - jrp->start);
+    }
+
+    if (state & NGX_PEER_FAILED) {
+        peer->shared->fails++;
+        peer->shared->total_fails++;
+        peer->shared->accessed = ngx_time();
+
+        if (peer->max_fails) {
+            peer->shared->current_weight -= peer->weight / peer->max_fails;
+        }
+
+        if (peer->shared->current_weight < 0) {
+            peer->shared->current_weight = 0;
+        }
+
+        /* a failure that may be retried takes a retry from the budget */
+
+        if (jrp->conf->retry_budget && pc->tries > 0) {
+
+            if (jrp->peers->shared->retry_tokens >= 100) {
+                jrp->peers->shared->retry_tokens -= 100;
+
+            } else {
+                ngx_log_error(NGX_LOG_WARN, pc->log, 0,
+                        "[upstream_jvm_route] the retry budget of "
+                        "upstream \"%V\" is exhausted", jrp->peers->name);
+
+                pc->tries = 0;
+            }
+        }
+    }
+
+    ngx_spinlock_unlock(lock);
+}
+
+
+#if (NGX_HTTP_SSL || NGX_STREAM_SSL)
+static ngx_int_t
+ngx_http_upstream_jvm_route_set_session(ngx_peer_connection_t *pc, void *data)
+{
+    size_t                                   len;
+    ngx_uint_t                               version;
+    const u_char                            *p;
+    ngx_atomic_t                            *lock;
+    ngx_ssl_session_t                       *ssl_session;
+    ngx_http_upstream_jvm_route_peer_t      *peer;
+    ngx_http_upstream_jvm_route_peer_data_t *jrp = data;
+
+    u_char  buf[NGX_JVM_ROUTE_SSL_SESSION_SIZE];
+
+    if (jrp->current == NGX_PEER_INVALID)
+        return NGX_OK;
+
+    peer = &jrp->peers->peer[jrp->current];
+
+    if (jrp->peers->shared == NULL) {
+        return ngx_ssl_set_session(pc->connection, peer->ssl_session);
+    }
+
+    /*
+     * Pick up a session saved by another worker.  Only the copy of the
+     * serialized session is made under the lock, so the saving worker may
+     * free the old one as soon as it has swapped the pointer; it is parsed
+     * once the lock is released.
+     */
+
+    lock = &jrp->peers->shared->lock;
+    ngx_spinlock(lock, ngx_pid, 1024);
+
+    version = peer->shared->ssl_session_version;
+
+    if (version == peer->ssl_session_version) {
+        ngx_spinlock_unlock(lock);
+        return ngx_ssl_set_session(pc->connection, peer->ssl_session);
+    }
+
+    len = 0;
+
+    if (peer->shared->ssl_session) {
+        len = peer->shared->ssl_session_len;
+        ngx_memcpy(buf, peer->shared->ssl_session, len);
+    }
+
+    ngx_spinlock_unlock(lock);
+
+    ssl_session = NULL;
+
+    if (len) {
+        p = buf;
+        ssl_session = d2i_SSL_SESSION(NULL, &p, len);
+    }
+
+    if (peer->ssl_session) {
+        ngx_ssl_free_session(peer->ssl_session);
+    }
+
+    peer->ssl_session = ssl_session;
+    peer->ssl_session_version = version;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "set session: %p, version:%ui",
+                   peer->ssl_session, peer->ssl_session_version);
+
+    return ngx_ssl_set_session(pc->connection, peer->ssl_session);
+}
+
+
+static void
+ngx_http_upstream_jvm_route_save_session(ngx_peer_connection_t *pc, void *data)
+{
+    int                                       len;
+    u_char                                   *buf, *old, *p;
+    ngx_atomic_t                             *lock;
+    ngx_ssl_session_t                        *old_ssl_session, *ssl_session;
+    ngx_http_upstream_jvm_route_peer_t       *peer;
+    ngx_http_upstream_jvm_route_peer_data_t  *jrp = data;
+
+    if (jrp->current == NGX_PEER_INVALID)
+        return;
+
+    /* the session came from the cache, there is nothing new to share */
+
+    if (SSL_session_reused(pc->connection->ssl->connection)) {
+        return;
+    }
+
+    ssl_session = ngx_ssl_get_session(pc->connection);
+
+    if (ssl_session == NULL) {
+        return;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "save session: %p", ssl_session);
+
+    peer = &jrp->peers->peer[jrp->current];
+
+    old_ssl_session = peer->ssl_session;
+    peer->ssl_session = ssl_session;
+
+    if (old_ssl_session) {
+        ngx_ssl_free_session(old_ssl_session);
+    }
+
+    if (jrp->peers->shared == NULL) {
+        return;
+    }
+
+    len = i2d_SSL_SESSION(ssl_session, NULL);
+
+    if (len <= 0 || len > NGX_JVM_ROUTE_SSL_SESSION_SIZE) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                       "session of %d bytes is not shared", len);
+        return;
+    }
+
+    buf = ngx_slab_alloc(jrp->peers->shpool, len);
+    if (buf == NULL) {
+        ngx_log_error(NGX_LOG_WARN, pc->log, 0,
+                      "[upstream_jvm_route] no room to share the session "
+                      "of \"%V\" in \"%V\"", &peer->name,
+                      &jrp->peers->shm_name);
+        return;
+    }
+
+    p = buf;
+    i2d_SSL_SESSION(ssl_session, &p);
+
+    lock = &jrp->peers->shared->lock;
+    ngx_spinlock(lock, ngx_pid, 1024);
+
+    old = peer->shared->ssl_session;
+
+    peer->shared->ssl_session = buf;
+    peer->shared->ssl_session_len = len;
+    peer->ssl_session_version = ++peer->shared->ssl_session_version;
+
+    ngx_spinlock_unlock(lock);
+
+    if (old) {
+        ngx_slab_free(jrp->peers->shpool, old);
+    }
+}
+#endif
+
+
+static void *
+ngx_http_upstream_jvm_route_create_conf(ngx_conf_t *cf)
+{
+    ngx_http_upstream_jvm_route_srv_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool,
+                       sizeof(ngx_http_upstream_jvm_route_srv_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    return conf;
+}
+
+
+static char *
+ngx_http_upstream_jvm_route_hash(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_str_t                              *value;
+    ngx_http_upstream_srv_conf_t           *uscf;
+    ngx_http_compile_complex_value_t        ccv;
+    ngx_http_upstream_jvm_route_srv_conf_t *ujrscf;
+
+    uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
+
+    ujrscf = ngx_http_conf_upstream_srv_conf(uscf,
+                                          ngx_http_upstream_jvm_route_module);
+
+    if (ujrscf->hash) {
+        return "is duplicate";
+    }
+
+    ujrscf->hash = 1;
+
+    if (cf->args->nelts == 1) {
+        /* the client address */
+        return NGX_CONF_OK;
+    }
+
+    value = cf->args->elts;
+
+    ujrscf->hash_key = ngx_palloc(cf->pool, sizeof(ngx_http_complex_value_t));
+    if (ujrscf->hash_key == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    ngx_memzero(&ccv, sizeof(ngx_http_compile_complex_value_t));
+
+    ccv.cf = cf;
+    ccv.value = &value[1];
+    ccv.complex_value = ujrscf->hash_key;
+
+    if (ngx_http_compile_complex_value(&ccv) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_upstream_jvm_route_local_group(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_str_t                              *value;
+    ngx_http_upstream_srv_conf_t           *uscf;
+    ngx_http_compile_complex_value_t        ccv;
+    ngx_http_upstream_jvm_route_srv_conf_t *ujrscf;
+
+    uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
+
+    ujrscf = ngx_http_conf_upstream_srv_conf(uscf,
+                                          ngx_http_upstream_jvm_route_module);
+
+    if (ujrscf->local_group) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    ujrscf->local_group = ngx_palloc(cf->pool, sizeof(ngx_http_complex_value_t));
+    if (ujrscf->local_group == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    ngx_memzero(&ccv, sizeof(ngx_http_compile_complex_value_t));
+
+    ccv.cf = cf;
+    ccv.value = &value[1];
+    ccv.complex_value = ujrscf->local_group;
+
+    if (ngx_http_compile_complex_value(&ccv) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_upstream_jvm_route_keepalive(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_int_t                               n;
+    ngx_str_t                              *value, s;
+    ngx_http_upstream_srv_conf_t           *uscf;
+    ngx_http_upstream_jvm_route_srv_conf_t *ujrscf;
+
+    uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
+
+    ujrscf = ngx_http_conf_upstream_srv_conf(uscf,
+                                          ngx_http_upstream_jvm_route_module);
+
+    if (ujrscf->max_idle) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    n = ngx_atoi(value[1].data, value[1].len);
+
+    if (n == NGX_ERROR || n == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid max_idle value \"%V\" in \"%V\" directive",
+                           &value[1], &cmd->name);
+        return NGX_CONF_ERROR;
+    }
+
+    ujrscf->max_idle = n;
+    ujrscf->idle_timeout = 60000;
+
+    if (cf->args->nelts == 3) {
+
+        if (ngx_strncmp(value[2].data, "idle_timeout=", 13) != 0) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid parameter \"%V\"", &value[2]);
+            return NGX_CONF_ERROR;
+        }
+
+        s.len = value[2].len - 13;
+        s.data = value[2].data + 13;
+
+        n = ngx_parse_time(&s, 0);
+
+        if (n == NGX_ERROR || n == 0) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid idle_timeout value \"%V\"", &value[2]);
+            return NGX_CONF_ERROR;
+        }
+
+        ujrscf->idle_timeout = n;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_upstream_jvm_route_tries(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_int_t                               n;
+    ngx_str_t                              *value;
+    ngx_http_upstream_srv_conf_t           *uscf;
+    ngx_http_upstream_jvm_route_srv_conf_t *ujrscf;
+
+    uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
+
+    ujrscf = ngx_http_conf_upstream_srv_conf(uscf,
+                                          ngx_http_upstream_jvm_route_module);
+
+    if (ujrscf->tries) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    n = ngx_atoi(value[1].data, value[1].len);
+
+    if (n == NGX_ERROR || n == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid value \"%V\" in \"%V\" directive",
+                           &value[1], &cmd->name);
+        return NGX_CONF_ERROR;
+    }
+
+    ujrscf->tries = n;
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_upstream_jvm_route_retry_budget(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    size_t                                  len;
+    ngx_int_t                               n;
+    ngx_str_t                              *value;
+    ngx_http_upstream_srv_conf_t           *uscf;
+    ngx_http_upstream_jvm_route_srv_conf_t *ujrscf;
+
+    uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
+
+    ujrscf = ngx_http_conf_upstream_srv_conf(uscf,
+                                          ngx_http_upstream_jvm_route_module);
+
+    if (ujrscf->retry_budget) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    len = value[1].len;
+
+    if (len && value[1].data[len - 1] == '%') {
+        len--;
+    }
+
+    n = ngx_atoi(value[1].data, len);
+
+    if (n == NGX_ERROR || n == 0 || n > 100) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid value \"%V\" in \"%V\" directive, "
+                           "it must be a percent from 1 to 100",
+                           &value[1], &cmd->name);
+        return NGX_CONF_ERROR;
+    }
+
+    ujrscf->retry_budget = n;
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_upstream_jvm_route_rps_sticky(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_str_t                              *value;
+    ngx_http_upstream_srv_conf_t           *uscf;
+    ngx_http_upstream_jvm_route_srv_conf_t *ujrscf;
+
+    uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
+
+    ujrscf = ngx_http_conf_upstream_srv_conf(uscf,
+                                          ngx_http_upstream_jvm_route_module);
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "spill") == 0) {
+        ujrscf->rps_keep = 0;
+
+    } else if (ngx_strcmp(value[1].data, "keep") == 0) {
+        ujrscf->rps_keep = 1;
+
+    } else {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid value \"%V\" in \"%V\" directive, "
+                           "it must be \"spill\" or \"keep\"",
+                           &value[1], &cmd->name);
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_upstream_jvm_route_resolve_interval(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_int_t                               n;
+    ngx_str_t                              *value;
+    ngx_http_upstream_srv_conf_t           *uscf;
+    ngx_http_upstream_jvm_route_srv_conf_t *ujrscf;
+
+    uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
+
+    ujrscf = ngx_http_conf_upstream_srv_conf(uscf,
+                                          ngx_http_upstream_jvm_route_module);
+
+    if (ujrscf->resolve_interval) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    n = ngx_parse_time(&value[1], 0);
+
+    if (n == NGX_ERROR || n == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid value \"%V\" in \"%V\" directive",
+                           &value[1], &cmd->name);
+        return NGX_CONF_ERROR;
+    }
+
+    ujrscf->resolve_interval = n;
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_upstream_jvm_route_zone(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ssize_t                                 size;
+    ngx_str_t                              *value;
+    ngx_http_upstream_srv_conf_t           *uscf;
+    ngx_http_upstream_main_conf_t          *umcf;
+    ngx_http_upstream_jvm_route_srv_conf_t *ujrscf;
+
+    uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
+    umcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_upstream_module);
+
+    ujrscf = ngx_http_conf_upstream_srv_conf(uscf,
+                                          ngx_http_upstream_jvm_route_module);
+
+    if (ujrscf->shm_zone) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (value[1].len == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid zone name \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    size = 0;
+
+    if (cf->args->nelts == 3) {
+        size = ngx_parse_size(&value[2]);
+
+        if (size == NGX_ERROR) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid zone size \"%V\"", &value[2]);
+            return NGX_CONF_ERROR;
+        }
+
+        if (size < (ssize_t) (8 * ngx_pagesize)) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "zone \"%V\" is too small", &value[1]);
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    ujrscf->shm_zone = ngx_shared_memory_add(cf, &value[1], size,
+                                             &ngx_http_upstream_jvm_route_module);
+    if (ujrscf->shm_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    ujrscf->shm_zone->init = ngx_http_upstream_jvm_route_init_zone;
+    ujrscf->shm_zone->data = umcf;
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_upstream_jvm_route_hot_sessions(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_int_t                               n;
+    ngx_str_t                              *value, s;
+    ngx_uint_t                              i, *limit;
+    ngx_http_upstream_srv_conf_t           *uscf;
+    ngx_http_upstream_jvm_route_srv_conf_t *ujrscf;
+
+    uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
+
+    ujrscf = ngx_http_conf_upstream_srv_conf(uscf,
+                                          ngx_http_upstream_jvm_route_module);
+
+    if (ujrscf->hot_sessions) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    n = ngx_atoi(value[1].data, value[1].len);
+
+    if (n == NGX_ERROR || n == 0 || n > NGX_JVM_ROUTE_HOT_SESSIONS_MAX) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid value \"%V\" in \"%V\" directive, "
+                           "it must be a number from 1 to %d",
+                           &value[1], &cmd->name,
+                           NGX_JVM_ROUTE_HOT_SESSIONS_MAX);
+        return NGX_CONF_ERROR;
+    }
+
+    ujrscf->hot_sessions = n;
+    ujrscf->session_status = NGX_HTTP_TOO_MANY_REQUESTS;
+
+    for (i = 2; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "status=", 7) == 0) {
+            n = ngx_atoi(value[i].data + 7, value[i].len - 7);
+
+            if (n < 400 || n > 599) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid status \"%V\", it must be "
+                                   "from 400 to 599", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            ujrscf->session_status = n;
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "max_rps=", 8) == 0) {
+            limit = &ujrscf->session_max_rps;
+            s.len = value[i].len - 8;
+            s.data = value[i].data + 8;
+
+        } else if (ngx_strncmp(value[i].data, "max_busy=", 9) == 0) {
+            limit = &ujrscf->session_max_busy;
+            s.len = value[i].len - 9;
+            s.data = value[i].data + 9;
+
+        } else {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid parameter \"%V\"", &value[i]);
+            return NGX_CONF_ERROR;
+        }
+
+        n = ngx_atoi(s.data, s.len);
+
+        if (n == NGX_ERROR || n == 0) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid parameter \"%V\"", &value[i]);
+            return NGX_CONF_ERROR;
+        }
+
+        *limit = n;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_upstream_jvm_route_shed(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    size_t                                  len;
+    ngx_int_t                               n;
+    ngx_str_t                              *value;
+    ngx_http_upstream_srv_conf_t           *uscf;
+    ngx_http_upstream_jvm_route_srv_conf_t *ujrscf;
+
+    uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
+
+    ujrscf = ngx_http_conf_upstream_srv_conf(uscf,
+                                          ngx_http_upstream_jvm_route_module);
+
+    if (ujrscf->shed) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    len = value[1].len;
+
+    if (len && value[1].data[len - 1] == '%') {
+        ujrscf->shed_percent = 1;
+        len--;
+    }
+
+    n = ngx_atoi(value[1].data, len);
 
-        n = 0;
+    if (n == NGX_ERROR || n == 0 || (ujrscf->shed_percent && n > 100)) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid value \"%V\" in \"%V\" directive, "
+                           "it must be a number of requests or a percent "
+                           "from 1 to 100", &value[1], &cmd->name);
+        return NGX_CONF_ERROR;
+    }
 
-        for (i = 0; i < us->servers->nelts; i++) {
-            if (server[i].backup) {
-                continue;
+    ujrscf->shed = n;
+    ujrscf->shed_status = NGX_HTTP_SERVICE_UNAVAILABLE;
+
+    if (cf->args->nelts == 3) {
+
+        if (ngx_strncmp(value[2].data, "status=", 7) != 0) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid parameter \"%V\"", &value[2]);
+            return NGX_CONF_ERROR;
+        }
+
+        n = ngx_atoi(value[2].data + 7, value[2].len - 7);
+
+        if (n < 400 || n > 599) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid status \"%V\", it must be "
+                               "from 400 to 599", &value[2]);
+            return NGX_CONF_ERROR;
+        }
+
+        ujrscf->shed_status = n;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_upstream_jvm_route_long_lived(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_int_t                               n;
+    ngx_str_t                              *value;
+    ngx_http_upstream_srv_conf_t           *uscf;
+    ngx_http_compile_complex_value_t        ccv;
+    ngx_http_upstream_jvm_route_srv_conf_t *ujrscf;
+
+    uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
+
+    ujrscf = ngx_http_conf_upstream_srv_conf(uscf,
+                                          ngx_http_upstream_jvm_route_module);
+
+    if (ujrscf->long_lived) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    ujrscf->long_lived = ngx_palloc(cf->pool, sizeof(ngx_http_complex_value_t));
+    if (ujrscf->long_lived == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    ngx_memzero(&ccv, sizeof(ngx_http_compile_complex_value_t));
+
+    ccv.cf = cf;
+    ccv.value = &value[1];
+    ccv.complex_value = ujrscf->long_lived;
+
+    if (ngx_http_compile_complex_value(&ccv) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (cf->args->nelts == 3) {
+
+        if (ngx_strncmp(value[2].data, "max_busy=", 9) != 0) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid parameter \"%V\"", &value[2]);
+            return NGX_CONF_ERROR;
+        }
+
+        n = ngx_atoi(value[2].data + 9, value[2].len - 9);
+
+        if (n == NGX_ERROR || n == 0) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid parameter \"%V\"", &value[2]);
+            return NGX_CONF_ERROR;
+        }
+
+        ujrscf->long_max_busy = n;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_upstream_jvm_route_hedge(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    u_char                                 *dot;
+    size_t                                  len;
+    ngx_int_t                               n, f;
+    ngx_str_t                              *value, s;
+    ngx_uint_t                              i;
+    ngx_http_upstream_srv_conf_t           *uscf;
+    ngx_http_upstream_jvm_route_srv_conf_t *ujrscf;
+
+    uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
+
+    ujrscf = ngx_http_conf_upstream_srv_conf(uscf,
+                                          ngx_http_upstream_jvm_route_module);
+
+    if (ujrscf->hedge_delay) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (value[1].len > 1 && value[1].data[0] == 'p') {
+
+        /* p99 or p99.9, kept in 1/10 percent */
+
+        len = value[1].len - 1;
+        dot = ngx_strlchr(value[1].data + 1, value[1].data + value[1].len, '.');
+        f = 0;
+
+        if (dot) {
+            len = dot - value[1].data - 1;
+            f = ngx_atoi(dot + 1, value[1].data + value[1].len - dot - 1);
+
+            if (f == NGX_ERROR || f > 9) {
+                goto invalid;
             }
+        }
 
-            n += server[i].naddrs;
+        n = ngx_atoi(value[1].data + 1, len);
+
+        if (n == NGX_ERROR || n > 99 || n * 10 + f == 0) {
+            goto invalid;
         }
 
-        peers = ngx_pcalloc(cf->pool, sizeof(ngx_http_upstream_jvm_route_peers_t)
-                              + sizeof(ngx_http_upstream_jvm_route_peer_t) * (n - 1));
-        if (peers == NULL) {
-            return NGX_ERROR;
+        ujrscf->hedge_percentile = n * 10 + f;
+        ujrscf->hedge_delay = 1000;
+
+    } else {
+        n = ngx_parse_time(&value[1], 0);
+
+        if (n == NGX_ERROR || n == 0) {
+            goto invalid;
         }
 
-        peers->number = n;
-        peers->name = &us->host;
+        ujrscf->hedge_delay = n;
+    }
 
-        n = 0;
+    ujrscf->hedge_budget = 5;
 
-        for (i = 0; i < us->servers->nelts; i++) {
-            for (j = 0; j < server[i].naddrs; j++) {
-                if (server[i].backup) {
-                    continue;
-                }
+    for (i = 2; i < cf->args->nelts; i++) {
 
-                peers->peer[n].sockaddr = server[i].addrs[j].sockaddr;
-                peers->peer[n].socklen = server[i].addrs[j].socklen;
-                peers->peer[n].name = server[i].addrs[j].name;
-                peers->peer[n].srun_id = server[i].srun_id;
-                peers->peer[n].max_fails = server[i].max_fails;
-                peers->peer[n].max_busy = server[i].max_busy;
-                peers->peer[n].fail_timeout = server[i].fail_timeout;
-                peers->peer[n].down = server[i].down;
-                peers->peer[n].weight = server[i].down ? 0 : server[i].weight;
+        if (ngx_strncmp(value[i].data, "max=", 4) == 0
+            && ujrscf->hedge_percentile)
+        {
+            s.len = value[i].len - 4;
+            s.data = value[i].data + 4;
 
-                n++;
+            n = ngx_parse_time(&s, 0);
+
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid_parameter;
             }
+
+            ujrscf->hedge_delay = n;
+
+            continue;
         }
 
-        us->peer.data = peers;
+        if (ngx_strncmp(value[i].data, "budget=", 7) == 0) {
+            len = value[i].len - 7;
 
-        ngx_sort(&peers->peer[0], (size_t) n,
-                 sizeof(ngx_http_upstream_jvm_route_peer_t),
-                 ngx_http_upstream_cmp_servers);
+            if (len && value[i].data[value[i].len - 1] == '%') {
+                len--;
+            }
 
-        /* backup servers */
+            n = ngx_atoi(value[i].data + 7, len);
 
-        n = 0;
+            if (n == NGX_ERROR || n == 0 || n > 100) {
+                goto invalid_parameter;
+            }
 
-        for (i = 0; i < us->servers->nelts; i++) {
-            if (!server[i].backup) {
-                continue;
+            ujrscf->hedge_budget = n;
+
+            continue;
+        }
+
+        goto invalid_parameter;
+    }
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid value \"%V\" in \"%V\" directive, "
+                       "it must be a time or a percentile such as p99",
+                       &value[1], &cmd->name);
+    return NGX_CONF_ERROR;
+
+invalid_parameter:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[i]);
+    return NGX_CONF_ERROR;
+}
+
+
+static char *
+ngx_http_upstream_jvm_route_sync(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_http_upstream_jvm_route_main_conf_t *ujrmcf = conf;
+
+    ngx_int_t    n;
+    ngx_str_t   *value, s;
+    ngx_url_t    u;
+    ngx_uint_t   i;
+    ngx_addr_t  *node;
+
+    if (ujrmcf->sync_listen) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    ujrmcf->sync_interval = 100;
+
+    ujrmcf->sync_nodes = ngx_array_create(cf->pool, 4, sizeof(ngx_addr_t));
+    if (ujrmcf->sync_nodes == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "interval=", 9) == 0) {
+
+            s.len = value[i].len - 9;
+            s.data = value[i].data + 9;
+
+            n = ngx_parse_time(&s, 0);
+
+            if (n == NGX_ERROR || n == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid interval value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
             }
 
-            n += server[i].naddrs;
+            ujrmcf->sync_interval = n;
+            continue;
         }
 
-        if (n == 0) {
-            return NGX_OK;
+        ngx_memzero(&u, sizeof(ngx_url_t));
+
+        u.url = value[i];
+
+        if (ngx_parse_url(cf->pool, &u) != NGX_OK) {
+            if (u.err) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "%s in \"%V\"", u.err, &value[i]);
+            }
+
+            return NGX_CONF_ERROR;
         }
 
-        backup = ngx_pcalloc(cf->pool, sizeof(ngx_http_upstream_jvm_route_peers_t)
-                              + sizeof(ngx_http_upstream_jvm_route_peer_t) * (n - 1));
-        if (backup == NULL) {
+        if (u.no_port || u.naddrs == 0) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "no port in \"%V\"", &value[i]);
+            return NGX_CONF_ERROR;
+        }
+
+        /* the first address is this node's, the others are the cluster */
+
+        if (ujrmcf->sync_listen == NULL) {
+            ujrmcf->sync_listen = &u.addrs[0];
+            ujrmcf->sync_node = ngx_murmur_hash2(u.addrs[0].name.data,
+                                                 u.addrs[0].name.len);
+            continue;
+        }
+
+        node = ngx_array_push(ujrmcf->sync_nodes);
+        if (node == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        *node = u.addrs[0];
+    }
+
+    if (ujrmcf->sync_nodes->nelts == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "no other nodes in \"%V\"", &cmd->name);
+        return NGX_CONF_ERROR;
+    }
+
+    ujrmcf->sync_last = ngx_pcalloc(cf->pool, ujrmcf->sync_nodes->nelts
+                            * sizeof(ngx_http_upstream_jvm_route_sync_node_t));
+    if (ujrmcf->sync_last == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_jvm_route_set_format(ngx_http_upstream_jvm_route_srv_conf_t *ujrscf,
+    ngx_str_t *value)
+{
+    u_char     *p;
+    size_t      len;
+    ngx_int_t   n;
+
+    p = value->data + sizeof("route_format=") - 1;
+    len = value->len - (sizeof("route_format=") - 1);
+
+    if (len == sizeof("suffix_after:.") - 1
+        && ngx_strncmp(p, "suffix_after:", 13) == 0)
+    {
+        ujrscf->route_format = NGX_JVM_ROUTE_SUFFIX_AFTER;
+        ujrscf->route_delimiter = p[13];
+        return NGX_OK;
+    }
+
+    if (len == sizeof("prefix_before:.") - 1
+        && ngx_strncmp(p, "prefix_before:", 14) == 0)
+    {
+        ujrscf->route_format = NGX_JVM_ROUTE_PREFIX_BEFORE;
+        ujrscf->route_delimiter = p[14];
+        return NGX_OK;
+    }
+
+    if (len > sizeof("prefix_len:") - 1
+        && ngx_strncmp(p, "prefix_len:", 11) == 0)
+    {
+        n = ngx_atoi(p + 11, len - 11);
+        if (n == NGX_ERROR || n == 0) {
             return NGX_ERROR;
         }
 
-        backup->number = n;
-        backup->name = &us->host;
+        ujrscf->route_format = NGX_JVM_ROUTE_PREFIX_LEN;
+        ujrscf->route_len = n;
+        return NGX_OK;
+    }
 
-        n = 0;
+    if (len == sizeof("jetty") - 1 && ngx_strncmp(p, "jetty", 5) == 0) {
+        ujrscf->route_format = NGX_JVM_ROUTE_JETTY;
+        ujrscf->route_delimiter = '.';
+        return NGX_OK;
+    }
 
-        for (i = 0; i < us->servers->nelts; i++) {
-            for (j = 0; j < server[i].naddrs; j++) {
-                if (!server[i].backup) {
-                    continue;
-                }
+    return NGX_ERROR;
+}
 
-                backup->peer[n].sockaddr = server[i].addrs[j].sockaddr;
-                backup->peer[n].socklen = server[i].addrs[j].socklen;
-                backup->peer[n].name = server[i].addrs[j].name;
-                backup->peer[n].weight = server[i].weight;
-                backup->peer[n].srun_id = server[i].srun_id;
-                backup->peer[n].max_fails = server[i].max_fails;
-                backup->peer[n].max_busy = server[i].max_busy;
-                backup->peer[n].fail_timeout = server[i].fail_timeout;
-                backup->peer[n].down = server[i].down;
 
-                n++;
-            }
+/*
+ * "$cookie_NAME[|session_url]" also looks for the session in the URI, under
+ * session_url or NAME.  Any other variable is taken as it is.
+ */
+static char *
+ngx_http_upstream_jvm_route_add_source(ngx_conf_t *cf,
+    ngx_http_upstream_jvm_route_srv_conf_t *ujrscf, ngx_str_t *value)
+{
+    u_char                                *p, *last;
+    ngx_str_t                              name;
+    ngx_http_upstream_jvm_route_source_t  *src;
+
+    src = ngx_array_push(ujrscf->sources);
+    if (src == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    name.data = value->data + 1;
+    last = value->data + value->len;
+
+    p = ngx_strlchr(name.data, last, '|');
+    name.len = (p ? p : last) - name.data;
+
+    src->name.len = 0;
+    src->name.data = NULL;
+
+    if (name.len > sizeof("cookie_") - 1
+        && ngx_strncmp(name.data, "cookie_", 7) == 0)
+    {
+        if (p && p + 1 < last) {
+            src->name.data = p + 1;
+            src->name.len = last - p - 1;
+
+        } else {
+            src->name.data = name.data + 7;
+            src->name.len = name.len - 7;
         }
 
-        peers->next = backup;
+    } else if (p) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "only a $cookie_ source can have a session_url "
+                           "in \"%V\"", value);
+        return NGX_CONF_ERROR;
+    }
+
+    if (name.len == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid session source \"%V\"", value);
+        return NGX_CONF_ERROR;
+    }
+
+    src->index = ngx_http_get_variable_index(cf, &name);
+    if (src->index == NGX_ERROR) {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_upstream_jvm_route(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_str_t                              *value;
+    ngx_uint_t                              i, format;
+    ngx_http_upstream_srv_conf_t           *uscf;
+    ngx_http_upstream_jvm_route_srv_conf_t *ujrscf;
+
+    value = cf->args->elts;
+
+    uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
+
+    ujrscf = ngx_http_conf_upstream_srv_conf(uscf,
+                                          ngx_http_upstream_jvm_route_module);
 
-        ngx_sort(&backup->peer[0], (size_t) n,
-                 sizeof(ngx_http_upstream_jvm_route_peer_t),
-                 ngx_http_upstream_cmp_servers);
+    if (ujrscf->sources) {
+        return "is duplicate";
+    }
 
-        return NGX_OK;
+    ujrscf->sources = ngx_array_create(cf->pool, 2,
+                                   sizeof(ngx_http_upstream_jvm_route_source_t));
+    if (ujrscf->sources == NULL) {
+        return NGX_CONF_ERROR;
     }
 
-    /* an upstream implicitly defined by proxy_pass, etc. */
+    format = 0;
 
-    if (us->port == 0 && us->default_port == 0) {
-        ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
-                      "no port in upstream \"%V\" in %s:%ui",
-                      &us->host, us->file_name, us->line);
-        return NGX_ERROR;
-    }
+    for (i = 1; i < cf->args->nelts; i++) {
 
-    ngx_memzero(&u, sizeof(ngx_url_t));
+        if (value[i].data[0] == '$') {
 
-    u.host = us->host;
-    u.port = (in_port_t) (us->port ? us->port : us->default_port);
+            if (format) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "session source \"%V\" must precede "
+                                   "the parameters", &value[i]);
+                return NGX_CONF_ERROR;
+            }
 
-    if (ngx_inet_resolve_host(cf->pool, &u) != NGX_OK) {
-        if (u.err) {
-            ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
-                          "%s in upstream \"%V\" in %s:%ui",
-                          u.err, &us->host, us->file_name, us->line);
+            if (ngx_http_upstream_jvm_route_add_source(cf, ujrscf, &value[i])
+                != NGX_CONF_OK)
+            {
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
         }
 
-        return NGX_ERROR;
-    }
+        if (format++) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "only one of \"reverse\" and \"route_format=\" "
+                               "can be specified");
+            return NGX_CONF_ERROR;
+        }
 
-    n = u.naddrs;
+        if (value[i].len == 7
+            && ngx_strncmp(value[i].data, "reverse", 7) == 0)
+        {
+            ujrscf->route_format = NGX_JVM_ROUTE_REVERSE;
+            continue;
+        }
 
-    peers = ngx_pcalloc(cf->pool, sizeof(ngx_http_upstream_jvm_route_peers_t)
-                              + sizeof(ngx_http_upstream_jvm_route_peer_t) * (n - 1));
-    if (peers == NULL) {
-        return NGX_ERROR;
-    }
+        if (ngx_strncmp(value[i].data, "route_format=", 13) == 0) {
+            if (ngx_http_upstream_jvm_route_set_format(ujrscf, &value[i])
+                != NGX_OK)
+            {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid route format \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
 
-    peers->number = n;
-    peers->name = &us->host;
+            continue;
+        }
 
-    for (i = 0; i < u.naddrs; i++) {
-        peers->peer[i].sockaddr = u.addrs[i].sockaddr;
-        peers->peer[i].socklen = u.addrs[i].socklen;
-        peers->peer[i].name = u.addrs[i].name;
-        peers->peer[i].weight = 1;
-        peers->peer[i].max_fails = 1;
-        peers->peer[i].max_busy = 0;
-        peers->peer[i].fail_timeout = 10;
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[i]);
+        return NGX_CONF_ERROR;
     }
 
-    us->peer.data = peers;
+    if (ujrscf->sources->nelts == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "no session source in \"jvm_route\"");
+        return NGX_CONF_ERROR;
+    }
 
-    /* implicitly defined upstream has no backup servers */
+    uscf->peer.init_upstream = ngx_http_upstream_init_jvm_route;
 
-    return NGX_OK;
+    uscf->flags = NGX_HTTP_UPSTREAM_CREATE 
+        | NGX_HTTP_UPSTREAM_MAX_FAILS
+        | NGX_HTTP_UPSTREAM_FAIL_TIMEOUT
+        | NGX_HTTP_UPSTREAM_SRUN_ID
+        | NGX_HTTP_UPSTREAM_MAX_BUSY
+        | NGX_HTTP_UPSTREAM_MAX_RPS
+        | NGX_HTTP_UPSTREAM_GROUP
+        | NGX_HTTP_UPSTREAM_RESOLVE
+        | NGX_HTTP_UPSTREAM_BUDDY
+        | NGX_HTTP_UPSTREAM_DOWN;
+
+    return NGX_CONF_OK;
 }
 
 
-static ngx_int_t 
-ngx_http_upstream_jvm_route_init_shm_zone(ngx_shm_zone_t *shm_zone, void *data)
+static size_t
+ngx_http_upstream_jvm_route_status_size(ngx_http_upstream_jvm_route_peers_t *peers)
 {
-    ngx_uint_t                              i;
-    ngx_atomic_t                           *lock;
-    ngx_slab_pool_t                        *shpool;
-    ngx_http_upstream_jvm_route_peers_t    *peers;
-    ngx_http_upstream_jvm_route_shm_block_t *shm_block;
-
-    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, shm_zone->shm.log, 0,
-            "[upstream_jvm_route] data:%p, shm_zone->data:%p", data, shm_zone->data);
+    size_t      size, len;
+    ngx_uint_t  i;
+
+    size = sizeof("upstream : total_busy = , total_requests = , "
+                  "current_peer: /, generation: \n\n") - 1
+           + peers->name->len + 5 * NGX_INT_T_LEN;
+
+    for (i = 0; i < peers->number; i++) {
+        size += sizeof(" peer : () down: , fails: /, busy: /, weight: /, "
+                       "total_req: , last_req: , total_fails: , "
+                       "fail_acc_time: ") - 1
+                + peers->peer[i].name.len + peers->peer[i].srun_id.len
+                + 12 * NGX_INT_T_LEN
+                + sizeof("Thu Jan  1 08:00:00 1970\n") - 1;
+
+        if (peers->long_lived) {
+            size += sizeof("long: /, ") - 1 + 2 * NGX_INT_T_LEN;
+        }
 
-    peers = shm_zone->data;
-    if (peers) {
+        size += sizeof("  last 1s/10s/60s: rps //, fails/s //, avg //ms\n") - 1
+                + 9 * (2 * NGX_INT_T_LEN + 2);
+    }
 
-        if (data == NULL) {
-            shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+    if (peers->shed) {
+        size += sizeof("\n shed:  requests without a session, above  busy\n")
+                - 1 + 2 * NGX_INT_T_LEN;
+    }
 
-            if (shm_zone->shm.exists) {
-                shm_zone->data = shpool->data;
-                return NGX_OK;
-            }
+    if (peers->hedge_delay) {
+        size += sizeof("\n hedge: delay ms, hedged: , budget: \n") - 1
+                + 3 * NGX_INT_T_LEN;
+    }
 
-            shm_block = ngx_slab_alloc(shpool, sizeof(*shm_block) +
-                    (peers->number - 1) * sizeof(ngx_http_upstream_jvm_route_shared_t));
+    if (peers->hot_sessions) {
+        len = 0;
 
-            if (shm_block == NULL) {
-                ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
-                        "upstream_jvm_route_shm_size is too small!");
-                return NGX_ERROR;
-            }
-        }
-        else {
-            /* kill -HUP */
-            shm_block = data;
+        for (i = 0; i < peers->number; i++) {
+            len = ngx_max(len, peers->peer[i].srun_id.len);
         }
 
-        shm_zone->data = shm_block;
-        peers->shared = shm_block;
+        size += sizeof("\n hot sessions: /\n") - 1 + 2 * NGX_INT_T_LEN
+                + peers->hot_sessions
+                  * (sizeof("  session 12345678 : peer (), rps: , busy: , "
+                            "limited: \n") - 1
+                     + NGX_JVM_ROUTE_SESSION_SHOWN + len + 4 * NGX_INT_T_LEN);
+    }
 
-        lock = &peers->shared->lock;
-        ngx_spinlock(lock, ngx_pid, 1024);
+    return size;
+}
 
-        shm_block->generation = ngx_http_upstream_jvm_route_generation + 1;
-        shm_block->peers = peers;
-        shm_block->total_nreq = 0;
-        shm_block->total_requests = 0;
 
-        for (i = 0; i < peers->number; i++) {
-            shm_block->stats[i].nreq = 0;
-            shm_block->stats[i].last_req_id = 0;
-            shm_block->stats[i].total_req = 0;
-            shm_block->stats[i].fails = 0;
-            shm_block->stats[i].total_fails = 0;
-            shm_block->stats[i].accessed = 0;
-            shm_block->stats[i].current_weight = peers->peer[i].weight;
+/*
+ * The requests and failures per second and the average time of the
+ * requests done over the last 1, 10 and 60 whole seconds of a peer.
+ */
 
-            peers->peer[i].shared = &peers->shared->stats[i];
-        }
+static u_char *
+ngx_http_upstream_jvm_route_status_rates(u_char *p,
+    ngx_http_upstream_jvm_route_shared_t *sh)
+{
+    uint32_t                               now;
+    ngx_uint_t                             i, n, r;
+    ngx_uint_t                             requests[3], fails[3], done[3];
+    ngx_uint_t                             msec[3];
+    ngx_http_upstream_jvm_route_second_t  *second;
 
-        ngx_spinlock_unlock(lock);
+    static ngx_uint_t  spans[3] = { 1, 10, 60 };
 
-        return NGX_OK;
+    now = (uint32_t) ngx_time();
+
+    for (i = 0; i < 3; i++) {
+        requests[i] = fails[i] = done[i] = msec[i] = 0;
     }
 
-    ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
-            "[upstream_jvm_route] can't find the peers!");
+    for (n = 1; n <= 60; n++) {
+        second = &sh->seconds[(now - n) & (NGX_JVM_ROUTE_SECONDS - 1)];
 
-    return NGX_ERROR;
-}
+        if (second->second != now - n) {
+            continue;
+        }
 
+        for (i = 0; i < 3; i++) {
+            if (n <= spans[i]) {
+                requests[i] += second->requests;
+                fails[i] += second->fails;
+                done[i] += second->done;
+                msec[i] += second->msec;
+            }
+        }
+    }
 
-static ngx_int_t
-ngx_http_upstream_init_jvm_route(ngx_conf_t *cf, ngx_http_upstream_srv_conf_t *us)
-{
-    u_char                                 *last;
-    ngx_str_t                              *shm_name;
-    ngx_uint_t                              shm_size;
-    ngx_shm_zone_t                         *shm_zone;
-    ngx_http_upstream_jvm_route_peers_t    *peers;
+    p = ngx_sprintf(p, "  last 1s/10s/60s: rps");
 
-    if (ngx_http_upstream_init_jvm_route_rr(cf, us) != NGX_OK) {
-        return NGX_ERROR;
+    for (i = 0; i < 3; i++) {
+        r = requests[i] * 10 / spans[i];
+        p = ngx_sprintf(p, "%c%ui.%ui", i ? '/' : ' ', r / 10, r % 10);
     }
 
-    peers = us->peer.data;
-    if (peers == NULL) {
-        ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
-                "[upstream_jvm_route] can't find the peers!");
-        return NGX_ERROR;
+    p = ngx_sprintf(p, ", fails/s");
+
+    for (i = 0; i < 3; i++) {
+        r = fails[i] * 10 / spans[i];
+        p = ngx_sprintf(p, "%c%ui.%ui", i ? '/' : ' ', r / 10, r % 10);
     }
 
-    peers->current = peers->number - 1;
-    shm_name = &peers->shm_name;
-    shm_name->data = ngx_palloc(cf->pool, SHM_NAME_LEN);
-    if (shm_name->data == NULL) {
-        return NGX_ERROR;
+    p = ngx_sprintf(p, ", avg");
+
+    for (i = 0; i < 3; i++) {
+        p = ngx_sprintf(p, "%c%ui", i ? '/' : ' ', done[i] ? msec[i] / done[i] : 0);
     }
 
-    /*add the share memory with the generation*/
-    last = ngx_snprintf(shm_name->data, SHM_NAME_LEN, "%V_%ui", peers->name, 
-	    ngx_http_upstream_jvm_route_generation + 1);
-    shm_name->len = last - shm_name->data;
+    return ngx_sprintf(p, "ms\n");
+}
 
-    shm_size = sizeof(ngx_http_upstream_jvm_route_shm_block_t) +
-            (peers->number - 1) * sizeof(ngx_http_upstream_jvm_route_shared_t);
-    
-    shm_size = ngx_align(shm_size, ngx_pagesize) + 8 * ngx_pagesize;
 
-    shm_zone = ngx_shared_memory_add(cf, shm_name, shm_size, 
-            &ngx_http_upstream_jvm_route_module);
-    if (shm_zone == NULL) {
-        return NGX_ERROR;
-    }
+/* the top sessions, the most requests per second first */
 
-    if (shm_zone->data) {
+static u_char *
+ngx_http_upstream_jvm_route_status_sessions(u_char *p,
+    ngx_http_upstream_jvm_route_peers_t *peers,
+    ngx_http_upstream_jvm_route_sessions_t *sessions)
+{
+    uint64_t                                    shown;
+    ngx_uint_t                                  i, n, max;
+    ngx_http_upstream_jvm_route_hot_session_t  *hs;
 
-        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-                   "[upstream_jvm_route] shm_zone: \"%V\" is already built.", 
-                   peers->name);
+    ngx_http_upstream_jvm_route_sessions_roll(sessions);
 
-        return NGX_ERROR;
-    }
+    p = ngx_sprintf(p, "\n hot sessions: %ui/%ui\n",
+                    sessions->number, sessions->size);
 
-    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, cf->log, 0,
-            "[upstream_jvm_route] upsteam:%V, shm_zone size:%ui", 
-            peers->name, shm_size);
+    shown = 0;
 
-    shm_zone->data = peers;
-    shm_zone->init = ngx_http_upstream_jvm_route_init_shm_zone;
+    for (n = 0; n < sessions->number; n++) {
+        max = NGX_PEER_INVALID;
 
-    us->peer.init = ngx_http_upstream_init_jvm_route_peer;
+        for (i = 0; i < sessions->number; i++) {
+            if (shown & ((uint64_t) 1 << i)) {
+                continue;
+            }
 
-    return NGX_OK;
+            if (max == NGX_PEER_INVALID
+                || sessions->top[i].rps > sessions->top[max].rps)
+            {
+                max = i;
+            }
+        }
+
+        shown |= (uint64_t) 1 << max;
+        hs = &sessions->top[max];
+
+        p = ngx_sprintf(p, "  session %*s %08xD: peer %ui(%V), rps: %ui, "
+                        "busy: %ui, limited: %ui\n",
+                        (size_t) hs->len, hs->session, hs->hash,
+                        hs->peer + 1, &peers->peer[hs->peer].srun_id, hs->rps,
+                        ngx_http_upstream_jvm_route_sketch_add(sessions->busy,
+                                                               hs->hash, 0),
+                        hs->limited);
+    }
+
+    return p;
 }
 
 
-static ngx_int_t
-ngx_http_upstream_jvm_route_get_session_value(ngx_http_request_t *r,
-    ngx_http_upstream_jvm_route_srv_conf_t *us, ngx_str_t *val)
+static u_char *
+ngx_http_upstream_jvm_route_status_upstream(u_char *p,
+    ngx_http_upstream_jvm_route_peers_t *peers)
 {
-    ngx_str_t *name, *uri;
-    ngx_int_t  i; 
-    size_t     offset;
-    u_char    *start;
+    ngx_uint_t                                i;
+    ngx_atomic_t                             *lock;
+    ngx_http_upstream_jvm_route_peer_t       *peer;
+    ngx_http_upstream_jvm_route_shared_t     *sh;
+    ngx_http_upstream_jvm_route_shm_block_t  *shm_block;
 
-    /* session in cookie */
-    if (ngx_http_complex_value(r, &us->cookie, val) != NGX_OK) {
-        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
-                "[upstream_jvm_route] compiles the session in cookie error!");
-        return NGX_ERROR;
-    }
+    shm_block = peers->shared;
 
-    /* session in url */
-    if (val->len == 0) {
+    lock = &shm_block->lock;
+    ngx_spinlock(lock, ngx_pid, 1024);
 
-        if (us->session_url.len != 0) {
-            name = &us->session_url;
-        }
-        else {
-            name = &us->session_cookie;
+    p = ngx_sprintf(p, 
+            "upstream %V: total_busy = %d, "
+            "total_requests = %ui, " 
+            "current_peer: %d/%d, " 
+            "generation: %d\n\n", 
+            peers->name, shm_block->total_nreq,
+            shm_block->total_requests,
+            peers->current + 1, peers->number,
+            shm_block->generation);
+
+    for (i = 0; i < peers->number; i++) {
+        peer = &peers->peer[i];
+        sh = peer->shared;
+        p = ngx_sprintf(p, 
+                " peer %d: %V(%V) " 
+                "down: %d, fails: %d/%d, busy: %d/%d, ",
+            i + 1, &peer->name, &peer->srun_id, 
+            peer->down, sh->fails, peer->max_fails, sh->nreq, peer->max_busy);
+
+        if (peers->long_lived) {
+            p = ngx_sprintf(p, "long: %ui/%ui, ",
+                            sh->long_nreq, peers->long_max_busy);
         }
 
-        uri = &r->unparsed_uri;
+        p = ngx_sprintf(p,
+                "weight: %d/%d, " 
+                "total_req: %ui, last_req: %ui, total_fails: %ui, fail_acc_time: %s",
+            sh->current_weight, peer->weight, 
+            sh->total_req, sh->last_req_id, sh->total_fails, ctime(&sh->accessed));
 
-        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                "[upstream jvm_route] URI: \"%V\", session_name: \"%V\"", uri, name);
-
-        start = ngx_strncasestrn(uri->data, name->data, uri->len, name->len);
-        if (start != NULL) {
-            start = start + name->len;
-            while (*start != '=') {
-                if (start >= (uri->data + uri->len)) {
-                    ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
-                            "upstream_jvm_route find the session in URI error!");
-                    return NGX_ERROR;
-                }
-                start++;
-            }
+        p = ngx_http_upstream_jvm_route_status_rates(p, sh);
+    }
 
-            start++;
-            offset = start - uri->data;
-            if (offset < uri->len) {
-                val->data = start;
+    if (peers->shed) {
+        p = ngx_sprintf(p, "\n shed: %ui requests without a session, "
+                        "above %ui busy\n", shm_block->total_shed, peers->shed);
+    }
 
-                i = ngx_strntok(start, "?&;", uri->len - offset, sizeof("?&;")-1);
-                if (i > 0) {
-                    val->len = i;
-                }
-                else {
-                    val->len = uri->len - offset;
-                }
-            }
-        }
+    if (peers->hedge_delay) {
+        p = ngx_sprintf(p, "\n hedge: delay %Mms, hedged: %ui, budget: %i\n",
+                        shm_block->hedge_delay, shm_block->total_hedged,
+                        shm_block->hedge_tokens / 100);
     }
 
-    if (val->len == 0) {
-        ngx_log_error(NGX_LOG_WARN, r->connection->log, 0,
-                "[upstream_jvm_route] can't find the session in cookie or URI!");
+    if (shm_block->sessions && shm_block->peers == peers) {
+        p = ngx_http_upstream_jvm_route_status_sessions(p, peers,
+                                                        shm_block->sessions);
     }
 
-    return NGX_OK;
+    ngx_spinlock_unlock(lock);
+
+    return p;
 }
 
 
 static ngx_int_t
-ngx_http_upstream_init_jvm_route_peer(ngx_http_request_t *r,
-    ngx_http_upstream_srv_conf_t *us)
+ngx_http_upstream_jvm_route_status_handler(ngx_http_request_t *r)
 {
-    ngx_str_t                                 val;
-    ngx_http_upstream_jvm_route_peer_data_t  *jrp;
-    ngx_http_upstream_jvm_route_peers_t      *jrps;
-    ngx_http_upstream_jvm_route_srv_conf_t   *ujrscf;
+    size_t             size;
+    ngx_int_t          rc;
+    ngx_str_t          filter;
+    ngx_uint_t         i, n, busy, requests;
+    ngx_buf_t         *b;
+    ngx_chain_t        out;
+    ngx_http_upstream_jvm_route_peers_t     **peersp;
+    ngx_http_upstream_jvm_route_loc_conf_t   *ujrlcf;
+    ngx_http_upstream_jvm_route_main_conf_t  *ujrmcf;
 
-    ujrscf = ngx_http_conf_upstream_srv_conf(us, ngx_http_upstream_jvm_route_module);
+    ujrlcf = ngx_http_get_module_loc_conf(r, ngx_http_upstream_jvm_route_module);
 
-    jrp = r->upstream->peer.data;
+    if (r->method != NGX_HTTP_GET && r->method != NGX_HTTP_HEAD) {
+        return NGX_HTTP_NOT_ALLOWED;
+    }
 
-    if (jrp == NULL) {
-        jrp = ngx_pcalloc(r->pool, sizeof(ngx_http_upstream_jvm_route_peer_data_t));
-        if (jrp == NULL) {
-            return NGX_ERROR;
-        }
+    rc = ngx_http_discard_request_body(r);
 
-        r->upstream->peer.data = jrp;
+    if (rc != NGX_OK) {
+        return rc;
     }
 
-    jrps = us->peer.data;
+    r->headers_out.content_type.len = sizeof("text/plain") - 1;
+    r->headers_out.content_type.data = (u_char *) "text/plain";
 
-    if (jrps == NULL || jrps->shared == NULL) {
-        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
-                "[upstream_jvm_route] peers or shm_zone data is NULL!");
+    if (r->method == NGX_HTTP_HEAD) {
+        r->headers_out.status = NGX_HTTP_OK;
 
-        return NGX_ERROR;
+        rc = ngx_http_send_header(r);
+
+        if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+            return rc;
+        }
     }
 
-    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                "[upstream_jvm_route] jrps:%p, shared:%p", jrps, jrps->shared);
+    /* the upstreams to show, bound at configuration time */
+
+    if (ujrlcf->peers) {
+        peersp = &ujrlcf->peers;
+        n = 1;
+
+    } else {
+        ujrmcf = ngx_http_get_module_main_conf(r,
+                                           ngx_http_upstream_jvm_route_module);
+        peersp = ujrmcf->upstreams.elts;
+        n = ujrmcf->upstreams.nelts;
+    }
+
+    /* the "upstream" argument picks one of them, the names are unique */
+
+    if (ujrlcf->peers == NULL
+        && ngx_http_arg(r, (u_char *) "upstream", sizeof("upstream") - 1,
+                        &filter) == NGX_OK)
+    {
+        for (i = 0; i < n; i++) {
+            if (filter.len == peersp[i]->name->len
+                && ngx_strncmp(filter.data, peersp[i]->name->data,
+                               filter.len) == 0)
+            {
+                break;
+            }
+        }
+
+        peersp += i;
+        n = (i < n) ? 1 : 0;
+    }
 
-    jrp->tried = ngx_bitvector_alloc(r->pool, jrps->number, &jrp->data);
+    size = sizeof("upstreams: , total_busy = , total_requests = \n") - 1
+           + 3 * NGX_INT_T_LEN;
 
-    if (ngx_http_upstream_jvm_route_get_session_value(r, ujrscf, &val) != NGX_OK) {
-        return NGX_ERROR;
-    } 
+    busy = 0;
+    requests = 0;
 
-    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-            "[upstream_jvm_route] session_cookie:\"%V\", session_url:\"%V\", session_value:\"%V\"",
-            &ujrscf->session_cookie, &ujrscf->session_url, &val);
+    for (i = 0; i < n; i++) {
+        busy += peersp[i]->shared->total_nreq;
+        requests += peersp[i]->shared->total_requests;
 
-    jrp->cookie = val;
-    jrp->current = jrps->current;
-    jrp->peers = jrps;
-    jrp->conf = ujrscf;
-    jrps->shared->total_requests++;
+        size += ngx_http_upstream_jvm_route_status_size(peersp[i]) + 1;
+    }
 
-    r->upstream->peer.get = ngx_http_upstream_get_jvm_route_peer;
-    r->upstream->peer.free = ngx_http_upstream_free_jvm_route_peer;
-    r->upstream->peer.tries = jrps->number;
+    b = ngx_create_temp_buf(r->pool, size);
+    if (b == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
 
-#if (NGX_HTTP_SSL)
-    r->upstream->peer.set_session =
-                               ngx_http_upstream_jvm_route_set_session;
-    r->upstream->peer.save_session =
-                               ngx_http_upstream_jvm_route_save_session;
-#endif
+    out.buf = b;
+    out.next = NULL;
 
-    return NGX_OK;
-}
+    if (ujrlcf->peers == NULL) {
+        b->last = ngx_sprintf(b->last,
+                "upstreams: %ui, total_busy = %ui, total_requests = %ui\n",
+                n, busy, requests);
+    }
 
+    for (i = 0; i < n; i++) {
 
-static ngx_int_t
-ngx_http_upstream_jvm_route_try_peer( ngx_http_upstream_jvm_route_peer_data_t *jrp,
-    ngx_uint_t peer_id)
-{
-    ngx_http_upstream_jvm_route_peer_t        *peer;
+        if (ujrlcf->peers == NULL) {
+            *b->last++ = '\n';
+        }
 
-    if (ngx_bitvector_test(jrp->tried, peer_id)) {
-        return NGX_BUSY;
+        b->last = ngx_http_upstream_jvm_route_status_upstream(b->last,
+                                                              peersp[i]);
     }
 
-    peer = &jrp->peers->peer[peer_id];
+    r->headers_out.status = NGX_HTTP_OK;
+    r->headers_out.content_length_n = b->last - b->pos;
 
-    if (peer->max_busy != 0 && peer->shared->nreq >= peer->max_busy) {
-        return NGX_BUSY;
-    }
+    b->last_buf = 1;
 
-    if (!peer->down) {
-        if (peer->max_fails == 0 || peer->shared->fails < peer->max_fails) {
-            return NGX_OK;
-        }
+    rc = ngx_http_send_header(r);
 
-        if (ngx_time() - peer->shared->accessed > peer->fail_timeout) {
-            peer->shared->fails = 0;
-            return NGX_OK;
-        }
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
     }
 
-    return NGX_BUSY;
+    return ngx_http_output_filter(r, &out);
 }
 
 
-static ngx_int_t
-ngx_http_upstream_choose_by_jvm_route(ngx_http_upstream_jvm_route_peer_data_t *jrp)
+static void *
+ngx_http_upstream_jvm_route_create_main_conf(ngx_conf_t *cf)
 {
-    ngx_uint_t                          i, n;
-    ngx_uint_t                          npeers = jrp->peers->number;
-    ngx_http_upstream_jvm_route_peer_t *peer;
+    ngx_http_upstream_jvm_route_main_conf_t  *conf;
 
-    for (i = 0, n = jrp->current; i < npeers; i++, n = (n+1)%npeers) {
-        peer = &jrp->peers->peer[n];
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_upstream_jvm_route_main_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
 
-        if (jrp->conf->reverse) {
-            if (ngx_strncmp_r(jrp->cookie.data, peer->srun_id.data,
-                        jrp->cookie.len, peer->srun_id.len) == 0){
-                if (ngx_http_upstream_jvm_route_try_peer(jrp, n) == NGX_OK) {
-                    return n;
-                }
-            }
-        }
-        else {
-            if (ngx_strncmp(jrp->cookie.data, peer->srun_id.data,
-                        peer->srun_id.len) == 0){
-                if (ngx_http_upstream_jvm_route_try_peer(jrp, n) == NGX_OK) {
-                    return n;
-                }
-            }
-        }
+    if (ngx_array_init(&conf->upstreams, cf->pool, 4,
+                       sizeof(ngx_http_upstream_jvm_route_peers_t *))
+        != NGX_OK)
+    {
+        return NULL;
     }
 
-    return NGX_PEER_INVALID;
+    if (ngx_array_init(&conf->status, cf->pool, 1,
+                       sizeof(ngx_http_upstream_jvm_route_loc_conf_t *))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
+    return conf;
 }
 
 
+/*
+ * The upstreams are initialized with the upstream main conf, before the
+ * postconfiguration: the status locations are bound to their peers here,
+ * so that a request does not look for them.
+ */
+
 static ngx_int_t
-ngx_http_upstream_choose_by_rr(ngx_http_upstream_jvm_route_peer_data_t *jrp)
+ngx_http_upstream_jvm_route_postconf(ngx_conf_t *cf)
 {
-    ngx_uint_t                          i, n, all_busy = 0;
-    ngx_uint_t                          npeers = jrp->peers->number;
-    ngx_http_upstream_jvm_route_peer_t *peer;
+    ngx_uint_t                                 i, j;
+    ngx_http_upstream_srv_conf_t             **uscfp;
+    ngx_http_upstream_main_conf_t             *umcf;
+    ngx_http_upstream_jvm_route_peers_t      **peersp;
+    ngx_http_upstream_jvm_route_loc_conf_t   **ujrlcfp;
+    ngx_http_upstream_jvm_route_main_conf_t   *ujrmcf;
 
-    peer = jrp->peers->peer;
-    while (1) {
-        for (i = 0, n = jrp->current; i < npeers; i++, n = (n+1)%npeers) {
+    umcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_upstream_module);
+    ujrmcf = ngx_http_conf_get_module_main_conf(cf,
+                                           ngx_http_upstream_jvm_route_module);
 
-            if (peer[n].shared->current_weight <= 0) {
-                continue;
-            }
+    uscfp = umcf->upstreams.elts;
 
-            if (ngx_http_upstream_jvm_route_try_peer(jrp, n) == NGX_OK) {
-                return n;
-            }
-        }
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
 
-        if (all_busy) {
-            return NGX_PEER_INVALID;
+        if (uscfp[i]->peer.init_upstream != ngx_http_upstream_init_jvm_route) {
+            continue;
         }
 
-        for (i = 0; i < npeers; i++) {
-            peer[i].shared->current_weight = peer[i].weight;
-            all_busy = 1;
+        peersp = ngx_array_push(&ujrmcf->upstreams);
+        if (peersp == NULL) {
+            return NGX_ERROR;
         }
+
+        *peersp = uscfp[i]->peer.data;
     }
 
-    return NGX_PEER_INVALID;
-}
+#if (NGX_STREAM)
+    if (ngx_stream_upstream_jvm_route_check_names(cf) != NGX_OK) {
+        return NGX_ERROR;
+    }
+#endif
 
+    peersp = ujrmcf->upstreams.elts;
+    ujrlcfp = ujrmcf->status.elts;
 
-static ngx_int_t
-ngx_http_upstream_jvm_route_choose_peer(ngx_peer_connection_t *pc, 
-        ngx_http_upstream_jvm_route_peer_data_t *jrp)
-{
-    ngx_uint_t                          n;
-    ngx_uint_t                          npeers = jrp->peers->number;
-    ngx_http_upstream_jvm_route_peer_t *peer;
+    for (i = 0; i < ujrmcf->status.nelts; i++) {
 
-    if (npeers == 1) {
-        n = 0;
-        goto chosen;
-    }
+        if (ujrlcfp[i]->shm_name.len == 0) {
+            continue;
+        }
 
-    if (jrp->cookie.len > 0) {
-        n = ngx_http_upstream_choose_by_jvm_route(jrp);
-        if (n != NGX_PEER_INVALID) {
-            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 
-                    0, "[upstream_jvm_route] choose peer %i by jvm_route", n);
-            goto chosen;
+        for (j = 0; j < ujrmcf->upstreams.nelts; j++) {
+            if (ujrlcfp[i]->shm_name.len == peersp[j]->name->len
+                && ngx_strncmp(ujrlcfp[i]->shm_name.data,
+                               peersp[j]->name->data,
+                               ujrlcfp[i]->shm_name.len) == 0)
+            {
+                ujrlcfp[i]->peers = peersp[j];
+                break;
+            }
         }
-    }
 
-    n = ngx_http_upstream_choose_by_rr(jrp);
-    if (n != NGX_PEER_INVALID) {
-        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 
-                0, "[upstream_jvm_route] choose peer %i by rr", n);
-        goto chosen;
+        if (ujrlcfp[i]->peers == NULL) {
+            ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                          "jvm_route_status: no jvm_route upstream \"%V\"",
+                          &ujrlcfp[i]->shm_name);
+            return NGX_ERROR;
+        }
     }
 
-    return NGX_BUSY;
-
-chosen:
-    ngx_bitvector_set(jrp->tried, n);
+    return NGX_OK;
+}
 
-    peer = &jrp->peers->peer[n];
-    if (peer->shared->current_weight > 0) {
-        peer->shared->current_weight--;
-    }
 
-    jrp->index = n;
+static void * 
+ngx_http_upstream_jvm_route_create_loc_conf(ngx_conf_t *cf)
+{
+    ngx_http_upstream_jvm_route_loc_conf_t  *conf;
 
-    return NGX_OK;
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_upstream_jvm_route_loc_conf_t));
+    if (conf == NULL) {
+        return NGX_CONF_ERROR;
+    }
+    
+    return conf;
 }
 
 
-static void
-ngx_http_upstream_jvm_route_update_nreq(ngx_http_upstream_jvm_route_peer_data_t *jrp, 
-        int delta, ngx_log_t *log)
+static char *
+ngx_http_upstream_jvm_route_set_status(ngx_conf_t *cf, 
+        ngx_command_t *cmd, void *conf)
 {
-    /* "kill -HUP" will generate a new peers */
-    if (jrp->peers == jrp->peers->shared->peers && 
-            jrp->peers->shared->generation == ngx_http_upstream_jvm_route_generation) {
+    ngx_http_upstream_jvm_route_loc_conf_t  *ujrlcf = conf;
+    ngx_http_core_loc_conf_t                *clcf;
+    ngx_str_t                               *value;
+    ngx_http_upstream_jvm_route_loc_conf_t **ujrlcfp;
+    ngx_http_upstream_jvm_route_main_conf_t *ujrmcf;
 
-        jrp->peers->peer[jrp->current].shared->nreq += delta;
-        jrp->peers->shared->total_nreq += delta;
+    value = cf->args->elts;
 
-#if NGX_DEBUG
-        ngx_uint_t                          nreq;
-        ngx_uint_t                          total_nreq;
+    if (cf->args->nelts == 2) {
+        ujrlcf->shm_name = value[1];
+    }
 
-        nreq = jrp->peers->peer[jrp->current].shared->nreq;
-        total_nreq = jrp->peers->shared->total_nreq;
+    ujrmcf = ngx_http_conf_get_module_main_conf(cf,
+                                           ngx_http_upstream_jvm_route_module);
 
-        ngx_log_debug6(NGX_LOG_DEBUG_HTTP, log, 0,
-                "[upstream_jvm_route] nreq for peer %ui @ %p/%p now %d, total %d, delta %d",
-                jrp->current, jrp->peers, jrp->peers->peer[jrp->current].shared, nreq,
-                total_nreq, delta);
-#endif
+    ujrlcfp = ngx_array_push(&ujrmcf->status);
+    if (ujrlcfp == NULL) {
+        return NGX_CONF_ERROR;
     }
+
+    *ujrlcfp = ujrlcf;
+
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+    clcf->handler = ngx_http_upstream_jvm_route_status_handler;
+
+    return NGX_CONF_OK;
 }
 
 
-static ngx_int_t
-ngx_http_upstream_get_jvm_route_peer(ngx_peer_connection_t *pc, void *data)
-{
-    ngx_int_t                                ret;
-    ngx_uint_t                               n = 0;
-    ngx_atomic_t                            *lock;
-    ngx_http_upstream_jvm_route_peer_t      *peer = NULL;
-    ngx_http_upstream_jvm_route_peer_data_t *jrp = data;
+#if (NGX_STREAM)
 
-    if (jrp->current == NGX_PEER_INVALID) {
-        jrp->current = jrp->peers->current;
-    }
+/*
+ * The stream counterpart, for Tomcats behind AJP or TLS passthrough: a
+ * stream upstream with jvm_route is balanced by the same peers, try_peer()
+ * and shared stats as an http one.  A stream server has no srun_id, so a
+ * connection keeps to the server of its key on the consistent hash ring,
+ * and its max_conns is the max_busy of the peer.
+ */
 
-    jrp->current = (jrp->current + 1) % jrp->peers->number;
+typedef struct {
+    /* what the selection reads, the same as for an http upstream */
+    ngx_http_upstream_jvm_route_srv_conf_t   conf;
 
-    lock = &jrp->peers->shared->lock;
-    ngx_spinlock(lock, ngx_pid, 1024);
+    /* the client address if NULL */
+    ngx_stream_complex_value_t              *key;
+} ngx_stream_upstream_jvm_route_srv_conf_t;
 
-    ret = ngx_http_upstream_jvm_route_choose_peer(pc, jrp);
+typedef struct {
+    /* the peers of every jvm_route stream upstream */
+    ngx_array_t                              upstreams;
+} ngx_stream_upstream_jvm_route_main_conf_t;
 
-    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, pc->log, 0, 
-            "[upstream_jvm_route] jrp->current = %d, peer_id = %d, ret = %d", 
-            jrp->current, jrp->index, ret);
 
-    pc->tries--;
+static void *ngx_stream_upstream_jvm_route_create_main_conf(ngx_conf_t *cf);
+static void *ngx_stream_upstream_jvm_route_create_conf(ngx_conf_t *cf);
+static ngx_int_t ngx_stream_upstream_jvm_route_postconf(ngx_conf_t *cf);
+static char *ngx_stream_upstream_jvm_route(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 
-    if (ret == NGX_BUSY) {
-        ngx_log_error(NGX_LOG_ERR, pc->log, 0,
-                "[upstream_jvm_route] ALL the peers are busy now! "
-                "Flush all the peers' failure countor to zero.");
 
-        for (n = 0; n < jrp->peers->number; n++) {
-            jrp->peers->peer[n].shared->fails = 0;
-        }
+static ngx_command_t  ngx_stream_upstream_jvm_route_commands[] = {
 
-        pc->name = jrp->peers->name;
-        jrp->current = NGX_PEER_INVALID;
-        ngx_spinlock_unlock(lock);
-        return NGX_BUSY;
-    }
+    { ngx_string("jvm_route"),
+      NGX_STREAM_UPS_CONF|NGX_CONF_NOARGS|NGX_CONF_TAKE1,
+      ngx_stream_upstream_jvm_route,
+      0,
+      0,
+      NULL },
 
-    peer = &jrp->peers->peer[jrp->index];
-    jrp->current = jrp->index;
+      ngx_null_command
+};
 
-    pc->sockaddr = peer->sockaddr;
-    pc->socklen = peer->socklen;
-    pc->name = &peer->name;
 
-    jrp->peers->current = jrp->current;
+static ngx_stream_module_t  ngx_stream_upstream_jvm_route_module_ctx = {
+    NULL,                                           /* preconfiguration */
+    ngx_stream_upstream_jvm_route_postconf,         /* postconfiguration */
 
-    /* "kill -HUP" will generate a new peers */
-    if (jrp->peers != jrp->peers->shared->peers || 
-            jrp->peers->shared->generation != ngx_http_upstream_jvm_route_generation) {
-        ngx_spinlock_unlock(lock);
-        return NGX_OK;
-    }
+    ngx_stream_upstream_jvm_route_create_main_conf, /* create main configuration */
+    NULL,                                           /* init main configuration */
 
-    peer->shared->last_req_id = jrp->peers->shared->total_requests;
-    ngx_http_upstream_jvm_route_update_nreq(jrp, 1, pc->log);
-    peer->shared->total_req++;
-    ngx_spinlock_unlock(lock);
+    ngx_stream_upstream_jvm_route_create_conf,      /* create server configuration */
+    NULL                                            /* merge server configuration */
+};
 
-    return NGX_OK;
-}
+
+ngx_module_t  ngx_stream_upstream_jvm_route_module = {
+    NGX_MODULE_V1,
+    &ngx_stream_upstream_jvm_route_module_ctx, /* module context */
+    ngx_stream_upstream_jvm_route_commands,    /* module directives */
+    NGX_STREAM_MODULE,                         /* module type */
+    NULL,                                      /* init master */
+    NULL,                                      /* init module */
+    NULL,                                      /* init process */
+    NULL,                                      /* init thread */
+    NULL,                                      /* exit thread */
+    NULL,                                      /* exit process */
+    NULL,                                      /* exit master */
+    NGX_MODULE_V1_PADDING
+};
 
 
-static void
-ngx_http_upstream_free_jvm_route_peer(ngx_peer_connection_t *pc, void *data,
-    ngx_uint_t state)
+static ngx_int_t
+ngx_stream_upstream_init_jvm_route(ngx_conf_t *cf,
+    ngx_stream_upstream_srv_conf_t *us)
 {
-    ngx_atomic_t                                *lock;
-    ngx_http_upstream_jvm_route_peer_t          *peer;
-    ngx_http_upstream_jvm_route_peer_data_t     *jrp = data;
+    ngx_uint_t                              i, j, n;
+    ngx_stream_upstream_server_t           *server;
+    ngx_http_upstream_jvm_route_peers_t    *peers;
 
-    ngx_log_debug4(NGX_LOG_DEBUG_HTTP, pc->log, 0, 
-            "[upstream_jvm_route] jrp->current = %d, state = %ui, pc->tries = %d, pc->data = %p",
-        jrp->current, state, pc->tries, pc->data);
+    server = us->servers ? us->servers->elts : NULL;
 
-    if (jrp->current == NGX_PEER_INVALID) {
-        return;
+    n = 0;
+
+    for (i = 0; server && i < us->servers->nelts; i++) {
+        n += server[i].naddrs;
     }
 
-    peer = &jrp->peers->peer[jrp->current];
-    lock = &jrp->peers->shared->lock;
-    ngx_spinlock(lock, ngx_pid, 1024);
+    if (n == 0) {
+        ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                      "no servers in upstream \"%V\" in %s:%ui",
+                      &us->host, us->file_name, us->line);
+        return NGX_ERROR;
+    }
 
-    /* "kill -HUP" will generate a new peers */
-    if (jrp->peers != jrp->peers->shared->peers || 
-            jrp->peers->shared->generation != ngx_http_upstream_jvm_route_generation) {
-        ngx_spinlock_unlock(lock);
-        return;
+    peers = ngx_pcalloc(cf->pool, sizeof(ngx_http_upstream_jvm_route_peers_t)
+                              + sizeof(ngx_http_upstream_jvm_route_peer_t) * (n - 1));
+    if (peers == NULL) {
+        return NGX_ERROR;
     }
 
-    ngx_http_upstream_jvm_route_update_nreq(jrp, -1, pc->log);
+    peers->number = n;
+    peers->name = &us->host;
 
-    if (jrp->peers->number == 1) {
-        pc->tries = 0;
-    }
+    n = 0;
 
-    if (state & NGX_PEER_FAILED) {
-        peer->shared->fails++;
-        peer->shared->total_fails++;
-        peer->shared->accessed = ngx_time();
+    for (i = 0; i < us->servers->nelts; i++) {
+        for (j = 0; j < server[i].naddrs; j++) {
+            peers->peer[n].sockaddr = server[i].addrs[j].sockaddr;
+            peers->peer[n].socklen = server[i].addrs[j].socklen;
+            peers->peer[n].name = server[i].addrs[j].name;
+            peers->peer[n].max_fails = server[i].max_fails;
+            peers->peer[n].max_busy = server[i].max_conns;
+            peers->peer[n].fail_timeout = server[i].fail_timeout;
+            peers->peer[n].down = server[i].down;
+            peers->peer[n].weight = server[i].down ? 0 : server[i].weight;
 
-        if (peer->max_fails) {
-            peer->shared->current_weight -= peer->weight / peer->max_fails;
+            n++;
         }
+    }
 
-        if (peer->shared->current_weight < 0) {
-            peer->shared->current_weight = 0;
-        }
+    ngx_sort(&peers->peer[0], (size_t) n,
+             sizeof(ngx_http_upstream_jvm_route_peer_t),
+             ngx_http_upstream_cmp_servers);
+
+    if (ngx_http_upstream_jvm_route_init_points(cf, peers) != NGX_OK) {
+        return NGX_ERROR;
     }
 
-    ngx_spinlock_unlock(lock);
+    if (ngx_http_upstream_jvm_route_init_hot(cf, peers, NGX_JVM_ROUTE_PREFIX)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    peers->current = peers->number - 1;
+
+    us->peer.init = ngx_stream_upstream_init_jvm_route_peer;
+    us->peer.data = peers;
+
+    return ngx_http_upstream_jvm_route_add_shm_zone(cf, peers, "stream_");
 }
 
 
-#if (NGX_HTTP_SSL)
 static ngx_int_t
-ngx_http_upstream_jvm_route_set_session(ngx_peer_connection_t *pc, void *data)
+ngx_stream_upstream_init_jvm_route_peer(ngx_stream_session_t *s,
+    ngx_stream_upstream_srv_conf_t *us)
 {
-    ngx_int_t                                rc;
-    ngx_ssl_session_t                       *ssl_session;
-    ngx_http_upstream_jvm_route_peer_t      *peer;
-    ngx_http_upstream_jvm_route_peer_data_t *jrp = data;
-
-    if (jrp->current == NGX_PEER_INVALID)
-        return NGX_OK;
-
-    peer = &jrp->peers->peer[jrp->current];
+    ngx_str_t                                  key;
+    ngx_uint_t                                 nelts;
+    ngx_atomic_t                              *lock;
+    ngx_http_upstream_jvm_route_peers_t       *jrps;
+    ngx_http_upstream_jvm_route_peer_data_t   *jrp;
+    ngx_stream_upstream_jvm_route_srv_conf_t  *sjrscf;
 
-    /* TODO: threads only mutex */
-    /* ngx_lock_mutex(jrp->peers->mutex); */
+    sjrscf = ngx_stream_conf_upstream_srv_conf(us,
+                                        ngx_stream_upstream_jvm_route_module);
 
-    ssl_session = peer->ssl_session;
+    jrps = us->peer.data;
 
-    rc = ngx_ssl_set_session(pc->connection, ssl_session);
+    if (jrps == NULL || jrps->shared == NULL) {
+        ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
+                "[upstream_jvm_route] peers or shm_zone data is NULL!");
 
-    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
-                   "set session: %p:%d",
-                   ssl_session, ssl_session ? ssl_session->references : 0);
+        return NGX_ERROR;
+    }
 
-    /* ngx_unlock_mutex(jrp->peers->mutex); */
+    nelts = ngx_bitvector_nelts(jrps->number);
 
-    return rc;
-}
+    jrp = ngx_pcalloc(s->connection->pool,
+                      sizeof(ngx_http_upstream_jvm_route_peer_data_t)
+                      + (nelts - 1) * sizeof(uintptr_t));
+    if (jrp == NULL) {
+        return NGX_ERROR;
+    }
 
+    jrp->tried = jrp->data;
 
-static void
-ngx_http_upstream_jvm_route_save_session(ngx_peer_connection_t *pc, void *data)
-{
-    ngx_ssl_session_t                        *old_ssl_session, *ssl_session;
-    ngx_http_upstream_jvm_route_peer_t       *peer;
-    ngx_http_upstream_jvm_route_peer_data_t  *jrp = data;
+    if (sjrscf->key == NULL) {
+        key = s->connection->addr_text;
 
-    if (jrp->current == NGX_PEER_INVALID)
-        return;
+    } else if (ngx_stream_complex_value(s, sjrscf->key, &key) != NGX_OK) {
+        return NGX_ERROR;
+    }
 
-    ssl_session = ngx_ssl_get_session(pc->connection);
+    /* without a key, no SNI for example, the connection is balanced */
 
-    if (ssl_session == NULL) {
-        return;
+    if (key.len && jrps->points) {
+        jrp->hash = ngx_murmur_hash2(key.data, key.len);
+        jrp->hashed = 1;
     }
 
-    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
-                   "save session: %p:%d", ssl_session, ssl_session->references);
-
-    peer = &jrp->peers->peer[jrp->current];
+    ngx_log_debug2(NGX_LOG_DEBUG_STREAM, s->connection->log, 0,
+            "[upstream_jvm_route] stream key:\"%V\", hash:%uD", &key, jrp->hash);
 
-    /* TODO: threads only mutex */
-    /* ngx_lock_mutex(jrp->peers->mutex); */
+    jrp->current = jrps->current;
+    jrp->peers = jrps;
+    jrp->conf = &sjrscf->conf;
 
-    old_ssl_session = peer->ssl_session;
-    peer->ssl_session = ssl_session;
+    lock = &jrps->shared->lock;
+    ngx_spinlock(lock, ngx_pid, 1024);
 
-    /* ngx_unlock_mutex(jrp->peers->mutex); */
+    jrps->shared->total_requests++;
 
-    if (old_ssl_session) {
+    ngx_spinlock_unlock(lock);
 
-        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
-                       "old session: %p:%d",
-                       old_ssl_session, old_ssl_session->references);
+    s->upstream->peer.data = jrp;
+    s->upstream->peer.get = ngx_http_upstream_get_jvm_route_peer;
+    s->upstream->peer.free = ngx_http_upstream_free_jvm_route_peer;
+    s->upstream->peer.tries = jrps->number;
 
-        /* TODO: may block */
+#if (NGX_STREAM_SSL)
+    s->upstream->peer.set_session = ngx_http_upstream_jvm_route_set_session;
+    s->upstream->peer.save_session = ngx_http_upstream_jvm_route_save_session;
+#endif
 
-        ngx_ssl_free_session(old_ssl_session);
-    }
+    return NGX_OK;
 }
-#endif
 
 
 static void *
-ngx_http_upstream_jvm_route_create_conf(ngx_conf_t *cf)
+ngx_stream_upstream_jvm_route_create_main_conf(ngx_conf_t *cf)
 {
-    ngx_http_upstream_jvm_route_srv_conf_t  *conf;
+    ngx_stream_upstream_jvm_route_main_conf_t  *conf;
 
     conf = ngx_pcalloc(cf->pool,
-                       sizeof(ngx_http_upstream_jvm_route_srv_conf_t));
+                       sizeof(ngx_stream_upstream_jvm_route_main_conf_t));
     if (conf == NULL) {
         return NULL;
     }
 
+    if (ngx_array_init(&conf->upstreams, cf->pool, 4,
+                       sizeof(ngx_http_upstream_jvm_route_peers_t *))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
     return conf;
 }
 
 
-static char *
-ngx_http_upstream_jvm_route(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+static void *
+ngx_stream_upstream_jvm_route_create_conf(ngx_conf_t *cf)
 {
-    ngx_str_t                              *value, *val_cookie;
-    ngx_uint_t                              i, len;
-    ngx_http_compile_complex_value_t        ccv;
-    ngx_http_upstream_srv_conf_t           *uscf;
-    ngx_http_upstream_jvm_route_srv_conf_t *ujrscf;
-
-    value = cf->args->elts;
-
-    uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
-
-    ujrscf = ngx_http_conf_upstream_srv_conf(uscf,
-                                          ngx_http_upstream_jvm_route_module);
-
-    if (value[1].len > 8 || ngx_strncmp(value[1].data, "$cookie_", 8) == 0 ) {
-        for (i = 8; i < value[1].len; i++) {
-            if (value[1].data[i] == '|') { 
-                break;
-            }
-        }
-
-        len = i;
-
-        ujrscf->session_cookie.data = &value[1].data[8] ;
-        ujrscf->session_cookie.len = len - 8;
-
-        if (len == value[1].len) {
-            val_cookie = &value[1];
-
-            ujrscf->session_url.data = NULL;
-            ujrscf->session_url.len = 0;
-        }
-        else {
-            val_cookie = ngx_palloc(cf->pool, sizeof(ngx_str_t));
-            if (val_cookie == NULL) {
-                return NGX_CONF_ERROR;
-            }
-            val_cookie->data = &value[1].data[0]; 
-            val_cookie->len = len; 
-
-            len ++;
-            ujrscf->session_url.data = &value[1].data[len];
-            ujrscf->session_url.len = value[1].len - len;
-        }
-    }
-    else {
-        return NGX_CONF_ERROR;
-    }
-
-    ngx_memzero(&ccv, sizeof(ngx_http_compile_complex_value_t));
-
-    ccv.cf = cf;
-    ccv.value = val_cookie;
-    ccv.complex_value = &ujrscf->cookie;
-
-    if (ngx_http_compile_complex_value(&ccv) != NGX_OK) {
-        return NGX_CONF_ERROR;
-    }
+    ngx_stream_upstream_jvm_route_srv_conf_t  *conf;
 
-    if (cf->args->nelts > 2) {
-        if (ngx_strncmp(value[2].data, "reverse", 7) == 0 ) {
-            ujrscf->reverse = 1;
-        }
+    conf = ngx_pcalloc(cf->pool,
+                       sizeof(ngx_stream_upstream_jvm_route_srv_conf_t));
+    if (conf == NULL) {
+        return NULL;
     }
 
-    uscf->peer.init_upstream = ngx_http_upstream_init_jvm_route;
-
-    uscf->flags = NGX_HTTP_UPSTREAM_CREATE 
-        | NGX_HTTP_UPSTREAM_MAX_FAILS
-        | NGX_HTTP_UPSTREAM_FAIL_TIMEOUT
-        | NGX_HTTP_UPSTREAM_SRUN_ID
-        | NGX_HTTP_UPSTREAM_DOWN;
-
-    return NGX_CONF_OK;
+    return conf;
 }
 
 
-extern volatile  ngx_cycle_t  *ngx_cycle;
+/* the stream upstreams are initialized with the stream upstream main conf */
 
-static ngx_shm_zone_t *
-ngx_shared_memory_find(ngx_str_t *name, void *tag)
+static ngx_int_t
+ngx_stream_upstream_jvm_route_postconf(ngx_conf_t *cf)
 {
-    ngx_uint_t        i;
-    ngx_shm_zone_t   *shm_zone;
-    ngx_list_part_t  *part;
+    ngx_uint_t                                  i;
+    ngx_stream_upstream_srv_conf_t            **uscfp;
+    ngx_stream_upstream_main_conf_t            *umcf;
+    ngx_http_upstream_jvm_route_peers_t       **peersp;
+    ngx_stream_upstream_jvm_route_main_conf_t  *sjrmcf;
 
-    part = (ngx_list_part_t *) & (ngx_cycle->shared_memory.part);
-    shm_zone = part->elts;
+    umcf = ngx_stream_conf_get_module_main_conf(cf, ngx_stream_upstream_module);
+    sjrmcf = ngx_stream_conf_get_module_main_conf(cf,
+                                        ngx_stream_upstream_jvm_route_module);
 
-    for (i = 0; /* void */ ; i++) {
-
-        if (i >= part->nelts) {
-            if (part->next == NULL) {
-                break;
-            }
-            part = part->next;
-            shm_zone = part->elts;
-            i = 0;
-        }
+    uscfp = umcf->upstreams.elts;
 
-        if (name->len != shm_zone[i].shm.name.len) {
-            continue;
-        }
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
 
-        if (ngx_strncmp(name->data, shm_zone[i].shm.name.data, name->len)
-            != 0)
-        {
+        if (uscfp[i]->peer.init_upstream != ngx_stream_upstream_init_jvm_route) {
             continue;
         }
 
-        if (tag != shm_zone[i].tag) {
-            continue;
+        peersp = ngx_array_push(&sjrmcf->upstreams);
+        if (peersp == NULL) {
+            return NGX_ERROR;
         }
 
-        return &shm_zone[i];
+        *peersp = uscfp[i]->peer.data;
     }
 
-    return NULL;
+    return ngx_stream_upstream_jvm_route_check_names(cf);
 }
 
 
-static ngx_int_t 
-ngx_http_upstream_jvm_route_status_handler(ngx_http_request_t *r)
-{
-    u_char            *last;
-    ngx_int_t          rc;
-    ngx_uint_t         i;
-    ngx_buf_t         *b;
-    ngx_str_t          shm_name;
-    ngx_chain_t        out;
-    ngx_atomic_t      *lock;
-    ngx_shm_zone_t    *shm_zone;
-    ngx_http_upstream_jvm_route_peers_t     *peers;
-    ngx_http_upstream_jvm_route_loc_conf_t  *ujrlcf;
-    ngx_http_upstream_jvm_route_shm_block_t *shm_block;
-
-    ujrlcf = ngx_http_get_module_loc_conf(r, ngx_http_upstream_jvm_route_module);
+/*
+ * jvm_route_status and jvm_route_sync find an upstream by its name alone,
+ * so a stream upstream may not be named as an http one; the postconf of
+ * whichever block comes last sees both and checks them.
+ */
 
-    if (r->method != NGX_HTTP_GET && r->method != NGX_HTTP_HEAD) {
-        return NGX_HTTP_NOT_ALLOWED;
-    }
+static ngx_int_t
+ngx_stream_upstream_jvm_route_check_names(ngx_conf_t *cf)
+{
+    ngx_uint_t                                  i, j;
+    ngx_http_upstream_jvm_route_peers_t       **http, **stream;
+    ngx_http_upstream_jvm_route_main_conf_t    *ujrmcf;
+    ngx_stream_upstream_jvm_route_main_conf_t  *sjrmcf;
 
-    rc = ngx_http_discard_request_body(r);
+    ujrmcf = ngx_http_cycle_get_module_main_conf(cf->cycle,
+                                           ngx_http_upstream_jvm_route_module);
+    sjrmcf = ngx_stream_cycle_get_module_main_conf(cf->cycle,
+                                        ngx_stream_upstream_jvm_route_module);
 
-    if (rc != NGX_OK) {
-        return rc;
+    if (ujrmcf == NULL || sjrmcf == NULL) {
+        return NGX_OK;
     }
 
-    r->headers_out.content_type.len = sizeof("text/plain") - 1;
-    r->headers_out.content_type.data = (u_char *) "text/plain";
-
-    if (r->method == NGX_HTTP_HEAD) {
-        r->headers_out.status = NGX_HTTP_OK;
+    http = ujrmcf->upstreams.elts;
+    stream = sjrmcf->upstreams.elts;
 
-        rc = ngx_http_send_header(r);
+    for (i = 0; i < sjrmcf->upstreams.nelts; i++) {
+        for (j = 0; j < ujrmcf->upstreams.nelts; j++) {
 
-        if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
-            return rc;
+            if (stream[i]->name->len == http[j]->name->len
+                && ngx_strncmp(stream[i]->name->data, http[j]->name->data,
+                               http[j]->name->len) == 0)
+            {
+                ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                              "jvm_route: the stream upstream \"%V\" has "
+                              "the name of an http jvm_route upstream",
+                              stream[i]->name);
+                return NGX_ERROR;
+            }
         }
     }
 
-    shm_name.data = ngx_palloc(r->pool, SHM_NAME_LEN);
-    if (shm_name.data == NULL) {
-        return NGX_HTTP_INTERNAL_SERVER_ERROR;
-    }
-
-    last = ngx_snprintf(shm_name.data, SHM_NAME_LEN, "%V_%ui", 
-	    &ujrlcf->shm_name, ngx_http_upstream_jvm_route_generation);
-    shm_name.len = last - shm_name.data;
-
-    shm_zone = ngx_shared_memory_find(&shm_name, &ngx_http_upstream_jvm_route_module);
+    return NGX_OK;
+}
 
-    if (shm_zone == NULL || shm_zone->data == NULL) {
 
-        ngx_log_error(NGX_LOG_EMERG, r->connection->log, 0,
-                "can not find the shared memory zone \"%V\" ", &shm_name);
+/*
+ * Once the whole configuration is read, the stream upstreams are added to
+ * the ones that jvm_route_status shows and jvm_route_sync sends.
+ */
 
-        return NGX_HTTP_INTERNAL_SERVER_ERROR;
-    }
+static ngx_int_t
+ngx_stream_upstream_jvm_route_add_upstreams(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                                  i;
+    ngx_http_upstream_jvm_route_peers_t       **peersp, **stream;
+    ngx_http_upstream_jvm_route_main_conf_t    *ujrmcf;
+    ngx_stream_upstream_jvm_route_main_conf_t  *sjrmcf;
 
-    shm_block = shm_zone->data;
-    peers = shm_block->peers;
+    ujrmcf = ngx_http_cycle_get_module_main_conf(cycle,
+                                           ngx_http_upstream_jvm_route_module);
+    sjrmcf = ngx_stream_cycle_get_module_main_conf(cycle,
+                                        ngx_stream_upstream_jvm_route_module);
 
-    b = ngx_create_temp_buf(r->pool, ngx_pagesize);
-    if (b == NULL) {
-        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    if (ujrmcf == NULL || sjrmcf == NULL) {
+        return NGX_OK;
     }
 
-    out.buf = b;
-    out.next = NULL;
-
-    lock = &peers->shared->lock;
-    ngx_spinlock(lock, ngx_pid, 1024);
+    stream = sjrmcf->upstreams.elts;
 
-    if (peers) {
-        b->last = ngx_sprintf(b->last, 
-                "upstream %V: total_busy = %d, "
-                "total_requests = %ui, " 
-                "current_peer: %d/%d, " 
-                "generation: %d\n\n", 
-                peers->name, shm_block->total_nreq,
-                shm_block->total_requests,
-                peers->current + 1, peers->number,
-                shm_block->generation);
-        
-        for (i = 0; i < peers->number; i++) {
-            ngx_http_upstream_jvm_route_peer_t *peer = &peers->peer[i];
-            ngx_http_upstream_jvm_route_shared_t *sh = peer->shared;
-            b->last = ngx_sprintf(b->last, 
-                    " peer %d: %V(%V) " 
-                    "down: %d, fails: %d/%d, busy: %d/%d, " 
-                    "weight: %d/%d, " 
-                    "total_req: %ui, last_req: %ui, total_fails: %ui, fail_acc_time: %s",
-                i + 1, &peer->name, &peer->srun_id, 
-                peer->down, sh->fails, peer->max_fails, sh->nreq, peer->max_busy,
-                sh->current_weight, peer->weight, 
-                sh->total_req, sh->last_req_id, sh->total_fails, ctime(&sh->accessed));
+    for (i = 0; i < sjrmcf->upstreams.nelts; i++) {
+        peersp = ngx_array_push(&ujrmcf->upstreams);
+        if (peersp == NULL) {
+            return NGX_ERROR;
         }
-    }
-    else {
-        b->last = ngx_sprintf(b->last, 
-                "upstream : total_busy = %ui, total_requests: %ui\n", 
-                shm_block->total_nreq, shm_block->total_requests);
+
+        *peersp = stream[i];
     }
 
-    ngx_spinlock_unlock(lock);
+    return NGX_OK;
+}
 
-    r->headers_out.status = NGX_HTTP_OK;
-    r->headers_out.content_length_n = b->last - b->pos;
 
-    b->last_buf = 1;
+static char *
+ngx_stream_upstream_jvm_route(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_str_t                                 *value;
+    ngx_stream_upstream_srv_conf_t            *uscf;
+    ngx_stream_compile_complex_value_t         ccv;
+    ngx_stream_upstream_jvm_route_srv_conf_t  *sjrscf;
 
-    rc = ngx_http_send_header(r);
+    uscf = ngx_stream_conf_get_module_srv_conf(cf, ngx_stream_upstream_module);
 
-    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
-        return rc;
+    if (uscf->peer.init_upstream == ngx_stream_upstream_init_jvm_route) {
+        return "is duplicate";
     }
 
-    return ngx_http_output_filter(r, &out);
-}
+    sjrscf = ngx_stream_conf_upstream_srv_conf(uscf,
+                                        ngx_stream_upstream_jvm_route_module);
 
+    uscf->peer.init_upstream = ngx_stream_upstream_init_jvm_route;
 
-static void * 
-ngx_http_upstream_jvm_route_create_loc_conf(ngx_conf_t *cf)
-{
-    ngx_http_upstream_jvm_route_loc_conf_t  *conf;
+    uscf->flags = NGX_STREAM_UPSTREAM_CREATE
+        | NGX_STREAM_UPSTREAM_WEIGHT
+        | NGX_STREAM_UPSTREAM_MAX_FAILS
+        | NGX_STREAM_UPSTREAM_FAIL_TIMEOUT
+        | NGX_STREAM_UPSTREAM_MAX_CONNS
+        | NGX_STREAM_UPSTREAM_DOWN;
 
-    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_upstream_jvm_route_loc_conf_t));
-    if (conf == NULL) {
-        return NGX_CONF_ERROR;
+    if (cf->args->nelts == 1) {
+        /* the client address */
+        return NGX_CONF_OK;
     }
-    
-    return conf;
-}
 
+    value = cf->args->elts;
 
-static char *
-ngx_http_upstream_jvm_route_set_status(ngx_conf_t *cf, 
-        ngx_command_t *cmd, void *conf)
-{
-    ngx_http_upstream_jvm_route_loc_conf_t  *ujrlcf = conf;
-    ngx_http_core_loc_conf_t                *clcf;
-    ngx_str_t                               *value;
+    sjrscf->key = ngx_palloc(cf->pool, sizeof(ngx_stream_complex_value_t));
+    if (sjrscf->key == NULL) {
+        return NGX_CONF_ERROR;
+    }
 
-    value = cf->args->elts;
+    ngx_memzero(&ccv, sizeof(ngx_stream_compile_complex_value_t));
 
-    ujrlcf->shm_name = value[1];
+    ccv.cf = cf;
+    ccv.value = &value[1];
+    ccv.complex_value = sjrscf->key;
 
-    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
-    clcf->handler = ngx_http_upstream_jvm_route_status_handler;
+    if (ngx_stream_compile_complex_value(&ccv) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
 
     return NGX_CONF_OK;
 }
+
+#endif